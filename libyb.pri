@@ -3,6 +3,7 @@ SOURCES += \
     $$PWD/libyb/descriptor.cpp \
     $$PWD/libyb/stream_parser.cpp \
     $$PWD/libyb/tunnel.cpp \
+    $$PWD/libyb/async/async_runner_pool.cpp \
     $$PWD/libyb/async/cancellation_token.cpp \
     $$PWD/libyb/async/descriptor_reader.cpp \
     $$PWD/libyb/async/device.cpp \
@@ -13,6 +14,8 @@ SOURCES += \
     $$PWD/libyb/async/timer.cpp \
     $$PWD/libyb/async/detail/parallel_composition_task.cpp \
     $$PWD/libyb/async/detail/task_impl.cpp \
+    $$PWD/libyb/async/detail/task_node_pool.cpp \
+    $$PWD/libyb/async/detail/task_trace.cpp \
     $$PWD/libyb/shupito/escape_sequence.cpp \
     $$PWD/libyb/shupito/flip2.cpp \
     $$PWD/libyb/usb/bulk_stream.cpp \
@@ -33,9 +36,14 @@ win32 {
         $$PWD/libyb/async/detail/win32_affinity_task.cpp \
         $$PWD/libyb/async/detail/win32_async_channel.cpp \
         $$PWD/libyb/async/detail/win32_async_runner.cpp \
+        $$PWD/libyb/async/detail/win32_concurrent_channel.cpp \
         $$PWD/libyb/async/detail/win32_handle_task.cpp \
+        $$PWD/libyb/async/detail/win32_runner_metrics.cpp \
         $$PWD/libyb/async/detail/win32_serial_port.cpp \
         $$PWD/libyb/async/detail/win32_sync_runner.cpp \
+        $$PWD/libyb/async/detail/win32_task_node_pool.cpp \
+        $$PWD/libyb/async/detail/win32_task_reaper.cpp \
+        $$PWD/libyb/async/detail/win32_task_trace.cpp \
         $$PWD/libyb/async/detail/win32_timer.cpp \
         $$PWD/libyb/async/detail/win32_wait_context.cpp \
         $$PWD/libyb/usb/detail/usb_request_context.cpp \
@@ -50,9 +58,17 @@ unix:!macx:!symbian {
     SOURCES += \
         $$PWD/libyb/async/detail/linux_async_channel.cpp \
         $$PWD/libyb/async/detail/linux_async_runner.cpp \
+        $$PWD/libyb/async/detail/linux_concurrent_channel.cpp \
+        $$PWD/libyb/async/detail/linux_epoll_set.cpp \
+        $$PWD/libyb/async/detail/linux_io_uring.cpp \
+        $$PWD/libyb/async/detail/linux_runner_metrics.cpp \
         $$PWD/libyb/async/detail/linux_serial_port.cpp \
         $$PWD/libyb/async/detail/linux_sync_runner.cpp \
+        $$PWD/libyb/async/detail/linux_task_node_pool.cpp \
+        $$PWD/libyb/async/detail/linux_task_reaper.cpp \
+        $$PWD/libyb/async/detail/linux_task_trace.cpp \
         $$PWD/libyb/async/detail/linux_timer.cpp \
+        $$PWD/libyb/async/detail/linux_timer_wheel.cpp \
         $$PWD/libyb/async/detail/linux_wait_context.cpp \
         $$PWD/libyb/usb/detail/linux_usb_context.cpp \
         $$PWD/libyb/usb/detail/linux_usb_device.cpp \
@@ -2,16 +2,74 @@
 #define LIBYB_ASYNC_ASYNC_RUNNER_HPP
 
 #include "task.hpp"
+#include "runner_stats.hpp"
 #include "../utils/noncopyable.hpp"
+#include <exception>
 #include <memory>
 #include <utility>
+#include <vector>
 
 namespace yb {
 
 class async_runner;
 
+// Selects the mechanism the dispatch thread uses to wait for poll items.
+// Backends that aren't available on the current platform
+// fall back to the default one.
+enum runner_backend_t
+{
+	rb_default,
+
+	// Collects the poll items of all tasks and waits for them
+	// on every iteration.
+	rb_poll,
+
+	// Keeps the poll items registered across iterations; only the tasks
+	// whose poll items fired or that were cancelled are prepared again.
+	// Tasks waiting for something other than a poll item must
+	// call `set_volatile` during the preparation.
+	rb_epoll,
+
+	// Like `rb_epoll`, but poll items are submitted to an io_uring
+	// and reads and writes attached to them are performed by the kernel
+	// as soon as the fd is ready. Falls back to `rb_poll` if the kernel
+	// doesn't support io_uring.
+	rb_io_uring,
+
+	// Waits for the handles of all tasks with `WaitForMultipleObjects`.
+	// The only backend available on Windows.
+	rb_wait_objects
+};
+
 namespace detail {
 
+// A callback that runs once a promise finishes, either on the dispatch
+// thread that finished it or, if it already has, on the thread
+// that registers it. The callback deletes itself; it must not throw,
+// an exception escaping it terminates the program.
+class async_completion
+	: noncopyable
+{
+public:
+	async_completion()
+		: m_next(0)
+	{
+	}
+
+	virtual void run() throw() = 0;
+
+protected:
+	virtual ~async_completion() {}
+
+private:
+	async_completion * m_next;
+
+	friend class async_promise_base;
+};
+
+template <typename T, typename F>
+class async_continuation;
+
 class async_promise_base
 	: noncopyable
 {
@@ -22,10 +80,12 @@ public:
 	void addref();
 	void release();
 
+	void set_runner(async_runner * runner);
 	void mark_finished();
 	void wait();
+	void add_completion(async_completion * c);
 	void cancel(cancel_level cl);
-	void perform_pending_cancels();
+	bool perform_pending_cancels();
 
 	virtual void prepare_wait(task_wait_preparation_context & ctx) = 0;
 	virtual bool finish_wait(task_wait_finalization_context & ctx) throw() = 0;
@@ -37,6 +97,8 @@ protected:
 private:
 	struct impl;
 	std::unique_ptr<impl> m_pimpl;
+
+	friend class yb::async_runner;
 };
 
 template <typename T>
@@ -192,6 +254,20 @@ public:
 			m_promise->cancel(cl);
 	}
 
+	// Calls `f(task_result<T>)` once the promise finishes, without
+	// blocking the calling thread. The callback runs on the runner's
+	// dispatch thread and must not block; if it throws, `std::terminate`
+	// is called. The future is consumed; the promise can no longer
+	// be waited for or cancelled through it.
+	template <typename F>
+	void on_complete(F f);
+
+	// Posts `f` to `runner` as a continuation of the promise, like `task::then`,
+	// once the promise finishes. The future is consumed; cancelling
+	// the returned future only cancels the continuation.
+	template <typename F>
+	async_future<typename detail::task_then_type<T, F>::unwrapped_type> then_on(async_runner & runner, F f);
+
 private:
 	detail::async_promise<T> * m_promise;
 	std::exception_ptr m_exception;
@@ -206,33 +282,20 @@ class async_runner
 	: noncopyable
 {
 public:
-	async_runner();
+	explicit async_runner(runner_backend_t backend = rb_default);
 	~async_runner();
 
+	// Returns the backend actually in use.
+	runner_backend_t backend() const;
+
+	// Starts or stops collecting the dispatch loop's statistics.
+	void enable_stats(bool enable = true);
+	runner_stats stats() const;
+
 	template <typename T>
 	async_future<T> post(task<T> && t)
 	{
-		assert(!t.empty());
-
-		try
-		{
-			std::unique_ptr<detail::async_promise<T>> promise(new detail::async_promise<T>(this));
-			if (t.has_result())
-			{
-				promise->set_task(std::move(t));
-				promise->mark_finished();
-				return async_future<T>(promise.release());
-			}
-
-			submit_context sc(*this);
-			promise->set_task(std::move(t));
-			sc.submit(promise.get());
-			return async_future<T>(promise.release());
-		}
-		catch (...)
-		{
-			return async_future<T>(std::current_exception());
-		}
+		return this->post(std::move(t), false);
 	}
 
 	template <typename T>
@@ -280,21 +343,215 @@ public:
 	}
 
 private:
+	// A stealable promise may be moved to another runner of the same pool
+	// until the dispatch thread prepares it for the first time.
+	template <typename T>
+	async_future<T> post(task<T> && t, bool stealable)
+	{
+		assert(!t.empty());
+
+		try
+		{
+			std::unique_ptr<detail::async_promise<T>> promise(new detail::async_promise<T>(this));
+			if (t.has_result())
+			{
+				promise->set_task(std::move(t));
+				promise->mark_finished();
+				return async_future<T>(promise.release());
+			}
+
+			submit_context sc(*this, stealable);
+			promise->set_task(std::move(t));
+
+			// The runner may finish and release the promise
+			// as soon as it's submitted.
+			async_future<T> res(promise.get());
+			sc.submit(promise.release());
+			return std::move(res);
+		}
+		catch (...)
+		{
+			return async_future<T>(std::current_exception());
+		}
+	}
+
+	// Submits a promise that was created in advance by `then_on`.
+	template <typename T>
+	void submit_continuation(detail::async_promise<T> * promise, task<T> && t)
+	{
+		promise->set_task(std::move(t));
+		if (promise->has_result())
+		{
+			promise->mark_finished();
+			return;
+		}
+
+		submit_context sc(*this, false);
+		sc.submit(promise);
+	}
+
 	struct submit_context
 		: noncopyable
 	{
-		submit_context(async_runner & runner);
+		submit_context(async_runner & runner, bool stealable);
 		~submit_context();
 		void submit(detail::async_promise_base * p);
 		async_runner & m_runner;
+		bool m_stealable;
 	};
 
+	// The number of promises posted to the runner that haven't finished yet.
+	size_t load() const;
+
+	// Links the runners of a pool together so that they can steal
+	// stealable promises from each other. The group must stay alive
+	// until the runner leaves it by joining a null group.
+	void join_group(std::vector<async_runner *> const * group);
+
 	struct impl;
 	std::unique_ptr<impl> m_pimpl;
 
 	friend class detail::async_promise_base;
+	friend class async_runner_pool;
+
+	template <typename T, typename F>
+	friend class detail::async_continuation;
 };
 
+namespace detail {
+
+template <typename T, typename F>
+class async_completion_fn
+	: public async_completion
+{
+public:
+	async_completion_fn(async_promise<T> * promise, F && f)
+		: m_promise(promise), m_f(std::move(f))
+	{
+		m_promise->addref();
+	}
+
+	void run() throw()
+	{
+		try
+		{
+			m_f(m_promise->get());
+		}
+		catch (...)
+		{
+			std::terminate();
+		}
+
+		delete this;
+	}
+
+	~async_completion_fn()
+	{
+		m_promise->release();
+	}
+
+private:
+	async_promise<T> * m_promise;
+	F m_f;
+};
+
+template <typename T, typename F>
+class async_continuation
+	: public async_completion
+{
+public:
+	typedef typename task_then_type<T, F>::unwrapped_type result_type;
+
+	async_continuation(async_promise<T> * source, async_promise<result_type> * target, async_runner & runner, F && f)
+		: m_source(source), m_target(target), m_runner(runner), m_f(std::move(f))
+	{
+		m_source->addref();
+		m_target->addref();
+	}
+
+	void run() throw()
+	{
+		task<result_type> t;
+		try
+		{
+			t = task<T>(m_source->get()).then(std::move(m_f));
+		}
+		catch (...)
+		{
+			t = async::raise<result_type>();
+		}
+
+		m_runner.submit_continuation(m_target, std::move(t));
+		delete this;
+	}
+
+	~async_continuation()
+	{
+		m_target->release();
+		m_source->release();
+	}
+
+private:
+	async_promise<T> * m_source;
+	async_promise<result_type> * m_target;
+	async_runner & m_runner;
+	F m_f;
+};
+
+} // namespace detail
+
+template <typename T>
+template <typename F>
+void async_future<T>::on_complete(F f)
+{
+	if (m_promise)
+	{
+		m_promise->add_completion(new detail::async_completion_fn<T, F>(m_promise, std::move(f)));
+	}
+	else
+	{
+		try
+		{
+			f(task_result<T>(m_exception));
+		}
+		catch (...)
+		{
+			std::terminate();
+		}
+	}
+
+	this->detach();
+}
+
+template <typename T>
+template <typename F>
+async_future<typename detail::task_then_type<T, F>::unwrapped_type> async_future<T>::then_on(async_runner & runner, F f)
+{
+	typedef typename detail::task_then_type<T, F>::unwrapped_type result_type;
+
+	if (!m_promise)
+	{
+		task_result<T> r(m_exception);
+		this->detach();
+		return runner.post(task<T>(std::move(r)).then(std::move(f)));
+	}
+
+	try
+	{
+		std::unique_ptr<detail::async_promise<result_type> > target(new detail::async_promise<result_type>(&runner));
+		std::unique_ptr<detail::async_continuation<T, F> > c(new detail::async_continuation<T, F>(m_promise, target.get(), runner, std::move(f)));
+
+		async_future<result_type> res(target.release());
+		m_promise->add_completion(c.release());
+		this->detach();
+		return std::move(res);
+	}
+	catch (...)
+	{
+		return async_future<result_type>(std::current_exception());
+	}
+}
+
 } // namespace yb
 
 #endif // LIBYB_ASYNC_ASYNC_RUNNER_HPP
@@ -0,0 +1,71 @@
+#include "async_runner_pool.hpp"
+#include <stdint.h>
+using namespace yb;
+
+async_runner_pool::async_runner_pool(size_t thread_count, runner_backend_t backend)
+{
+	if (thread_count == 0)
+		thread_count = 1;
+
+	m_runners.reserve(thread_count);
+	try
+	{
+		for (size_t i = 0; i < thread_count; ++i)
+			m_runners.push_back(new async_runner(backend));
+	}
+	catch (...)
+	{
+		for (size_t i = 0; i < m_runners.size(); ++i)
+			delete m_runners[i];
+		throw;
+	}
+
+	for (size_t i = 0; i < m_runners.size(); ++i)
+		m_runners[i]->join_group(&m_runners);
+}
+
+async_runner_pool::~async_runner_pool()
+{
+	// The runners must not steal from each other while they're being destroyed.
+	for (size_t i = 0; i < m_runners.size(); ++i)
+		m_runners[i]->join_group(0);
+	for (size_t i = 0; i < m_runners.size(); ++i)
+		delete m_runners[i];
+}
+
+size_t async_runner_pool::size() const
+{
+	return m_runners.size();
+}
+
+async_runner & async_runner_pool::operator[](size_t index)
+{
+	return *m_runners[index];
+}
+
+async_runner & async_runner_pool::runner_for(void const * affinity_key)
+{
+	// Objects are usually aligned, mix the bits before reducing.
+	uint32_t h = (uint32_t)((uintptr_t)affinity_key ^ ((uint64_t)(uintptr_t)affinity_key >> 32));
+	h ^= h >> 17;
+	h *= 0xed5ad4bb;
+	h ^= h >> 11;
+	return *m_runners[h % m_runners.size()];
+}
+
+async_runner & async_runner_pool::select_runner()
+{
+	size_t best = 0;
+	size_t best_load = m_runners[0]->load();
+	for (size_t i = 1; i < m_runners.size() && best_load != 0; ++i)
+	{
+		size_t load = m_runners[i]->load();
+		if (load < best_load)
+		{
+			best = i;
+			best_load = load;
+		}
+	}
+
+	return *m_runners[best];
+}
@@ -0,0 +1,95 @@
+#ifndef LIBYB_ASYNC_ASYNC_RUNNER_POOL_HPP
+#define LIBYB_ASYNC_ASYNC_RUNNER_POOL_HPP
+
+#include "async_runner.hpp"
+#include "../utils/noncopyable.hpp"
+#include <vector>
+#include <memory>
+
+namespace yb {
+
+// Spreads posted tasks across several async runners, each with its own
+// dispatch thread. A task never leaves the runner that started it.
+//
+// Tasks posted without an affinity key go to the least loaded runner;
+// until they're started, an idle runner may steal them. Tasks posted
+// with an affinity key always go to the same runner. Tasks that share
+// unsynchronized state (e.g. a device's dispatch loop and the transfers
+// it completes) must be posted with the same key.
+class async_runner_pool
+	: noncopyable
+{
+public:
+	explicit async_runner_pool(size_t thread_count, runner_backend_t backend = rb_default);
+	~async_runner_pool();
+
+	size_t size() const;
+	async_runner & operator[](size_t index);
+
+	async_runner & runner_for(void const * affinity_key);
+
+	template <typename T>
+	async_future<T> post(task<T> && t)
+	{
+		return this->select_runner().post(std::move(t), true);
+	}
+
+	template <typename T>
+	async_future<T> post(task<T> && t, void const * affinity_key)
+	{
+		return this->runner_for(affinity_key).post(std::move(t));
+	}
+
+	template <typename T>
+	void post_detached(task<T> && t)
+	{
+		async_future<T>(this->post(std::move(t))).detach();
+	}
+
+	template <typename T>
+	task_result<T> try_run(async_future<T> & f)
+	{
+		return f.try_get();
+	}
+
+	template <typename T>
+	task_result<T> try_run(task<T> && t)
+	{
+		async_future<T> f = this->post(std::move(t));
+		return this->try_run(f);
+	}
+
+	template <typename T>
+	T run(task<T> && t)
+	{
+		return this->try_run(std::move(t)).get();
+	}
+
+	template <typename T>
+	friend T operator <<(async_runner_pool & r, task<T> && t)
+	{
+		return r.run(std::move(t));
+	}
+
+	template <typename T>
+	friend async_future<T> operator|(async_runner_pool & r, task<T> && t)
+	{
+		return r.post(std::move(t));
+	}
+
+	template <typename T>
+	friend async_runner_pool & operator|=(async_runner_pool & r, task<T> && t)
+	{
+		r.post_detached(std::move(t));
+		return r;
+	}
+
+private:
+	async_runner & select_runner();
+
+	std::vector<async_runner *> m_runners;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_ASYNC_RUNNER_POOL_HPP
@@ -24,6 +24,17 @@ private:
 	cancel_level m_cl;
 };
 
+// The result of a task that didn't complete before its deadline.
+class task_timed_out
+	: public std::exception
+{
+public:
+	const char * what() const throw()
+	{
+		return "timed out";
+	}
+};
+
 } // namespace yb
 
 #endif // LIBYB_ASYNC_CANCEL_EXCEPTION_HPP
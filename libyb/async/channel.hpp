@@ -3,7 +3,9 @@
 
 #include "detail/channel_detail.hpp"
 #include "task.hpp"
+#include "../vector_ref.hpp"
 #include <stdexcept>
+#include <vector>
 
 namespace yb {
 
@@ -17,6 +19,8 @@ public:
 	channel_base(channel_base const & o);
 	channel_base & operator=(channel_base const & o);
 
+	size_t capacity() const;
+
 	task<T> receive() const;
 	task<void> send(task_result<T> && r) const;
 	task<void> send(task_result<T> const & r) const;
@@ -29,17 +33,30 @@ protected:
 	buffer_type * m_buffer;
 };
 
+// A channel with `dynamic_capacity` gets its capacity from `create`;
+// other channels are created without one.
 template <typename T, size_t Capacity = 1>
 class channel
 	: public channel_base<T, Capacity>
 {
 public:
 	static channel create();
+	static channel create(size_t capacity);
 
 	task<void> send(T const & value) const;
 	task<void> send(T && value) const;
 	using channel_base<T, Capacity>::send;
 
+	// Sends the values in order; the task completes once
+	// the last one is in the channel.
+	task<void> send_many(std::vector<T> && values) const;
+	task<void> send_many(vector_ref<T> const & values) const;
+
+	// Waits for at least one value and receives up to `max` values.
+	// A batch ends before an exception, which is raised by the next
+	// call instead.
+	task<std::vector<T> > receive_many(size_t max) const;
+
 private:
 	typedef typename channel_base<T, Capacity>::buffer_type buffer_type;
 	explicit channel(buffer_type * buffer);
@@ -51,6 +68,7 @@ class channel<void, Capacity>
 {
 public:
 	static channel create();
+	static channel create(size_t capacity);
 
 	task<void> send() const;
 	using channel_base<void, Capacity>::send;
@@ -94,13 +112,19 @@ channel_base<T, Capacity> & channel_base<T, Capacity>::operator=(channel_base co
 	return *this;
 }
 
+template <typename T, size_t Capacity>
+size_t channel_base<T, Capacity>::capacity() const
+{
+	return m_buffer->capacity();
+}
+
 template <typename T, size_t Capacity>
 task<T> channel_base<T, Capacity>::receive() const
 {
 	try
 	{
 		if (m_buffer->empty())
-			return task<T>(new channel_receive_task<T, Capacity>(m_buffer));
+			return task<T>::make(channel_receive_task<T, Capacity>(m_buffer));
 		else
 			return async::result(m_buffer->pop_front_move());
 	}
@@ -140,9 +164,17 @@ task<void> channel_base<T, Capacity>::send(task_result<T> const & r) const
 template <typename T, size_t Capacity>
 channel<T, Capacity> channel<T, Capacity>::create()
 {
+	static_assert(Capacity != dynamic_capacity, "channels with dynamic_capacity must be created with a capacity");
 	return channel<T, Capacity>(new buffer_type());
 }
 
+template <typename T, size_t Capacity>
+channel<T, Capacity> channel<T, Capacity>::create(size_t capacity)
+{
+	static_assert(Capacity == dynamic_capacity, "only channels with dynamic_capacity can be created with a capacity");
+	return channel<T, Capacity>(new buffer_type(capacity));
+}
+
 template <typename T, size_t Capacity>
 channel<T, Capacity>::channel(buffer_type * buffer)
 	: channel_base<T, Capacity>(buffer)
@@ -161,10 +193,68 @@ task<void> channel<T, Capacity>::send(T && value) const
 	return this->send(task_result<T>(std::move(value)));
 }
 
+template <typename T, size_t Capacity>
+task<void> channel<T, Capacity>::send_many(std::vector<T> && values) const
+{
+	try
+	{
+		size_t i = 0;
+		for (; i != values.size() && !this->m_buffer->full(); ++i)
+			this->m_buffer->push_back(task_result<T>(std::move(values[i])));
+
+		if (i == values.size())
+			return async::value();
+		return task<void>(new channel_send_many_task<T, Capacity>(this->m_buffer, std::move(values), i));
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
+}
+
+template <typename T, size_t Capacity>
+task<void> channel<T, Capacity>::send_many(vector_ref<T> const & values) const
+{
+	try
+	{
+		return this->send_many(std::vector<T>(values.begin(), values.end()));
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
+}
+
+template <typename T, size_t Capacity>
+task<std::vector<T> > channel<T, Capacity>::receive_many(size_t max) const
+{
+	assert(max != 0);
+
+	try
+	{
+		if (this->m_buffer->empty())
+			return task<std::vector<T> >::make(channel_receive_many_task<T, Capacity>(this->m_buffer, max));
+		else
+			return pop_front_many<T>(*this->m_buffer, max);
+	}
+	catch (...)
+	{
+		return async::raise<std::vector<T> >();
+	}
+}
+
 template <size_t Capacity>
 channel<void, Capacity> channel<void, Capacity>::create()
 {
-	return channel<void>(new buffer_type());
+	static_assert(Capacity != dynamic_capacity, "channels with dynamic_capacity must be created with a capacity");
+	return channel<void, Capacity>(new buffer_type());
+}
+
+template <size_t Capacity>
+channel<void, Capacity> channel<void, Capacity>::create(size_t capacity)
+{
+	static_assert(Capacity == dynamic_capacity, "only channels with dynamic_capacity can be created with a capacity");
+	return channel<void, Capacity>(new buffer_type(capacity));
 }
 
 template <size_t Capacity>
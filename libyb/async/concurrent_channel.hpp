@@ -0,0 +1,175 @@
+#ifndef LIBYB_ASYNC_CONCURRENT_CHANNEL_HPP
+#define LIBYB_ASYNC_CONCURRENT_CHANNEL_HPP
+
+#include "detail/concurrent_channel_detail.hpp"
+#include "task.hpp"
+
+namespace yb {
+
+enum channel_concurrency
+{
+	// Any number of threads may send and receive.
+	cc_mpmc,
+
+	// A single thread sends and a single thread receives;
+	// the ring then gets by without compare-and-swap.
+	cc_spsc
+};
+
+// A bounded channel that can be shared by threads, e.g. by a worker
+// thread and a runner. Unlike `channel`, the capacity is chosen
+// at runtime. Sending and receiving don't take any lock; a task
+// that has to wait for the other side waits on an event, which wakes
+// the runner that runs it.
+template <typename T, channel_concurrency Concurrency = cc_mpmc>
+class concurrent_channel
+{
+public:
+	// The capacity is rounded up to a power of two.
+	static concurrent_channel create(size_t capacity = 1);
+
+	~concurrent_channel();
+	concurrent_channel(concurrent_channel const & o);
+	concurrent_channel & operator=(concurrent_channel const & o);
+
+	size_t capacity() const;
+
+	task<T> receive() const;
+
+	task<void> send(task_result<T> && r) const;
+	task<void> send(task_result<T> const & r) const;
+	task<void> send(T && value) const;
+	task<void> send(T const & value) const;
+
+	// Sends the value unless the channel is full; can be called
+	// from threads that don't run a runner.
+	bool try_send(task_result<T> && r) const;
+	bool try_send(T && value) const;
+	bool try_send(T const & value) const;
+
+private:
+	typedef detail::concurrent_channel_buffer<T> buffer_type;
+
+	explicit concurrent_channel(buffer_type * buffer);
+
+	buffer_type * m_buffer;
+};
+
+} // namespace yb
+
+namespace yb {
+
+template <typename T, channel_concurrency Concurrency>
+concurrent_channel<T, Concurrency> concurrent_channel<T, Concurrency>::create(size_t capacity)
+{
+	return concurrent_channel(new buffer_type(capacity, Concurrency == cc_spsc));
+}
+
+template <typename T, channel_concurrency Concurrency>
+concurrent_channel<T, Concurrency>::concurrent_channel(buffer_type * buffer)
+	: m_buffer(buffer)
+{
+}
+
+template <typename T, channel_concurrency Concurrency>
+concurrent_channel<T, Concurrency>::~concurrent_channel()
+{
+	m_buffer->release();
+}
+
+template <typename T, channel_concurrency Concurrency>
+concurrent_channel<T, Concurrency>::concurrent_channel(concurrent_channel const & o)
+	: m_buffer(o.m_buffer)
+{
+	m_buffer->addref();
+}
+
+template <typename T, channel_concurrency Concurrency>
+concurrent_channel<T, Concurrency> & concurrent_channel<T, Concurrency>::operator=(concurrent_channel const & o)
+{
+	o.m_buffer->addref();
+	m_buffer->release();
+	m_buffer = o.m_buffer;
+	return *this;
+}
+
+template <typename T, channel_concurrency Concurrency>
+size_t concurrent_channel<T, Concurrency>::capacity() const
+{
+	return m_buffer->capacity();
+}
+
+template <typename T, channel_concurrency Concurrency>
+task<T> concurrent_channel<T, Concurrency>::receive() const
+{
+	typedef detail::concurrent_receive_op<T> op_type;
+
+	try
+	{
+		task<T> res = op_type()(*m_buffer);
+		if (res.has_result())
+			return std::move(res);
+		return task<T>::make(detail::concurrent_channel_task<T, op_type>(m_buffer, op_type()));
+	}
+	catch (...)
+	{
+		return async::raise<T>();
+	}
+}
+
+template <typename T, channel_concurrency Concurrency>
+task<void> concurrent_channel<T, Concurrency>::send(task_result<T> && r) const
+{
+	typedef detail::concurrent_send_op<T> op_type;
+
+	try
+	{
+		if (m_buffer->try_push(std::move(r)))
+			return async::value();
+		return task<void>::make(detail::concurrent_channel_task<T, op_type>(m_buffer, op_type(std::move(r))));
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
+}
+
+template <typename T, channel_concurrency Concurrency>
+task<void> concurrent_channel<T, Concurrency>::send(task_result<T> const & r) const
+{
+	return this->send(task_result<T>(r));
+}
+
+template <typename T, channel_concurrency Concurrency>
+task<void> concurrent_channel<T, Concurrency>::send(T && value) const
+{
+	return this->send(task_result<T>(std::move(value)));
+}
+
+template <typename T, channel_concurrency Concurrency>
+task<void> concurrent_channel<T, Concurrency>::send(T const & value) const
+{
+	return this->send(task_result<T>(value));
+}
+
+template <typename T, channel_concurrency Concurrency>
+bool concurrent_channel<T, Concurrency>::try_send(task_result<T> && r) const
+{
+	return m_buffer->try_push(std::move(r));
+}
+
+template <typename T, channel_concurrency Concurrency>
+bool concurrent_channel<T, Concurrency>::try_send(T && value) const
+{
+	return m_buffer->try_push(task_result<T>(std::move(value)));
+}
+
+template <typename T, channel_concurrency Concurrency>
+bool concurrent_channel<T, Concurrency>::try_send(T const & value) const
+{
+	return m_buffer->try_push(task_result<T>(value));
+}
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_CONCURRENT_CHANNEL_HPP
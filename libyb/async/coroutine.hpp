@@ -0,0 +1,20 @@
+#ifndef LIBYB_ASYNC_COROUTINE_HPP
+#define LIBYB_ASYNC_COROUTINE_HPP
+
+// With a compiler supporting C++20 coroutines, functions returning
+// `task<T>` can be written as coroutines. Such a coroutine can `co_await`
+// a `task<U>` (passed as an rvalue) and `co_return` its result;
+// exceptions thrown from the body complete the task with the exception.
+// The body starts running when the task is first waited for, so
+// the coroutine should take its parameters by value.
+//
+// Cancelling the task cancels the task the coroutine currently awaits,
+// as well as all tasks it awaits afterwards. The coroutine can query
+// the cancel level through `co_await current_cancel_level`.
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define LIBYB_ASYNC_HAS_COROUTINES 1
+#include "detail/coroutine_task.hpp"
+#endif
+
+#endif // LIBYB_ASYNC_COROUTINE_HPP
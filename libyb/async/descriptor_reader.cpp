@@ -12,7 +12,7 @@ struct handler
 	explicit handler(device & d)
 		: m_dev(d), m_out(channel<device_descriptor>::create()), m_registered(true)
 	{
-		m_reg = d.register_receiver(*this);
+		m_reg = d.register_receiver(*this, 0);
 	}
 
 	~handler()
@@ -23,9 +23,6 @@ struct handler
 
 	void handle_packet(packet const & p)
 	{
-		if (p[0] != 0)
-			return;
-
 		try
 		{
 			m_buffer.insert(m_buffer.end(), p.begin() + 1, p.end());
@@ -4,13 +4,14 @@
 #include "../task_base.hpp"
 #include "../cancel_exception.hpp"
 #include "../task.hpp"
+#include "task_node_pool.hpp"
 
 namespace yb {
 namespace detail {
 
 template <typename R>
 class cancel_level_upgrade_task
-	: public task_base<R>
+	: public task_base<R>, public pooled_task_node
 {
 public:
 	cancel_level_upgrade_task(task<R> && nested, cancel_level from, cancel_level to)
@@ -52,7 +53,7 @@ private:
 
 template <>
 class cancel_level_upgrade_task<void>
-	: public task_base<void>
+	: public task_base<void>, public pooled_task_node
 {
 public:
 	cancel_level_upgrade_task(task<void> && nested, cancel_level from, cancel_level to, bool catch_cancel = false)
@@ -4,6 +4,7 @@
 #include "../task_base.hpp"
 #include "../cancel_exception.hpp"
 #include "../../utils/noncopyable.hpp"
+#include "wait_context.hpp"
 
 namespace yb {
 namespace detail {
@@ -46,7 +47,9 @@ struct cancellation_token_core
 
 	void cancel(cancel_level cl)
 	{
+		// The runner must prepare the task again to notice.
 		m_task.cancel(cl);
+		invalidate_this_thread_preparations();
 	}
 };
 
@@ -3,6 +3,8 @@
 
 #include "circular_buffer.hpp"
 #include "../cancel_exception.hpp"
+#include <vector>
+#include <algorithm>
 
 namespace yb {
 
@@ -43,7 +45,10 @@ public:
 	void prepare_wait(task_wait_preparation_context & ctx)
 	{
 		if (m_buffer && m_buffer->full())
+		{
+			ctx.set_volatile();
 			return;
+		}
 
 		if (m_buffer)
 			m_buffer->push_back(std::move(m_value));
@@ -77,6 +82,12 @@ public:
 		m_buffer->addref();
 	}
 
+	channel_receive_task(channel_receive_task && o) throw()
+		: m_buffer(o.m_buffer)
+	{
+		o.m_buffer = 0;
+	}
+
 	~channel_receive_task()
 	{
 		if (m_buffer)
@@ -102,33 +113,193 @@ public:
 	void prepare_wait(task_wait_preparation_context & ctx)
 	{
 		if (m_buffer && m_buffer->empty())
-			return;
+			ctx.set_volatile();
+		else
+			ctx.set_finished();
+	}
 
+	task<T> finish_wait(task_wait_finalization_context &) throw()
+	{
 		if (!m_buffer)
+			return async::raise<T>(task_cancelled());
+
+		// Another receiver finalized in the same iteration
+		// may have taken the value already.
+		if (m_buffer->empty())
+			return nulltask;
+
+		task<T> res = async::result(std::move(m_buffer->front()));
+		m_buffer->pop_front();
+		return std::move(res);
+	}
+
+private:
+	buffer_type * m_buffer;
+
+	channel_receive_task(channel_receive_task const &);
+	channel_receive_task & operator=(channel_receive_task const &);
+};
+
+// Moves up to `max` values from the front of the buffer. The batch
+// ends before a result that holds an exception; such a result
+// is only taken (and raised) once it's at the front.
+template <typename T, typename Buffer>
+task<std::vector<T> > pop_front_many(Buffer & buffer, size_t max) throw()
+{
+	assert(!buffer.empty() && max != 0);
+	if (buffer.front().has_exception())
+		return async::raise<std::vector<T> >(buffer.pop_front_move().exception());
+
+	try
+	{
+		std::vector<T> res;
+		res.reserve((std::min)(max, buffer.size()));
+		while (res.size() != max && !buffer.empty() && buffer.front().has_value())
 		{
-			m_result = async::raise<T>(task_cancelled());
+			res.push_back(buffer.front().get());
+			buffer.pop_front();
 		}
-		else
+		return async::value(std::move(res));
+	}
+	catch (...)
+	{
+		return async::raise<std::vector<T> >();
+	}
+}
+
+template <typename T, size_t Capacity>
+class channel_send_many_task
+	: public task_base<void>
+{
+public:
+	typedef shared_circular_buffer<task_result<T>, Capacity> buffer_type;
+
+	// The values before `next` were sent already.
+	channel_send_many_task(buffer_type * buffer, std::vector<T> && values, size_t next)
+		: m_buffer(buffer), m_values(std::move(values)), m_next(next)
+	{
+		m_buffer->addref();
+	}
+
+	~channel_send_many_task()
+	{
+		if (m_buffer)
+			m_buffer->release();
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (cl >= cl_abort && m_buffer)
+		{
+			m_buffer->release();
+			m_buffer = 0;
+		}
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		this->cancel(cl_kill);
+		return task_result<void>();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_buffer)
 		{
-			m_result = async::result(std::move(m_buffer->front()));
-			m_buffer->pop_front();
+			for (; m_next != m_values.size() && !m_buffer->full(); ++m_next)
+				m_buffer->push_back(task_result<T>(std::move(m_values[m_next])));
+
+			if (m_next != m_values.size())
+			{
+				ctx.set_volatile();
+				return;
+			}
 		}
 
 		ctx.set_finished();
 	}
 
-	task<T> finish_wait(task_wait_finalization_context &) throw()
+	task<void> finish_wait(task_wait_finalization_context &) throw()
 	{
-		assert(!m_result.empty());
-		return std::move(m_result);
+		if (m_buffer)
+			return async::value();
+		else
+			return async::raise<void>(task_cancelled());
 	}
 
 private:
 	buffer_type * m_buffer;
-	task<T> m_result;
+	std::vector<T> m_values;
+	size_t m_next;
 
-	channel_receive_task(channel_receive_task const &);
-	channel_receive_task & operator=(channel_receive_task const &);
+	channel_send_many_task(channel_send_many_task const &);
+	channel_send_many_task & operator=(channel_send_many_task const &);
+};
+
+template <typename T, size_t Capacity>
+class channel_receive_many_task
+	: public task_base<std::vector<T> >
+{
+public:
+	typedef shared_circular_buffer<task_result<T>, Capacity> buffer_type;
+
+	channel_receive_many_task(buffer_type * buffer, size_t max)
+		: m_buffer(buffer), m_max(max)
+	{
+		m_buffer->addref();
+	}
+
+	channel_receive_many_task(channel_receive_many_task && o) throw()
+		: m_buffer(o.m_buffer), m_max(o.m_max)
+	{
+		o.m_buffer = 0;
+	}
+
+	~channel_receive_many_task()
+	{
+		if (m_buffer)
+			m_buffer->release();
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (cl >= cl_abort && m_buffer)
+		{
+			m_buffer->release();
+			m_buffer = 0;
+		}
+	}
+
+	task_result<std::vector<T> > cancel_and_wait() throw()
+	{
+		this->cancel(cl_kill);
+		return std::copy_exception(task_cancelled());
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_buffer && m_buffer->empty())
+			ctx.set_volatile();
+		else
+			ctx.set_finished();
+	}
+
+	task<std::vector<T> > finish_wait(task_wait_finalization_context &) throw()
+	{
+		if (!m_buffer)
+			return async::raise<std::vector<T> >(task_cancelled());
+
+		if (m_buffer->empty())
+			return nulltask;
+		return pop_front_many<T>(*m_buffer, m_max);
+	}
+
+private:
+	buffer_type * m_buffer;
+	size_t m_max;
+
+	channel_receive_many_task(channel_receive_many_task const &);
+	channel_receive_many_task & operator=(channel_receive_many_task const &);
 };
 
 } // namespace yb
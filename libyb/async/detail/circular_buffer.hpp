@@ -2,6 +2,8 @@
 #define LIBYB_ASYNC_DETAIL_CIRCULAR_BUFFER_HPP
 
 #include <type_traits>
+#include <algorithm>
+#include <new>
 #include <cstddef>
 
 namespace yb {
@@ -221,6 +223,139 @@ private:
 		>::type m_value;
 };
 
+// The capacity of buffers whose capacity is chosen at runtime.
+static size_t const dynamic_capacity = 0;
+
+// A buffer with a capacity chosen at runtime. The storage starts small
+// and doubles as the buffer fills up, until it reaches the capacity;
+// elements are moved to the new storage, so their move constructor
+// must not throw.
+template <typename T>
+class circular_buffer<T, dynamic_capacity>
+{
+public:
+	typedef T value_type;
+	static size_t const static_capacity = dynamic_capacity;
+
+	explicit circular_buffer(size_t capacity)
+		: m_capacity(capacity), m_first(0), m_size(0), m_storage_size(0), m_storage(0)
+	{
+		assert(capacity > 0);
+	}
+
+	~circular_buffer()
+	{
+		this->clear();
+		::operator delete(m_storage);
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	bool full() const
+	{
+		return m_size == m_capacity;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	size_t capacity() const
+	{
+		return m_capacity;
+	}
+
+	void clear()
+	{
+		while (!this->empty())
+			this->pop_front();
+	}
+
+	value_type & front()
+	{
+		assert(m_size > 0);
+		return m_storage[m_first];
+	}
+
+	value_type const & front() const
+	{
+		assert(m_size > 0);
+		return m_storage[m_first];
+	}
+
+	void pop_front()
+	{
+		assert(m_size > 0);
+		m_storage[m_first].~value_type();
+		m_first = this->index(1);
+		--m_size;
+	}
+
+	T pop_front_move()
+	{
+		T res(std::move(this->front()));
+		this->pop_front();
+		return std::move(res);
+	}
+
+	void push_back(value_type const & v)
+	{
+		this->emplace_back(v);
+	}
+
+	void push_back(value_type && v)
+	{
+		this->emplace_back(std::move(v));
+	}
+
+	template <typename U>
+	void emplace_back(U && v)
+	{
+		assert(m_size < m_capacity);
+		if (m_size == m_storage_size)
+			this->grow();
+		new(&m_storage[this->index(m_size)]) T(std::forward<U>(v));
+		++m_size;
+	}
+
+private:
+	size_t index(size_t offset) const
+	{
+		size_t i = m_first + offset;
+		return i >= m_storage_size? i - m_storage_size: i;
+	}
+
+	void grow()
+	{
+		size_t storage_size = (std::min)(m_storage_size? 2 * m_storage_size: 4, m_capacity);
+		T * storage = static_cast<T *>(::operator new(storage_size * sizeof(T)));
+		for (size_t i = 0; i < m_size; ++i)
+		{
+			T & v = m_storage[this->index(i)];
+			new(&storage[i]) T(std::move(v));
+			v.~T();
+		}
+
+		::operator delete(m_storage);
+		m_storage = storage;
+		m_storage_size = storage_size;
+		m_first = 0;
+	}
+
+	size_t m_capacity;
+	size_t m_first;
+	size_t m_size;
+	size_t m_storage_size;
+	T * m_storage;
+
+	circular_buffer(circular_buffer const &);
+	circular_buffer & operator=(circular_buffer const &);
+};
+
 template <typename T, size_t Capacity>
 class shared_circular_buffer
 	: public circular_buffer<T, Capacity>
@@ -231,6 +366,11 @@ public:
 	{
 	}
 
+	explicit shared_circular_buffer(size_t capacity)
+		: circular_buffer<T, Capacity>(capacity), m_refcount(1)
+	{
+	}
+
 	void addref()
 	{
 		++m_refcount;
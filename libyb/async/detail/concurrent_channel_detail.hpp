@@ -0,0 +1,292 @@
+#ifndef LIBYB_ASYNC_DETAIL_CONCURRENT_CHANNEL_DETAIL_HPP
+#define LIBYB_ASYNC_DETAIL_CONCURRENT_CHANNEL_DETAIL_HPP
+
+#include "../task_base.hpp"
+#include "../async_channel.hpp"
+#include "../cancel_exception.hpp"
+#include "../../utils/noncopyable.hpp"
+#include <new>
+#include <stdint.h>
+
+namespace yb {
+namespace detail {
+
+// Coordinates the slots of a bounded ring shared by threads;
+// the elements themselves are kept by the derived buffer.
+//
+// Elements are pushed and popped in two steps: `begin_push` claims
+// a ticket, the element is then constructed in the ticket's slot and
+// `end_push` publishes it. A multi-producer, multi-consumer ring keeps
+// a sequence number for each slot, a single-producer, single-consumer
+// ring only compares the positions.
+//
+// Tasks that find the ring empty (or full) register themselves
+// as waiters and wait for the corresponding event. The threads that
+// push or pop an element only set the event if someone waits.
+class concurrent_channel_core
+	: noncopyable
+{
+public:
+	enum waiter_kind
+	{
+		wk_receiver,
+		wk_sender
+	};
+
+	// The capacity is rounded up to a power of two.
+	concurrent_channel_core(size_t capacity, bool spsc);
+	virtual ~concurrent_channel_core();
+
+	void addref() throw();
+	void release() throw();
+
+	size_t capacity() const throw() { return (size_t)m_mask + 1; }
+
+	// Registers a waiter; returns false instead if the ring
+	// is no longer empty (or full).
+	bool begin_wait(waiter_kind kind);
+	void end_wait(waiter_kind kind) throw();
+
+	// Completes once an element may be available (or a slot may be free)
+	// to a waiter registered with `begin_wait`.
+	task<void> wait(waiter_kind kind);
+
+protected:
+	size_t slot(uint32_t ticket) const throw() { return ticket & m_mask; }
+
+	bool begin_push(uint32_t & ticket) throw();
+	void end_push(uint32_t ticket) throw();
+
+	bool begin_pop(uint32_t & ticket) throw();
+	void end_pop(uint32_t ticket) throw();
+
+private:
+	bool ready(waiter_kind kind) const throw();
+	void wake(waiter_kind kind) throw();
+
+	uint32_t m_mask;
+	uint32_t * m_seq;
+	bool m_spsc;
+
+	long m_refcount;
+	long m_waiters[2];
+	async_channel_base m_events[2];
+
+	// Producers and consumers each get their own cache line.
+	char m_tail_pad[64];
+	uint32_t m_tail;
+	char m_head_pad[64];
+	uint32_t m_head;
+	char m_end_pad[64];
+};
+
+template <typename T>
+class concurrent_channel_buffer
+	: public concurrent_channel_core
+{
+public:
+	concurrent_channel_buffer(size_t capacity, bool spsc)
+		: concurrent_channel_core(capacity, spsc),
+		m_slots(static_cast<task_result<T> *>(::operator new(this->capacity() * sizeof(task_result<T>))))
+	{
+	}
+
+	~concurrent_channel_buffer()
+	{
+		task<T> r;
+		while (this->try_pop(r))
+		{
+		}
+		::operator delete(m_slots);
+	}
+
+	bool try_push(task_result<T> && r) throw()
+	{
+		uint32_t ticket;
+		if (!this->begin_push(ticket))
+			return false;
+
+		new(&m_slots[this->slot(ticket)]) task_result<T>(std::move(r));
+		this->end_push(ticket);
+		return true;
+	}
+
+	bool try_pop(task<T> & r) throw()
+	{
+		uint32_t ticket;
+		if (!this->begin_pop(ticket))
+			return false;
+
+		task_result<T> & slot = m_slots[this->slot(ticket)];
+		r = task<T>(std::move(slot));
+		slot.~task_result<T>();
+		this->end_pop(ticket);
+		return true;
+	}
+
+private:
+	task_result<T> * m_slots;
+};
+
+// Waits for the event of a buffer until `Op` succeeds.
+template <typename T, typename Op>
+class concurrent_channel_task
+	: public task_base<typename Op::result_type>
+{
+public:
+	typedef typename Op::result_type result_type;
+
+	concurrent_channel_task(concurrent_channel_buffer<T> * buffer, Op && op)
+		: m_buffer(buffer), m_op(std::move(op)), m_waiting(false), m_cancelled(false)
+	{
+		m_buffer->addref();
+	}
+
+	concurrent_channel_task(concurrent_channel_task && o) throw()
+		: m_buffer(o.m_buffer), m_op(std::move(o.m_op)), m_wait(std::move(o.m_wait)), m_waiting(o.m_waiting),
+		m_cancelled(o.m_cancelled)
+	{
+		o.m_buffer = 0;
+		o.m_waiting = false;
+	}
+
+	~concurrent_channel_task()
+	{
+		if (m_buffer)
+		{
+			this->stop_waiting();
+			m_buffer->release();
+		}
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (cl >= cl_abort)
+			m_cancelled = true;
+		if (m_waiting)
+			m_wait.cancel(cl);
+	}
+
+	task_result<result_type> cancel_and_wait() throw()
+	{
+		this->stop_waiting();
+
+		task<result_type> r = m_op(*m_buffer);
+		if (r.has_result())
+			return r.get_result();
+		return std::copy_exception(task_cancelled());
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (!m_waiting)
+		{
+			if (m_cancelled || !m_buffer->begin_wait(Op::kind))
+			{
+				ctx.set_finished();
+				return;
+			}
+
+			try
+			{
+				m_wait = m_buffer->wait(Op::kind);
+			}
+			catch (...)
+			{
+				m_buffer->end_wait(Op::kind);
+				throw;
+			}
+
+			m_waiting = true;
+		}
+
+		m_wait.prepare_wait(ctx);
+	}
+
+	task<result_type> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (m_waiting)
+		{
+			m_wait.finish_wait(ctx);
+			if (!m_wait.has_result())
+				return nulltask;
+
+			task_result<void> r = m_wait.get_result();
+			this->stop_waiting();
+			if (r.has_exception())
+				return async::raise<result_type>(r.exception());
+		}
+
+		// Another thread may have been faster; the task then waits again.
+		task<result_type> res = m_op(*m_buffer);
+		if (res.has_result())
+			return std::move(res);
+		if (m_cancelled)
+			return async::raise<result_type>(task_cancelled());
+		return nulltask;
+	}
+
+private:
+	void stop_waiting() throw()
+	{
+		if (m_waiting)
+		{
+			m_wait.clear();
+			m_buffer->end_wait(Op::kind);
+			m_waiting = false;
+		}
+	}
+
+	concurrent_channel_buffer<T> * m_buffer;
+	Op m_op;
+	task<void> m_wait;
+	bool m_waiting;
+	bool m_cancelled;
+};
+
+// Returns the received element, or an empty task if there's none.
+template <typename T>
+struct concurrent_receive_op
+{
+	typedef T result_type;
+	static concurrent_channel_core::waiter_kind const kind = concurrent_channel_core::wk_receiver;
+
+	task<T> operator()(concurrent_channel_buffer<T> & buffer) throw()
+	{
+		task<T> res;
+		buffer.try_pop(res);
+		return std::move(res);
+	}
+};
+
+// Returns an empty task while the buffer is full.
+template <typename T>
+struct concurrent_send_op
+{
+	typedef void result_type;
+	static concurrent_channel_core::waiter_kind const kind = concurrent_channel_core::wk_sender;
+
+	explicit concurrent_send_op(task_result<T> && value)
+		: value(std::move(value))
+	{
+	}
+
+	concurrent_send_op(concurrent_send_op && o) throw()
+		: value(std::move(o.value))
+	{
+	}
+
+	task<void> operator()(concurrent_channel_buffer<T> & buffer) throw()
+	{
+		if (buffer.try_push(std::move(value)))
+			return async::value();
+		return nulltask;
+	}
+
+	task_result<T> value;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_CONCURRENT_CHANNEL_DETAIL_HPP
@@ -0,0 +1,347 @@
+#ifndef LIBYB_ASYNC_DETAIL_COROUTINE_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_COROUTINE_TASK_HPP
+
+#include "../task.hpp"
+#include "task_node_pool.hpp"
+#include <coroutine>
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <utility>
+#include <cassert>
+
+namespace yb {
+
+// `co_await current_cancel_level` yields the highest cancel level
+// the coroutine's task received so far, without suspending.
+struct current_cancel_level_t
+{
+};
+
+static current_cancel_level_t current_cancel_level;
+
+namespace detail {
+
+// The task a suspended coroutine waits for.
+class coroutine_awaited
+{
+public:
+	virtual void prepare_wait(task_wait_preparation_context & ctx) = 0;
+
+	// Returns true once the awaited task completes.
+	virtual bool finish_wait(task_wait_finalization_context & ctx) throw() = 0;
+
+	virtual void cancel(cancel_level cl) throw() = 0;
+	virtual void cancel_and_wait() throw() = 0;
+
+protected:
+	~coroutine_awaited() {}
+};
+
+template <typename U>
+class coroutine_awaiter;
+
+class coroutine_cancel_level_awaiter;
+
+class coroutine_promise_base
+{
+public:
+	coroutine_promise_base()
+		: m_awaited(0), m_cancel_level(cl_none)
+	{
+	}
+
+	// Frames come from the task node caches. Allocation failures
+	// are reported through the returned task rather than thrown.
+	static void * operator new(size_t size) throw()
+	{
+		try
+		{
+			return task_node_alloc(size);
+		}
+		catch (...)
+		{
+			return 0;
+		}
+	}
+
+	static void operator delete(void * p, size_t size) throw()
+	{
+		task_node_free(p, size);
+	}
+
+	// The body starts running when the task is first waited for.
+	std::suspend_always initial_suspend() const throw()
+	{
+		return std::suspend_always();
+	}
+
+	// The frame is destroyed by the task, which keeps the result.
+	std::suspend_always final_suspend() const throw()
+	{
+		return std::suspend_always();
+	}
+
+	template <typename U>
+	coroutine_awaiter<U> await_transform(task<U> && t);
+
+	coroutine_cancel_level_awaiter await_transform(current_cancel_level_t);
+
+	coroutine_awaited * m_awaited;
+	cancel_level m_cancel_level;
+};
+
+template <typename U>
+class coroutine_awaiter
+	: public coroutine_awaited
+{
+public:
+	coroutine_awaiter(coroutine_promise_base & promise, task<U> && t)
+		: m_promise(promise), m_task(std::move(t))
+	{
+		assert(!m_task.empty());
+	}
+
+	bool await_ready() const
+	{
+		return m_task.has_result();
+	}
+
+	void await_suspend(std::coroutine_handle<>)
+	{
+		m_promise.m_awaited = this;
+
+		// Tasks awaited after a cancellation are cancelled right away.
+		if (m_promise.m_cancel_level != cl_none)
+			m_task.cancel(m_promise.m_cancel_level);
+	}
+
+	U await_resume()
+	{
+		m_promise.m_awaited = 0;
+		return m_task.get_result().get();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		m_task.prepare_wait(ctx);
+	}
+
+	bool finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		m_task.finish_wait(ctx);
+		return m_task.has_result();
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		m_task.cancel(cl);
+	}
+
+	void cancel_and_wait() throw()
+	{
+		m_task = task<U>(m_task.cancel_and_wait());
+	}
+
+private:
+	coroutine_promise_base & m_promise;
+	task<U> m_task;
+};
+
+class coroutine_cancel_level_awaiter
+{
+public:
+	explicit coroutine_cancel_level_awaiter(cancel_level cl)
+		: m_cl(cl)
+	{
+	}
+
+	bool await_ready() const
+	{
+		return true;
+	}
+
+	void await_suspend(std::coroutine_handle<>)
+	{
+	}
+
+	cancel_level await_resume() const
+	{
+		return m_cl;
+	}
+
+private:
+	cancel_level m_cl;
+};
+
+template <typename U>
+coroutine_awaiter<U> coroutine_promise_base::await_transform(task<U> && t)
+{
+	return coroutine_awaiter<U>(*this, std::move(t));
+}
+
+inline coroutine_cancel_level_awaiter coroutine_promise_base::await_transform(current_cancel_level_t)
+{
+	return coroutine_cancel_level_awaiter(m_cancel_level);
+}
+
+template <typename T>
+class coroutine_promise;
+
+// Drives a coroutine returning `task<T>`; the coroutine is resumed
+// whenever the task it awaits completes.
+template <typename T>
+class coroutine_task
+	: public task_base<T>
+{
+public:
+	typedef std::coroutine_handle<coroutine_promise<T> > handle_type;
+
+	explicit coroutine_task(handle_type coro)
+		: m_coro(coro), m_started(false)
+	{
+	}
+
+	coroutine_task(coroutine_task && o) throw()
+		: m_coro(o.m_coro), m_started(o.m_started)
+	{
+		o.m_coro = handle_type();
+	}
+
+	~coroutine_task()
+	{
+		if (m_coro)
+			m_coro.destroy();
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		coroutine_promise<T> & p = m_coro.promise();
+		p.m_cancel_level = (std::max)(p.m_cancel_level, cl);
+		if (p.m_awaited)
+			p.m_awaited->cancel(cl);
+	}
+
+	task_result<T> cancel_and_wait() throw()
+	{
+		this->cancel(cl_kill);
+
+		// Nobody waited for the task, its body doesn't run at all.
+		if (!m_started)
+		{
+			m_coro.destroy();
+			m_coro = handle_type();
+			return task_result<T>(std::make_exception_ptr(task_cancelled(cl_kill)));
+		}
+
+		coroutine_promise<T> & p = m_coro.promise();
+		while (!m_coro.done())
+		{
+			p.m_awaited->cancel_and_wait();
+			m_coro.resume();
+		}
+
+		return p.m_result.get_result();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		this->start();
+
+		if (m_coro.done())
+			ctx.set_finished();
+		else
+			m_coro.promise().m_awaited->prepare_wait(ctx);
+	}
+
+	task<T> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		coroutine_promise<T> & p = m_coro.promise();
+		if (!m_coro.done())
+		{
+			if (!p.m_awaited->finish_wait(ctx))
+				return nulltask;
+
+			m_coro.resume();
+			if (!m_coro.done())
+				return nulltask;
+		}
+
+		return std::move(p.m_result);
+	}
+
+private:
+	void start()
+	{
+		if (!m_started)
+		{
+			m_started = true;
+			m_coro.resume();
+		}
+	}
+
+	handle_type m_coro;
+	bool m_started;
+};
+
+template <typename T>
+class coroutine_promise_result
+	: public coroutine_promise_base
+{
+public:
+	void return_value(T v)
+	{
+		m_result = task<T>(task_result<T>(std::move(v)));
+	}
+
+	task<T> m_result;
+};
+
+template <>
+class coroutine_promise_result<void>
+	: public coroutine_promise_base
+{
+public:
+	void return_void()
+	{
+		m_result = async::value();
+	}
+
+	task<void> m_result;
+};
+
+template <typename T>
+class coroutine_promise
+	: public coroutine_promise_result<T>
+{
+public:
+	task<T> get_return_object()
+	{
+		return task<T>::make(coroutine_task<T>(std::coroutine_handle<coroutine_promise<T> >::from_promise(*this)));
+	}
+
+	static task<T> get_return_object_on_allocation_failure()
+	{
+		return async::raise<T>(std::bad_alloc());
+	}
+
+	void unhandled_exception()
+	{
+		this->m_result = async::raise<T>();
+	}
+};
+
+} // namespace detail
+} // namespace yb
+
+namespace std {
+
+template <typename T, typename... Args>
+struct coroutine_traits<yb::task<T>, Args...>
+{
+	typedef yb::detail::coroutine_promise<T> promise_type;
+};
+
+} // namespace std
+
+#endif // LIBYB_ASYNC_DETAIL_COROUTINE_TASK_HPP
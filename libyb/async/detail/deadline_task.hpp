@@ -0,0 +1,96 @@
+#ifndef LIBYB_ASYNC_DETAIL_DEADLINE_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_DEADLINE_TASK_HPP
+
+#include "../task_base.hpp"
+#include "../cancel_exception.hpp"
+#include "../task.hpp"
+#include "task_node_pool.hpp"
+#include <stdint.h>
+
+namespace yb {
+
+// Declared in timer.hpp.
+uint64_t monotonic_time_us();
+task<void> wait_until_us(uint64_t deadline_us, uint64_t slack_us);
+
+namespace detail {
+
+// Races a task against a timer. When the timer wins, the task
+// is cancelled and, once it completes, the result is replaced
+// with `task_timed_out`.
+template <typename R>
+class deadline_task
+	: public task_base<R>, public pooled_task_node
+{
+public:
+	deadline_task(task<R> && nested, task<void> && timer, cancel_level cl)
+		: m_nested(std::move(nested)), m_timer(std::move(timer)), m_cl(cl), m_expired(false)
+	{
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		m_nested.cancel(cl);
+	}
+
+	task_result<R> cancel_and_wait() throw()
+	{
+		m_timer.clear();
+		task_result<R> r = m_nested.cancel_and_wait();
+		if (m_expired)
+			return task_result<R>(std::copy_exception(task_timed_out()));
+		return r;
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		task_wait_memento_builder mb(ctx);
+		m_nested.prepare_wait(ctx);
+		m_nested_m = mb.finish();
+
+		task_wait_memento_builder timer_mb(ctx);
+		if (m_timer.has_task())
+			m_timer.prepare_wait(ctx);
+		m_timer_m = timer_mb.finish();
+	}
+
+	task<R> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (ctx.contains(m_nested_m))
+		{
+			m_nested.finish_wait(ctx);
+			if (m_nested.has_result())
+			{
+				if (m_expired)
+					return async::raise<R>(task_timed_out());
+				return std::move(m_nested);
+			}
+		}
+
+		if (m_timer.has_task() && ctx.contains(m_timer_m))
+		{
+			m_timer.finish_wait(ctx);
+			if (m_timer.has_result())
+			{
+				m_expired = true;
+				m_nested.cancel(m_cl);
+			}
+		}
+
+		return nulltask;
+	}
+
+private:
+	task<R> m_nested;
+	task<void> m_timer;
+	cancel_level m_cl;
+	bool m_expired;
+
+	task_wait_memento m_nested_m;
+	task_wait_memento m_timer_m;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_DEADLINE_TASK_HPP
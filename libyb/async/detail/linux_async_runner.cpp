@@ -1,52 +1,161 @@
 #include "../async_runner.hpp"
 #include "linux_wait_context.hpp"
+#include "linux_epoll_set.hpp"
+#include "linux_io_uring.hpp"
+#include "linux_timer_wheel.hpp"
+#include "linux_runner_metrics.hpp"
+#include "task_reaper.hpp"
 #include "../../utils/noncopyable.hpp"
 #include <list>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/poll.h>
 #include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 using namespace yb;
 using namespace yb::detail;
 
-struct async_promise_base::impl
-	: noncopyable
+namespace {
+
+struct parallel_promise
 {
-	explicit impl(async_runner * runner)
-		: m_runner(runner), m_refcount(1), m_finished(false)
+	async_promise_base * promise;
+	task_wait_memento m;
+
+	// Each promise has its own wait context, so that idle promises
+	// don't have to be prepared again and, in the epoll and io_uring loops,
+	// their poll items stay registered across iterations.
+	std::unique_ptr<task_wait_preparation_context> wait_ctx;
+	bool prepared;
+	std::list<parallel_promise>::iterator self;
+	bool queued;
+	bool selected;
+	size_t selected_poll_item;
+
+	// Set for promises posted through a pool; another runner
+	// of the pool may take the promise before it is started.
+	bool stealable;
+
+	parallel_promise()
+		: promise(0), prepared(false), queued(false), selected(false), selected_poll_item(0), stealable(false)
 	{
-		if (pthread_mutex_init(&m_mutex, 0) != 0)
-			throw std::runtime_error("cannot create mutex");
+	}
 
-		if (pthread_cond_init(&m_cond, 0) != 0)
-		{
-			pthread_mutex_destroy(&m_mutex);
-			throw std::runtime_error("cannot create condvar");
-		}
+	~parallel_promise()
+	{
+		if (promise)
+			promise->release();
 	}
 
-	~impl()
+	parallel_promise(parallel_promise && o)
+		: promise(o.promise), wait_ctx(std::move(o.wait_ctx)), prepared(o.prepared), queued(o.queued), selected(o.selected), selected_poll_item(o.selected_poll_item),
+		stealable(o.stealable)
+	{
+		o.promise = 0;
+	}
+};
+
+typedef std::list<parallel_promise>::iterator promise_iterator;
+
+struct scoped_mutex
+{
+	explicit scoped_mutex(pthread_mutex_t & mutex)
+		: m_mutex(&mutex)
+	{
+		pthread_mutex_lock(m_mutex);
+	}
+
+	~scoped_mutex()
+	{
+		if (m_mutex)
+			pthread_mutex_unlock(m_mutex);
+	}
+
+	void detach()
+	{
+		m_mutex = 0;
+	}
+
+	pthread_mutex_t * m_mutex;
+};
+
+enum promise_state
+{
+	ps_running,
+	ps_waited_for,
+	ps_finished
+};
+
+char closed_completions_tag;
+async_completion * const closed_completions = reinterpret_cast<async_completion *>(&closed_completions_tag);
+
+void futex_wait(int * addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, 0, 0, 0);
+}
+
+void futex_wake_all(int * addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+}
+
+} // namespace
+
+struct async_promise_base::impl
+	: noncopyable
+{
+	explicit impl(async_runner * runner)
+		: m_promise(0), m_runner(runner), m_refcount(0), m_state(ps_running), m_completions(0), m_request_cl(cl_none), m_applied_cl(cl_none),
+		m_node(1), m_next_submitted(0), m_dispatcher(0), m_cancel_queued(false), m_next_cancelled(0)
 	{
-		pthread_cond_destroy(&m_cond);
-		pthread_mutex_destroy(&m_mutex);
 	}
 
+	async_promise_base * m_promise;
 	async_runner * m_runner;
 	int m_refcount;
 
-	pthread_mutex_t m_mutex;
-	pthread_cond_t m_cond;
-	bool m_finished;
+	// A futex word; see `promise_state`.
+	int m_state;
+
+	// The callbacks to run once the promise finishes, most recent first.
+	// Set to `closed_completions` when it does.
+	async_completion * m_completions;
 
+	// The highest requested cancel level is raised atomically by `cancel`;
+	// the applied one is only accessed by the dispatch thread.
 	cancel_level m_request_cl;
 	cancel_level m_applied_cl;
+
+	// The runner's record of the promise. It's allocated along with
+	// the promise, so that submitting can't fail, and is spliced
+	// into the runner's list once the runner takes the promise.
+	std::list<parallel_promise> m_node;
+
+	// Links the submitted promise into its runner's submission queue.
+	impl * m_next_submitted;
+
+	// The runner that took the promise from a submission queue and
+	// the promise's record in its list; the runner resets it
+	// once the promise finishes.
+	async_runner::impl * m_dispatcher;
+	std::list<parallel_promise>::iterator m_self;
+
+	// Set while the promise is linked into a runner's list
+	// of pending cancels, which holds a reference to it.
+	bool m_cancel_queued;
+	impl * m_next_cancelled;
 };
 
 async_promise_base::async_promise_base(async_runner * runner)
 	: m_pimpl(new impl(runner))
 {
+	m_pimpl->m_promise = this;
 }
 
 async_promise_base::~async_promise_base()
@@ -64,85 +173,125 @@ void async_promise_base::release()
 		delete this;
 }
 
-void async_promise_base::mark_finished()
-{
-	pthread_mutex_lock(&m_pimpl->m_mutex);
-	m_pimpl->m_finished = true;
-	pthread_cond_broadcast(&m_pimpl->m_cond);
-	pthread_mutex_unlock(&m_pimpl->m_mutex);
-}
-
-void async_promise_base::wait()
+void async_promise_base::set_runner(async_runner * runner)
 {
-	pthread_mutex_lock(&m_pimpl->m_mutex);
-	while (!m_pimpl->m_finished)
-		pthread_cond_wait(&m_pimpl->m_cond, &m_pimpl->m_mutex);
-	pthread_mutex_unlock(&m_pimpl->m_mutex);
+	__atomic_store_n(&m_pimpl->m_runner, runner, __ATOMIC_RELEASE);
 }
 
-void async_promise_base::perform_pending_cancels()
+void async_promise_base::mark_finished()
 {
-	if (m_pimpl->m_request_cl > m_pimpl->m_applied_cl)
-	{
-		this->do_cancel(m_pimpl->m_request_cl);
-		m_pimpl->m_applied_cl = m_pimpl->m_request_cl;
-	}
-}
-
-namespace {
+	// Waiters are only woken up if some announced themselves.
+	if (__atomic_exchange_n(&m_pimpl->m_state, (int)ps_finished, __ATOMIC_SEQ_CST) == ps_waited_for)
+		futex_wake_all(&m_pimpl->m_state);
 
-struct parallel_promise
-{
-	async_promise_base * promise;
-	task_wait_memento m;
+	// The promise is finished before the callbacks run, so that
+	// they can get the result without blocking.
+	async_completion * c = __atomic_exchange_n(&m_pimpl->m_completions, closed_completions, __ATOMIC_ACQ_REL);
 
-	parallel_promise()
-		: promise(0)
+	async_completion * first = 0;
+	while (c)
 	{
+		async_completion * next = c->m_next;
+		c->m_next = first;
+		first = c;
+		c = next;
 	}
 
-	~parallel_promise()
+	while (first)
 	{
-		if (promise)
-			promise->release();
+		async_completion * next = first->m_next;
+		first->run();
+		first = next;
 	}
+}
 
-	parallel_promise(parallel_promise && o)
-		: promise(o.promise)
+void async_promise_base::wait()
+{
+	int state = __atomic_load_n(&m_pimpl->m_state, __ATOMIC_ACQUIRE);
+	while (state != ps_finished)
 	{
-		o.promise = 0;
+		if (state == ps_waited_for || __atomic_compare_exchange_n(&m_pimpl->m_state, &state, (int)ps_waited_for, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+		{
+			futex_wait(&m_pimpl->m_state, ps_waited_for);
+			state = __atomic_load_n(&m_pimpl->m_state, __ATOMIC_ACQUIRE);
+		}
 	}
-};
+}
 
-struct scoped_mutex
+void async_promise_base::add_completion(async_completion * c)
 {
-	explicit scoped_mutex(pthread_mutex_t & mutex)
-		: m_mutex(&mutex)
+	async_completion * head = __atomic_load_n(&m_pimpl->m_completions, __ATOMIC_ACQUIRE);
+	do
 	{
-		pthread_mutex_lock(m_mutex);
-	}
+		if (head == closed_completions)
+		{
+			c->run();
+			return;
+		}
 
-	~scoped_mutex()
-	{
-		if (m_mutex)
-			pthread_mutex_unlock(m_mutex);
+		c->m_next = head;
 	}
+	while (!__atomic_compare_exchange_n(&m_pimpl->m_completions, &head, c, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
 
-	void detach()
+bool async_promise_base::perform_pending_cancels()
+{
+	cancel_level cl;
+	__atomic_load(&m_pimpl->m_request_cl, &cl, __ATOMIC_SEQ_CST);
+	if (cl > m_pimpl->m_applied_cl)
 	{
-		m_mutex = 0;
+		this->do_cancel(cl);
+		m_pimpl->m_applied_cl = cl;
+		return true;
 	}
 
-	pthread_mutex_t * m_mutex;
-};
-
-} // namespace
+	return false;
+}
 
 struct async_runner::impl
 {
-	impl()
-		: stopped(false)
+	typedef async_promise_base::impl promise_impl;
+
+	// Posts the tasks that the promises' tasks drop, but which can't
+	// be cancelled right away, back to the runner.
+	struct runner_reaper
+		: task_reaper
+	{
+		explicit runner_reaper(async_runner * owner)
+			: owner(owner)
+		{
+		}
+
+		void reap(task<void> && t) throw()
+		{
+			// If the post fails, the task is waited for right here.
+			scoped_task_reaper blocking(0);
+			owner->post_detached(std::move(t));
+			t.clear();
+		}
+
+		async_runner * owner;
+	};
+
+	impl(async_runner * owner, runner_backend_t backend)
+		: owner(owner), reaper(owner), submitted(0), cancelled(0), group(0), load(0), sleeping(false), stopped(false), rotation(0), registered_items(0)
 	{
+		if (backend == rb_epoll)
+		{
+			epoll.reset(new linux_epoll_set());
+		}
+		else if (backend == rb_io_uring)
+		{
+			// Fall back to poll if the kernel doesn't support io_uring.
+			try
+			{
+				uring.reset(new linux_io_uring());
+			}
+			catch (std::exception const &)
+			{
+			}
+		}
+
 		if (pthread_mutex_init(&mutex, 0) != 0)
 			throw std::runtime_error("failed to create a mutex");
 
@@ -163,37 +312,96 @@ struct async_runner::impl
 
 	~impl()
 	{
+		// The kernel must stop using the buffers before the promises are destroyed.
+		if (uring)
+			uring->cancel_all();
+
+		for (promise_impl * p = this->take_submitted(); p != 0; p = p->m_next_submitted)
+			promises.splice(promises.end(), p->m_node);
+
+		for (promise_impl * p = __atomic_exchange_n(&cancelled, (promise_impl *)0, __ATOMIC_ACQUIRE); p != 0; )
+		{
+			promise_impl * next = p->m_next_cancelled;
+			p->m_promise->release();
+			p = next;
+		}
+
 		close(control_event);
 		pthread_mutex_destroy(&mutex);
 	}
 
 	void run()
+	{
+		if (epoll)
+			this->run_registered(*epoll);
+		else if (uring)
+			this->run_registered(*uring);
+		else
+			this->run_poll();
+	}
+
+	void run_poll()
 	{
 		task_wait_preparation_context wait_ctx;
 		task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
 
+		std::vector<promise_iterator> cancelled_promises;
+		unsigned prepared_epoch = this_thread_preparation_epoch();
+
 		while (!__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
 		{
+			bool measure = metrics.enabled();
+			uint64_t start_ns = measure? linux_monotonic_ns(): 0;
+
 			wait_ctx.clear();
 
-			for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); ++it)
-				it->promise->perform_pending_cancels();
+			this->perform_pending_cancels(cancelled_promises);
+			for (size_t i = 0; i < cancelled_promises.size(); ++i)
+				cancelled_promises[i]->prepared = false;
 
+			// Tasks that changed without the runner noticing
+			// invalidate the preparations of all promises.
+			unsigned epoch = this_thread_preparation_epoch();
+			bool full = epoch != prepared_epoch;
+			prepared_epoch = epoch;
+
+			// Only the promises that were finalized, cancelled or that are
+			// volatile are prepared; the others reuse their poll items.
 			for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); ++it)
 			{
 				assert(it->promise != 0);
 
+				if (!it->wait_ctx)
+					it->wait_ctx.reset(new task_wait_preparation_context());
+
+				if (full || !it->prepared || it->wait_ctx->get()->m_volatile_tasks)
+				{
+					it->wait_ctx->clear();
+					it->wait_ctx->set_full_preparation(full);
+					it->promise->prepare_wait(*it->wait_ctx);
+					it->prepared = true;
+				}
+
 				task_wait_memento_builder mb(wait_ctx);
-				it->promise->prepare_wait(wait_ctx);
+				wait_ctx.append(*it->wait_ctx);
 				it->m = mb.finish();
 			}
 
+			if (!wait_ctx_impl.m_timers.empty())
+				this->timer_wheel().arm_all(wait_ctx_impl, 0);
+
+			uint64_t prepared_ns = measure? linux_monotonic_ns(): 0;
+			uint64_t woken_ns = prepared_ns;
+			size_t poll_items = 0;
+
 			if (wait_ctx_impl.m_finished_tasks)
 			{
-				task_wait_finalization_context finish_ctx;
-				finish_ctx.prep_ctx = &wait_ctx;
-				finish_ctx.finished_tasks = wait_ctx_impl.m_finished_tasks;
-				this->finish_wait(finish_ctx);
+				for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); )
+				{
+					if (it->m.finished_task_count != 0 && this->finish_promise(wait_ctx, it, 0))
+						continue;
+					++it;
+				}
 			}
 			else
 			{
@@ -202,55 +410,572 @@ struct async_runner::impl
 				pfd.events = POLLIN;
 				wait_ctx_impl.m_pollfds.push_back(pfd);
 
-				int r = poll(wait_ctx_impl.m_pollfds.data(), wait_ctx_impl.m_pollfds.size(), -1);
-				assert(r > 0);
+				if (timers)
+				{
+					timers->commit();
+					pfd.fd = timers->fd();
+					wait_ctx_impl.m_pollfds.push_back(pfd);
+				}
+
+				poll_items = wait_ctx_impl.m_pollfds.size();
+				if (measure)
+					prepared_ns = linux_monotonic_ns();
+
+				bool ready = this->prepare_to_sleep() || (timers && timers->has_fired());
+				int r = poll(wait_ctx_impl.m_pollfds.data(), wait_ctx_impl.m_pollfds.size(), ready? 0: -1);
+				__atomic_store_n(&sleeping, false, __ATOMIC_SEQ_CST);
+				assert(r >= 0);
+
+				if (measure)
+					woken_ns = linux_monotonic_ns();
 
-				if (wait_ctx_impl.m_pollfds.back().revents & POLLIN)
+				bool timer_ready = false;
+				if (timers)
+				{
+					timer_ready = (wait_ctx_impl.m_pollfds.back().revents & POLLIN) != 0;
+					wait_ctx_impl.m_pollfds.pop_back();
+				}
+
+				bool control_ready = (wait_ctx_impl.m_pollfds.back().revents & POLLIN) != 0;
+				wait_ctx_impl.m_pollfds.pop_back();
+
+				if (control_ready)
 				{
 					uint64_t val;
 					int r = read(control_event, &val, sizeof val);
 					assert(r >= 0);
 
-					scoped_mutex l(mutex);
-					promises.splice(promises.end(), new_promises);
+					if (measure)
+						metrics.record_control_wakeup();
+				}
+
+				size_t ready_count = r - (control_ready? 1: 0) - (timer_ready? 1: 0);
+				if (timer_ready || (timers && timers->has_fired()))
+					ready_count += timers->signal_expired(wait_ctx_impl);
+
+				this->finish_ready(wait_ctx, ready_count);
+
+				if (control_ready || this->has_submitted())
+					this->take_new_promises(promises);
+			}
+
+			if (measure)
+				metrics.record_iteration(prepared_ns - start_ns, woken_ns - prepared_ns, linux_monotonic_ns() - woken_ns, poll_items);
+		}
+	}
+
+	// Finalizes every promise with a ready poll item. A promise is finalized
+	// at most once, with the first of its ready items; the item searched
+	// first rotates between calls, so that a busy fd can't starve
+	// the other fds of the same promise.
+	void finish_ready(task_wait_preparation_context & wait_ctx, size_t ready_count)
+	{
+		std::vector<struct pollfd> const & pollfds = wait_ctx.get()->m_pollfds;
+
+		++rotation;
+		for (std::list<parallel_promise>::iterator it = promises.begin(); ready_count != 0 && it != promises.end(); )
+		{
+			size_t first = it->m.poll_item_first;
+			size_t count = it->m.poll_item_last - first;
+
+			size_t selected = count;
+			for (size_t k = 0; k < count; ++k)
+			{
+				size_t i = (k + rotation) % count;
+				if (pollfds[first + i].revents)
+				{
+					if (selected == count)
+						selected = i;
+					--ready_count;
+				}
+			}
+
+			if (selected != count && this->finish_promise(wait_ctx, it, selected))
+				continue;
+
+			++it;
+		}
+	}
+
+	// Finalizes the promise with the given poll item (relative to the promise)
+	// or, if it has finished tasks, with those. If the promise completes,
+	// removes it and advances the iterator.
+	bool finish_promise(task_wait_preparation_context const & wait_ctx, std::list<parallel_promise>::iterator & it, size_t selected_poll_item)
+	{
+		task_wait_finalization_context finish_ctx;
+		finish_ctx.prep_ctx = it->wait_ctx.get();
+		finish_ctx.finished_tasks = it->m.finished_task_count;
+		finish_ctx.selected_poll_item = selected_poll_item;
+
+		if (!finish_ctx.finished_tasks)
+			wait_ctx.copy_results_to(*it->wait_ctx, it->m.poll_item_first);
+
+		it->prepared = false;
+		if (!it->promise->finish_wait(finish_ctx))
+			return false;
+
+		this->retire(*it);
+		it = promises.erase(it);
+		__atomic_sub_fetch(&load, 1, __ATOMIC_RELAXED);
+		return true;
+	}
+
+	// Marks the promise as finished; the cancels that are still pending
+	// will be dropped.
+	void retire(parallel_promise & pp)
+	{
+		__atomic_store_n(&pp.promise->m_pimpl->m_dispatcher, (impl *)0, __ATOMIC_SEQ_CST);
+		pp.promise->mark_finished();
+	}
+
+	static void enqueue(std::vector<promise_iterator> & queue, promise_iterator it)
+	{
+		if (!it->queued)
+		{
+			it->queued = true;
+			queue.push_back(it);
+		}
+	}
+
+	static void register_item(linux_epoll_set & set, struct pollfd const & pfd, linux_io_op *, void * owner, size_t index)
+	{
+		set.add(pfd.fd, pfd.events, owner, index);
+	}
+
+	static void register_item(linux_io_uring & set, struct pollfd const & pfd, linux_io_op * op, void * owner, size_t index)
+	{
+		set.add(pfd.fd, pfd.events, op, owner, index);
+	}
+
+	template <typename PollSet>
+	void prepare_promise(PollSet & set, parallel_promise & pp, bool full)
+	{
+		if (!pp.wait_ctx)
+			pp.wait_ctx.reset(new task_wait_preparation_context());
+		else
+			this->unregister_promise(set, pp);
+
+		pp.wait_ctx->clear();
+		pp.wait_ctx->set_full_preparation(full);
+		pp.promise->prepare_wait(*pp.wait_ctx);
+
+		task_wait_preparation_context_impl const & wait_ctx_impl = *pp.wait_ctx->get();
+		std::vector<struct pollfd> const & pollfds = wait_ctx_impl.m_pollfds;
+		for (size_t i = 0, j = 0; i < pollfds.size(); ++i)
+		{
+			// Timers have no fd, they're armed in the wheel below.
+			if (pollfds[i].fd < 0)
+				continue;
+
+			linux_io_op * op = 0;
+			if (j < wait_ctx_impl.m_io_ops.size() && wait_ctx_impl.m_io_ops[j].first == i)
+				op = wait_ctx_impl.m_io_ops[j++].second;
+			register_item(set, pollfds[i], op, &pp, i);
+			++registered_items;
+		}
+
+		if (!wait_ctx_impl.m_timers.empty())
+		{
+			if (!timers)
+			{
+				struct pollfd pfd = {};
+				pfd.fd = this->timer_wheel().fd();
+				pfd.events = POLLIN;
+				register_item(set, pfd, 0, timers.get(), 0);
+			}
+
+			timers->arm_all(wait_ctx_impl, &pp);
+		}
+	}
+
+	template <typename PollSet>
+	void unregister_promise(PollSet & set, parallel_promise & pp)
+	{
+		std::vector<struct pollfd> const & pollfds = pp.wait_ctx->get()->m_pollfds;
+		for (size_t i = 0; i < pollfds.size(); ++i)
+		{
+			if (pollfds[i].fd >= 0)
+			{
+				set.remove(pollfds[i].fd, &pp, i);
+				--registered_items;
+			}
+		}
+	}
+
+	// Dispatches promises whose poll items stay registered in `set`
+	// across iterations.
+	template <typename PollSet>
+	void run_registered(PollSet & set)
+	{
+		// Promises that have to be prepared before the next wait;
+		// these are the new promises, the ones that were finalized
+		// or cancelled, and the volatile ones.
+		std::vector<promise_iterator> prepare_queue;
+		std::vector<promise_iterator> next_prepare_queue;
+
+		// Promises that are either finished or have a poll item selected.
+		std::vector<promise_iterator> finalize_queue;
+
+		struct pollfd control_pfd = {};
+		control_pfd.fd = control_event;
+		control_pfd.events = POLLIN;
+		register_item(set, control_pfd, 0, 0, 0);
+
+		std::vector<promise_iterator> cancelled_promises;
+		unsigned prepared_epoch = this_thread_preparation_epoch();
+
+		while (!__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
+		{
+			bool measure = metrics.enabled();
+			uint64_t start_ns = measure? linux_monotonic_ns(): 0;
+
+			this->perform_pending_cancels(cancelled_promises);
+			for (size_t i = 0; i < cancelled_promises.size(); ++i)
+				enqueue(prepare_queue, cancelled_promises[i]);
+
+			// Tasks that changed without the runner noticing
+			// invalidate the preparations of all promises.
+			unsigned epoch = this_thread_preparation_epoch();
+			bool full = epoch != prepared_epoch;
+			prepared_epoch = epoch;
+			if (full)
+			{
+				for (promise_iterator it = promises.begin(); it != promises.end(); ++it)
+					enqueue(prepare_queue, it);
+			}
+
+			for (size_t i = 0; i < prepare_queue.size(); ++i)
+			{
+				promise_iterator it = prepare_queue[i];
+				it->queued = false;
+				this->prepare_promise(set, *it, full);
+
+				task_wait_preparation_context_impl const & wait_ctx_impl = *it->wait_ctx->get();
+				if (wait_ctx_impl.m_finished_tasks)
+				{
+					it->selected = true;
+					finalize_queue.push_back(it);
+				}
+				else if (wait_ctx_impl.m_volatile_tasks || wait_ctx_impl.m_pollfds.empty())
+				{
+					enqueue(next_prepare_queue, it);
+				}
+			}
+
+			prepare_queue.clear();
+			set.commit();
+			if (timers)
+				timers->commit();
+
+			uint64_t prepared_ns = measure? linux_monotonic_ns(): 0;
+
+			bool ready = this->prepare_to_sleep() || !finalize_queue.empty() || (timers && timers->has_fired());
+			set.wait(ready? 0: -1);
+			__atomic_store_n(&sleeping, false, __ATOMIC_SEQ_CST);
+
+			uint64_t woken_ns = measure? linux_monotonic_ns(): 0;
+
+			bool control_ready = false;
+			bool timer_ready = false;
+			std::vector<typename PollSet::ready_item> const & ready_items = set.ready_items();
+			for (size_t i = 0; i < ready_items.size(); ++i)
+			{
+				typename PollSet::ready_item const & item = ready_items[i];
+				if (timers && item.owner == timers.get())
+				{
+					timer_ready = true;
+					continue;
+				}
+
+				if (item.owner == 0)
+				{
+					uint64_t val;
+					int r = read(control_event, &val, sizeof val);
+					assert(r >= 0);
+
+					if (measure)
+						metrics.record_control_wakeup();
+					control_ready = true;
 					continue;
 				}
 
-				for (size_t i = 0; i < wait_ctx_impl.m_pollfds.size() - 1; ++i)
+				parallel_promise & pp = *static_cast<parallel_promise *>(item.owner);
+				if (!pp.selected)
+				{
+					pp.wait_ctx->get()->m_pollfds[item.index].revents = item.revents;
+					pp.selected = true;
+					pp.selected_poll_item = item.index;
+					finalize_queue.push_back(pp.self);
+				}
+			}
+
+			if (control_ready || this->has_submitted())
+			{
+				std::list<parallel_promise> taken;
+				this->take_new_promises(taken);
+				for (promise_iterator it = taken.begin(); it != taken.end(); ++it)
+				{
+					it->self = it;
+					enqueue(next_prepare_queue, it);
+				}
+				promises.splice(promises.end(), taken);
+			}
+
+			if (timer_ready || (timers && timers->has_fired()))
+			{
+				std::vector<linux_timer_entry *> const & expired = timers->expire();
+				for (size_t i = 0; i < expired.size(); ++i)
+				{
+					linux_timer_entry & e = *expired[i];
+					parallel_promise & pp = *static_cast<parallel_promise *>(e.owner);
+					if (!linux_timer_wheel::is_prepared(e, *pp.wait_ctx->get()) || pp.selected)
+						continue;
+
+					pp.wait_ctx->get()->m_pollfds[e.index].revents = POLLIN;
+					pp.selected = true;
+					pp.selected_poll_item = e.index;
+					finalize_queue.push_back(pp.self);
+				}
+			}
+
+			for (size_t i = 0; i < finalize_queue.size(); ++i)
+			{
+				promise_iterator it = finalize_queue[i];
+				it->selected = false;
+
+				task_wait_finalization_context finish_ctx;
+				finish_ctx.prep_ctx = it->wait_ctx.get();
+				finish_ctx.finished_tasks = it->wait_ctx->get()->m_finished_tasks;
+				finish_ctx.selected_poll_item = it->selected_poll_item;
+
+				if (it->promise->finish_wait(finish_ctx))
+				{
+					this->unregister_promise(set, *it);
+					if (it->queued)
+						next_prepare_queue.erase(std::find(next_prepare_queue.begin(), next_prepare_queue.end(), it));
+					this->retire(*it);
+					promises.erase(it);
+					__atomic_sub_fetch(&load, 1, __ATOMIC_RELAXED);
+				}
+				else
 				{
-					if (wait_ctx_impl.m_pollfds[i].revents)
-					{
-						task_wait_finalization_context finish_ctx;
-						finish_ctx.prep_ctx = &wait_ctx;
-						finish_ctx.finished_tasks = false;
-						finish_ctx.selected_poll_item = i;
-						this->finish_wait(finish_ctx);
-						break;
-					}
+					enqueue(next_prepare_queue, it);
 				}
 			}
+
+			finalize_queue.clear();
+			prepare_queue.swap(next_prepare_queue);
+
+			if (measure)
+				metrics.record_iteration(prepared_ns - start_ns, woken_ns - prepared_ns, linux_monotonic_ns() - woken_ns, registered_items);
 		}
 	}
 
-	void finish_wait(task_wait_finalization_context & ctx)
+	// Pushes a chain of promises linked from `first` to `last`
+	// to the submission queue. Returns true if the queue was empty.
+	bool push_submitted(promise_impl * first, promise_impl * last)
 	{
-		for (std::list<parallel_promise>::iterator it = promises.begin(); it != promises.end(); )
+		promise_impl * head = __atomic_load_n(&submitted, __ATOMIC_RELAXED);
+		do
 		{
-			if (ctx.contains(it->m) && it->promise->finish_wait(ctx))
+			last->m_next_submitted = head;
+		}
+		while (!__atomic_compare_exchange_n(&submitted, &head, first, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+		return head == 0;
+	}
+
+	// Empties the submission queue and returns its promises
+	// in the order of submission.
+	promise_impl * take_submitted()
+	{
+		promise_impl * p = __atomic_exchange_n(&submitted, (promise_impl *)0, __ATOMIC_ACQUIRE);
+
+		promise_impl * res = 0;
+		while (p)
+		{
+			promise_impl * next = p->m_next_submitted;
+			p->m_next_submitted = res;
+			res = p;
+			p = next;
+		}
+
+		return res;
+	}
+
+	bool push_cancelled(promise_impl * p)
+	{
+		promise_impl * head = __atomic_load_n(&cancelled, __ATOMIC_RELAXED);
+		do
+		{
+			p->m_next_cancelled = head;
+		}
+		while (!__atomic_compare_exchange_n(&cancelled, &head, p, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+		return head == 0;
+	}
+
+	// Applies the cancels requested since the last call and stores
+	// the promises that have to be prepared again to `out`.
+	//
+	// Only the promises this runner took are cancelled here. The ones
+	// that were stolen are forwarded to their new runner, the ones
+	// that finished or weren't taken yet are dropped; the runner that
+	// takes a promise applies the pending cancel itself.
+	void perform_pending_cancels(std::vector<promise_iterator> & out)
+	{
+		out.clear();
+
+		promise_impl * p = __atomic_exchange_n(&cancelled, (promise_impl *)0, __ATOMIC_ACQUIRE);
+		while (p)
+		{
+			promise_impl * next = p->m_next_cancelled;
+
+			impl * dispatcher = __atomic_load_n(&p->m_dispatcher, __ATOMIC_SEQ_CST);
+			if (dispatcher != 0 && dispatcher != this)
 			{
-				it->promise->mark_finished();
-				it = promises.erase(it);
+				if (dispatcher->push_cancelled(p) && __atomic_load_n(&dispatcher->sleeping, __ATOMIC_SEQ_CST))
+					dispatcher->signal_control_event();
 			}
 			else
 			{
-				++it;
+				// The request is read after the flag is cleared,
+				// so that a concurrent `cancel` is never lost.
+				__atomic_store_n(&p->m_cancel_queued, false, __ATOMIC_SEQ_CST);
+				if (dispatcher == this && p->m_promise->perform_pending_cancels())
+					out.push_back(p->m_self);
+				p->m_promise->release();
 			}
+
+			p = next;
 		}
 	}
 
+	bool has_submitted() const
+	{
+		return __atomic_load_n(&submitted, __ATOMIC_ACQUIRE) != 0;
+	}
+
+	// Producers only signal the control event when they push to an empty
+	// queue or cancel list while the dispatch thread sleeps; the thread must therefore
+	// check the queue after announcing that it's going to sleep.
+	// Returns true if it must not block.
+	bool prepare_to_sleep()
+	{
+		__atomic_store_n(&sleeping, true, __ATOMIC_SEQ_CST);
+		return __atomic_load_n(&submitted, __ATOMIC_SEQ_CST) != 0 || __atomic_load_n(&cancelled, __ATOMIC_SEQ_CST) != 0;
+	}
+
+	void take_promise(std::list<parallel_promise> & out, promise_impl * p)
+	{
+		p->m_self = p->m_node.begin();
+		out.splice(out.end(), p->m_node);
+
+		// Cancels requested before the promise was taken
+		// may have been dropped by another runner.
+		__atomic_store_n(&p->m_dispatcher, this, __ATOMIC_SEQ_CST);
+		p->m_promise->perform_pending_cancels();
+	}
+
+	// Moves the submitted promises to `out`. If the runner is a member
+	// of a group, it also takes some of the stealable promises
+	// that were submitted to busy runners with higher load.
+	void take_new_promises(std::list<parallel_promise> & out)
+	{
+		for (promise_impl * p = this->take_submitted(); p != 0; )
+		{
+			promise_impl * next = p->m_next_submitted;
+			this->take_promise(out, p);
+			p = next;
+		}
+
+		// Leaving the group locks the mutex, after which
+		// the other runners must not be accessed.
+		scoped_mutex l(mutex);
+		if (!group)
+			return;
+
+		for (size_t i = 0; i < group->size(); ++i)
+		{
+			impl * victim = (*group)[i]->m_pimpl.get();
+			if (victim == this || __atomic_load_n(&victim->sleeping, __ATOMIC_SEQ_CST) || !victim->has_submitted())
+				continue;
+
+			size_t my_load = __atomic_load_n(&load, __ATOMIC_RELAXED);
+			size_t victim_load = __atomic_load_n(&victim->load, __ATOMIC_RELAXED);
+
+			// The victim's queue is taken as a whole; the promises
+			// that aren't stolen are pushed back and may thus be started
+			// after the ones submitted in the meantime.
+			promise_impl * first = victim->take_submitted();
+
+			size_t stealable = 0;
+			for (promise_impl * p = first; p != 0; p = p->m_next_submitted)
+			{
+				if (p->m_node.front().stealable)
+					++stealable;
+			}
+
+			size_t quota = 0;
+			if (victim_load > my_load)
+				quota = (std::min)(stealable, (victim_load - my_load + 1) / 2);
+
+			promise_impl * kept_first = 0;
+			promise_impl * kept_last = 0;
+			for (promise_impl * p = first; p != 0; )
+			{
+				promise_impl * next = p->m_next_submitted;
+				parallel_promise & pp = p->m_node.front();
+				if (quota != 0 && pp.stealable)
+				{
+					pp.promise->set_runner(owner);
+					this->take_promise(out, p);
+					__atomic_sub_fetch(&victim->load, 1, __ATOMIC_RELAXED);
+					__atomic_add_fetch(&load, 1, __ATOMIC_RELAXED);
+					--quota;
+				}
+				else
+				{
+					// Keeps the order of submission when pushed back.
+					p->m_next_submitted = kept_first;
+					kept_first = p;
+					if (!kept_last)
+						kept_last = p;
+				}
+
+				p = next;
+			}
+
+			if (kept_first && victim->push_submitted(kept_first, kept_last) && __atomic_load_n(&victim->sleeping, __ATOMIC_SEQ_CST))
+				victim->signal_control_event();
+		}
+	}
+
+	// Wakes up an idle member of the group so that it can steal
+	// promises from this runner.
+	void wake_thief(std::vector<async_runner *> const & group)
+	{
+		for (size_t i = 0; i < group.size(); ++i)
+		{
+			impl * thief = group[i]->m_pimpl.get();
+			if (thief != this && __atomic_load_n(&thief->sleeping, __ATOMIC_SEQ_CST))
+			{
+				thief->signal_control_event();
+				break;
+			}
+		}
+	}
+
+	// The wheel is created once a task waits for a deadline.
+	linux_timer_wheel & timer_wheel()
+	{
+		if (!timers)
+			timers.reset(new linux_timer_wheel());
+		return *timers;
+	}
+
 	static void * dispatch_thread(void * ctx)
 	{
 		impl * pimpl = (impl *)ctx;
+		scoped_task_reaper reaper(&pimpl->reaper);
 
 		try
 		{
@@ -270,17 +995,51 @@ struct async_runner::impl
 		assert(r >= 0 || errno == EAGAIN);
 	}
 
+	async_runner * owner;
+	runner_reaper reaper;
+
+	// Declared before the promises, whose timers may still be armed
+	// when they're destroyed.
+	std::unique_ptr<linux_timer_wheel> timers;
+
+	// Protects the group membership.
 	pthread_mutex_t mutex;
+
+	// The promises submitted since the dispatch thread last took them,
+	// in the reverse order of submission. Producers push them
+	// without locking.
+	promise_impl * submitted;
+
+	// The promises with pending cancel requests, pushed by `cancel`
+	// without locking.
+	promise_impl * cancelled;
+
+	std::vector<async_runner *> const * group;
+
+	// The number of unfinished promises, including the new ones.
+	size_t load;
+
+	// Set while the dispatch thread waits for poll items.
+	bool sleeping;
+
 	std::list<parallel_promise> promises;
-	std::list<parallel_promise> new_promises;
 	bool stopped;
+	size_t rotation;
+
+	// The number of the promises' poll items registered in the poll set.
+	size_t registered_items;
+
+	linux_runner_metrics metrics;
 
 	pthread_t thread;
 	int control_event;
+
+	std::unique_ptr<linux_epoll_set> epoll;
+	std::unique_ptr<linux_io_uring> uring;
 };
 
-async_runner::async_runner()
-	: m_pimpl(new impl())
+async_runner::async_runner(runner_backend_t backend)
+	: m_pimpl(new impl(this, backend))
 {
 	if (pthread_create(&m_pimpl->thread, 0, &impl::dispatch_thread, m_pimpl.get()) != 0)
 		throw std::runtime_error("failed to create a dispatch thread");
@@ -295,36 +1054,87 @@ async_runner::~async_runner()
 	pthread_join(m_pimpl->thread, &retval);
 }
 
-async_runner::submit_context::submit_context(async_runner & runner)
-	: m_runner(runner)
+runner_backend_t async_runner::backend() const
+{
+	if (m_pimpl->epoll)
+		return rb_epoll;
+	if (m_pimpl->uring)
+		return rb_io_uring;
+	return rb_poll;
+}
+
+size_t async_runner::load() const
 {
-	scoped_mutex l(m_runner.m_pimpl->mutex);
+	return __atomic_load_n(&m_pimpl->load, __ATOMIC_RELAXED);
+}
 
-	parallel_promise pp = {};
-	m_runner.m_pimpl->new_promises.push_back(std::move(pp));
+void async_runner::enable_stats(bool enable)
+{
+	m_pimpl->metrics.enable(enable);
+}
 
-	l.detach();
+runner_stats async_runner::stats() const
+{
+	return m_pimpl->metrics.snapshot(this->load());
+}
+
+void async_runner::join_group(std::vector<async_runner *> const * group)
+{
+	scoped_mutex l(m_pimpl->mutex);
+	__atomic_store_n(&m_pimpl->group, group, __ATOMIC_RELEASE);
+}
+
+async_runner::submit_context::submit_context(async_runner & runner, bool stealable)
+	: m_runner(runner), m_stealable(stealable)
+{
 }
 
 async_runner::submit_context::~submit_context()
 {
-	if (m_runner.m_pimpl->new_promises.back().promise == 0)
-		m_runner.m_pimpl->new_promises.pop_back();
-	pthread_mutex_unlock(&m_runner.m_pimpl->mutex);
 }
 
 void async_runner::submit_context::submit(detail::async_promise_base * p)
 {
-	assert(m_runner.m_pimpl->new_promises.back().promise == 0);
-	m_runner.m_pimpl->new_promises.back().promise = p;
-	m_runner.m_pimpl->signal_control_event();
+	impl & runner = *m_runner.m_pimpl;
+	impl::promise_impl * pi = p->m_pimpl.get();
+
+	parallel_promise & pp = pi->m_node.front();
+	assert(pp.promise == 0);
+	pp.promise = p;
+	pp.stealable = m_stealable;
+	p->addref();
+	__atomic_add_fetch(&runner.load, 1, __ATOMIC_RELAXED);
+
+	// The dispatch thread checks the queue before it goes to sleep;
+	// it only has to be woken up if it may have missed this push.
+	if (runner.push_submitted(pi, pi) && __atomic_load_n(&runner.sleeping, __ATOMIC_SEQ_CST))
+		runner.signal_control_event();
+
+	std::vector<async_runner *> const * group = __atomic_load_n(&runner.group, __ATOMIC_ACQUIRE);
+	if (group && m_stealable && !__atomic_load_n(&runner.sleeping, __ATOMIC_SEQ_CST))
+		runner.wake_thief(*group);
 }
 
 void async_promise_base::cancel(cancel_level cl)
 {
-	pthread_mutex_lock(&m_pimpl->m_runner->m_pimpl->mutex);
-	if (m_pimpl->m_request_cl < cl)
-		m_pimpl->m_request_cl = cl;
-	m_pimpl->m_runner->m_pimpl->signal_control_event();
-	pthread_mutex_unlock(&m_pimpl->m_runner->m_pimpl->mutex);
+	cancel_level request_cl;
+	__atomic_load(&m_pimpl->m_request_cl, &request_cl, __ATOMIC_SEQ_CST);
+	do
+	{
+		if (cl <= request_cl)
+			return;
+	}
+	while (!__atomic_compare_exchange(&m_pimpl->m_request_cl, &request_cl, &cl, true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	// The promise is linked into a list at most once; the runner
+	// reads the latest request when it gets to it.
+	if (__atomic_exchange_n(&m_pimpl->m_cancel_queued, true, __ATOMIC_SEQ_CST))
+		return;
+
+	// The promise may get stolen by another runner; its original
+	// runner then forwards the request.
+	this->addref();
+	async_runner::impl & runner = *__atomic_load_n(&m_pimpl->m_runner, __ATOMIC_ACQUIRE)->m_pimpl;
+	if (runner.push_cancelled(m_pimpl.get()) && __atomic_load_n(&runner.sleeping, __ATOMIC_SEQ_CST))
+		runner.signal_control_event();
 }
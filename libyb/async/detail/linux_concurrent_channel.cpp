@@ -0,0 +1,199 @@
+#include "concurrent_channel_detail.hpp"
+#include <stdexcept>
+using namespace yb;
+using namespace yb::detail;
+
+concurrent_channel_core::concurrent_channel_core(size_t capacity, bool spsc)
+	: m_mask(0), m_seq(0), m_spsc(spsc), m_refcount(1), m_tail(0), m_head(0)
+{
+	// Tickets wrap around, they must stay unambiguous.
+	if (capacity > 0x80000000u)
+		throw std::length_error("concurrent_channel capacity is too large");
+
+	uint32_t size = 1;
+	while (size < capacity)
+		size *= 2;
+	m_mask = size - 1;
+
+	m_waiters[wk_receiver] = 0;
+	m_waiters[wk_sender] = 0;
+
+	if (!m_spsc)
+	{
+		m_seq = new uint32_t[size];
+		for (uint32_t i = 0; i != size; ++i)
+			m_seq[i] = i;
+	}
+}
+
+concurrent_channel_core::~concurrent_channel_core()
+{
+	delete [] m_seq;
+}
+
+void concurrent_channel_core::addref() throw()
+{
+	__atomic_add_fetch(&m_refcount, 1, __ATOMIC_RELAXED);
+}
+
+void concurrent_channel_core::release() throw()
+{
+	if (__atomic_sub_fetch(&m_refcount, 1, __ATOMIC_ACQ_REL) == 0)
+		delete this;
+}
+
+bool concurrent_channel_core::begin_push(uint32_t & ticket) throw()
+{
+	if (m_spsc)
+	{
+		// Only this thread moves the tail.
+		uint32_t tail = m_tail;
+		if (tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) > m_mask)
+			return false;
+		ticket = tail;
+		return true;
+	}
+
+	uint32_t pos = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		// The slot is free once its sequence number reaches the ticket.
+		int32_t diff = (int32_t)(__atomic_load_n(&m_seq[pos & m_mask], __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&m_tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	ticket = pos;
+	return true;
+}
+
+void concurrent_channel_core::end_push(uint32_t ticket) throw()
+{
+	if (m_spsc)
+		__atomic_store_n(&m_tail, ticket + 1, __ATOMIC_RELEASE);
+	else
+		__atomic_store_n(&m_seq[ticket & m_mask], ticket + 1, __ATOMIC_RELEASE);
+
+	// Pairs with the fence in `begin_wait`; either the waiter sees
+	// the element, or this thread sees the waiter.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	this->wake(wk_receiver);
+	this->wake(wk_sender);
+}
+
+bool concurrent_channel_core::begin_pop(uint32_t & ticket) throw()
+{
+	if (m_spsc)
+	{
+		uint32_t head = m_head;
+		if (__atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) == head)
+			return false;
+		ticket = head;
+		return true;
+	}
+
+	uint32_t pos = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		// The slot is filled once its sequence number is past the ticket.
+		int32_t diff = (int32_t)(__atomic_load_n(&m_seq[pos & m_mask], __ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&m_head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	ticket = pos;
+	return true;
+}
+
+void concurrent_channel_core::end_pop(uint32_t ticket) throw()
+{
+	if (m_spsc)
+		__atomic_store_n(&m_head, ticket + 1, __ATOMIC_RELEASE);
+	else
+		__atomic_store_n(&m_seq[ticket & m_mask], ticket + m_mask + 1, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	this->wake(wk_sender);
+	this->wake(wk_receiver);
+}
+
+bool concurrent_channel_core::ready(waiter_kind kind) const throw()
+{
+	if (m_spsc)
+	{
+		uint32_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+		uint32_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+		return kind == wk_receiver? tail != head: tail - head <= m_mask;
+	}
+
+	// A position that has moved on in the meantime counts as ready;
+	// the waiter then merely tries again.
+	if (kind == wk_receiver)
+	{
+		uint32_t pos = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+		return (int32_t)(__atomic_load_n(&m_seq[pos & m_mask], __ATOMIC_ACQUIRE) - (pos + 1)) >= 0;
+	}
+	else
+	{
+		uint32_t pos = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+		return (int32_t)(__atomic_load_n(&m_seq[pos & m_mask], __ATOMIC_ACQUIRE) - pos) >= 0;
+	}
+}
+
+void concurrent_channel_core::wake(waiter_kind kind) throw()
+{
+	if (__atomic_load_n(&m_waiters[kind], __ATOMIC_RELAXED) != 0 && this->ready(kind))
+		m_events[kind].set();
+}
+
+bool concurrent_channel_core::begin_wait(waiter_kind kind)
+{
+	__atomic_add_fetch(&m_waiters[kind], 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (this->ready(kind))
+	{
+		__atomic_sub_fetch(&m_waiters[kind], 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	return true;
+}
+
+void concurrent_channel_core::end_wait(waiter_kind kind) throw()
+{
+	__atomic_sub_fetch(&m_waiters[kind], 1, __ATOMIC_RELAXED);
+
+	// The event may have been meant for other waiters as well;
+	// they get woken again if there's still something for them.
+	m_events[kind].reset();
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	this->wake(kind);
+}
+
+task<void> concurrent_channel_core::wait(waiter_kind kind)
+{
+	return m_events[kind].wait();
+}
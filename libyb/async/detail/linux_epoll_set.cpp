@@ -0,0 +1,171 @@
+#include "linux_epoll_set.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cassert>
+#include <errno.h>
+#include <poll.h>
+using namespace yb;
+using namespace yb::detail;
+
+// The revents are passed around as poll flags.
+static_assert(EPOLLIN == POLLIN && EPOLLOUT == POLLOUT && EPOLLPRI == POLLPRI
+	&& EPOLLERR == POLLERR && EPOLLHUP == POLLHUP, "epoll and poll flags differ");
+
+linux_epoll_set::fd_entry::fd_entry()
+	: registered(false), registered_events(0), error(0), pending(false)
+{
+}
+
+linux_epoll_set::linux_epoll_set()
+	: m_events(64)
+{
+	m_epoll.reset(epoll_create1(EPOLL_CLOEXEC));
+	if (m_epoll.empty())
+		throw std::runtime_error("cannot create epoll instance");
+}
+
+void linux_epoll_set::add(int fd, short events, void * owner, size_t index)
+{
+	assert(fd >= 0);
+	if ((size_t)fd >= m_fds.size())
+		m_fds.resize(fd + 1);
+
+	fd_entry & e = m_fds[fd];
+	registration reg = { owner, index, events };
+	e.regs.push_back(reg);
+
+	if (!e.pending)
+	{
+		e.pending = true;
+		m_pending_fds.push_back(fd);
+	}
+}
+
+void linux_epoll_set::remove(int fd, void * owner, size_t index)
+{
+	assert(fd >= 0 && (size_t)fd < m_fds.size());
+
+	fd_entry & e = m_fds[fd];
+	for (size_t i = 0; i < e.regs.size(); ++i)
+	{
+		if (e.regs[i].owner == owner && e.regs[i].index == index)
+		{
+			e.regs[i] = e.regs.back();
+			e.regs.pop_back();
+			break;
+		}
+	}
+
+	if (!e.pending)
+	{
+		e.pending = true;
+		m_pending_fds.push_back(fd);
+	}
+}
+
+void linux_epoll_set::commit()
+{
+	for (size_t i = 0; i < m_pending_fds.size(); ++i)
+	{
+		int fd = m_pending_fds[i];
+		fd_entry & e = m_fds[fd];
+		e.pending = false;
+
+		if (e.regs.empty())
+		{
+			// The fd may have been closed already, in which case
+			// the kernel has removed it from the set.
+			if (e.registered)
+				epoll_ctl(m_epoll.get(), EPOLL_CTL_DEL, fd, 0);
+
+			if (e.error)
+				m_forced_fds.erase(std::find(m_forced_fds.begin(), m_forced_fds.end(), fd));
+
+			e.registered = false;
+			e.error = 0;
+			continue;
+		}
+
+		if (e.error)
+			continue;
+
+		short events = 0;
+		for (size_t j = 0; j < e.regs.size(); ++j)
+			events |= e.regs[j].events;
+
+		if (e.registered && events == e.registered_events)
+			continue;
+
+		struct epoll_event ev = {};
+		ev.events = (uint16_t)events;
+		ev.data.fd = fd;
+
+		// The fd may have been closed and its number reused since it was
+		// registered, so the kernel's view of the set may be different from ours.
+		int r = epoll_ctl(m_epoll.get(), e.registered? EPOLL_CTL_MOD: EPOLL_CTL_ADD, fd, &ev);
+		if (r == -1 && errno == ENOENT)
+			r = epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, fd, &ev);
+		else if (r == -1 && errno == EEXIST)
+			r = epoll_ctl(m_epoll.get(), EPOLL_CTL_MOD, fd, &ev);
+
+		if (r == -1)
+		{
+			e.registered = false;
+			e.error = errno;
+			m_forced_fds.push_back(fd);
+			continue;
+		}
+
+		e.registered = true;
+		e.registered_events = events;
+	}
+
+	m_pending_fds.clear();
+}
+
+void linux_epoll_set::wait(int timeout)
+{
+	assert(m_pending_fds.empty());
+	m_ready.clear();
+
+	if (!m_forced_fds.empty())
+		timeout = 0;
+
+	int r = epoll_wait(m_epoll.get(), m_events.data(), m_events.size(), timeout);
+	if (r == -1)
+	{
+		if (errno != EINTR)
+			throw std::runtime_error("epoll_wait failed");
+		r = 0;
+	}
+
+	for (int i = 0; i < r; ++i)
+		this->dispatch(m_events[i].data.fd, (short)m_events[i].events);
+
+	// Mimic poll for fds that epoll refused: regular files (EPERM)
+	// are always ready, invalid fds (EBADF) get POLLNVAL.
+	for (size_t i = 0; i < m_forced_fds.size(); ++i)
+	{
+		int fd = m_forced_fds[i];
+		this->dispatch(fd, m_fds[fd].error == EPERM? (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM): POLLNVAL);
+	}
+
+	if ((size_t)r == m_events.size())
+		m_events.resize(m_events.size() * 2);
+}
+
+void linux_epoll_set::dispatch(int fd, short revents)
+{
+	fd_entry const & e = m_fds[fd];
+	for (size_t i = 0; i < e.regs.size(); ++i)
+	{
+		registration const & reg = e.regs[i];
+
+		short rev = revents & (reg.events | POLLERR | POLLHUP | POLLNVAL);
+		if (rev)
+		{
+			ready_item item = { reg.owner, reg.index, rev };
+			m_ready.push_back(item);
+		}
+	}
+}
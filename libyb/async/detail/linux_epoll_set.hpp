@@ -0,0 +1,82 @@
+#ifndef LIBYB_ASYNC_DETAIL_LINUX_EPOLL_SET_HPP
+#define LIBYB_ASYNC_DETAIL_LINUX_EPOLL_SET_HPP
+
+#include "../../utils/noncopyable.hpp"
+#include "../../utils/detail/scoped_unix_fd.hpp"
+#include <vector>
+#include <stddef.h>
+#include <sys/epoll.h>
+
+namespace yb {
+namespace detail {
+
+// Keeps poll items registered with an epoll instance across waits.
+//
+// Each poll item is identified by an opaque owner pointer and an index
+// into the owner's poll items. Several items may share an fd; the fd
+// is registered once with the union of their events. Changes are collected
+// and applied by `commit`, so that removing and re-adding the same item
+// doesn't cost any syscalls.
+class linux_epoll_set
+	: noncopyable
+{
+public:
+	struct ready_item
+	{
+		void * owner;
+		size_t index;
+		short revents;
+	};
+
+	linux_epoll_set();
+
+	void add(int fd, short events, void * owner, size_t index);
+	void remove(int fd, void * owner, size_t index);
+	void commit();
+
+	// Blocks until at least one of the registered fds is ready
+	// or the timeout (in milliseconds, -1 for infinity) expires.
+	// Afterwards, `ready_items` contains the items whose events fired.
+	void wait(int timeout);
+
+	std::vector<ready_item> const & ready_items() const { return m_ready; }
+
+private:
+	struct registration
+	{
+		void * owner;
+		size_t index;
+		short events;
+	};
+
+	struct fd_entry
+	{
+		// Whether and with which events the fd is registered
+		// in the epoll instance.
+		bool registered;
+		short registered_events;
+
+		// Set to errno if epoll refused the fd, e.g. because
+		// it's a regular file.
+		int error;
+
+		bool pending;
+		std::vector<registration> regs;
+
+		fd_entry();
+	};
+
+	void dispatch(int fd, short revents);
+
+	scoped_unix_fd m_epoll;
+	std::vector<fd_entry> m_fds;
+	std::vector<int> m_pending_fds;
+	std::vector<int> m_forced_fds;
+	std::vector<struct epoll_event> m_events;
+	std::vector<ready_item> m_ready;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_LINUX_EPOLL_SET_HPP
@@ -0,0 +1,162 @@
+#ifndef LIBYB_ASYNC_DETAIL_LINUX_FDIO_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_LINUX_FDIO_TASK_HPP
+
+#include "../task_base.hpp"
+#include "../cancel_exception.hpp"
+#include "linux_wait_context.hpp"
+#include "task_node_pool.hpp"
+#include "../../utils/noncopyable.hpp"
+#include <stdexcept>
+#include <utility>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace yb {
+namespace detail {
+
+// Reads or writes a non-blocking fd once it becomes ready.
+//
+// The operation is attached to the task's poll item, so that runners
+// able to submit it to the kernel directly don't have to poll first.
+template <typename Canceller>
+class linux_fdio_task
+	: public task_base<size_t>, public pooled_task_node, noncopyable
+{
+public:
+	linux_fdio_task(int fd, bool write, uint8_t * buffer, size_t size, Canceller && canceller)
+		: m_cancelled(false), m_canceller(std::move(canceller))
+	{
+		m_op.fd = fd;
+		m_op.write = write;
+		m_op.buffer = buffer;
+		m_op.size = size;
+		m_op.issuer = 0;
+		m_op.done = false;
+		m_op.result = 0;
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (!m_cancelled && !m_canceller(cl))
+			m_cancelled = true;
+	}
+
+	task_result<size_t> cancel_and_wait() throw()
+	{
+		if (!m_op.done && !m_cancelled && !m_canceller(cl_kill))
+			m_cancelled = true;
+
+		// An operation in flight is cancelled in the kernel or, if the
+		// canceller refuses, completed there; it's only polled for here
+		// if the runner doesn't issue operations or the kernel gave up.
+		if (m_op.issuer)
+		{
+			if (m_cancelled)
+				m_op.issuer->cancel_and_wait(m_op);
+			else
+				m_op.issuer->complete_and_wait(m_op);
+		}
+
+		while (!m_op.done && !m_cancelled)
+		{
+			struct pollfd pf = {};
+			pf.fd = m_op.fd;
+			pf.events = m_op.write? POLLOUT: POLLIN;
+			poll(&pf, 1, -1);
+			this->perform();
+		}
+
+		if (m_op.done)
+			return this->get_result();
+		return task_result<size_t>(std::copy_exception(task_cancelled()));
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (m_op.done)
+		{
+			ctx.set_finished();
+		}
+		else if (m_cancelled)
+		{
+			// The runner cancels the operation once it sees that
+			// it's no longer attached; wait until it does.
+			if (m_op.issuer)
+				ctx.set_volatile();
+			else
+				ctx.set_finished();
+		}
+		else
+		{
+			task_wait_preparation_context_impl * impl = ctx.get();
+
+			struct pollfd pf = {};
+			pf.fd = m_op.fd;
+			pf.events = m_op.write? POLLOUT: POLLIN;
+			impl->m_io_ops.push_back(std::make_pair(impl->m_pollfds.size(), &m_op));
+			impl->m_pollfds.push_back(pf);
+		}
+	}
+
+	task<size_t> finish_wait(task_wait_finalization_context &) throw()
+	{
+		if (!m_op.done)
+		{
+			if (m_cancelled)
+				return async::raise<size_t>(task_cancelled());
+
+			this->perform();
+			if (!m_op.done)
+				return nulltask;
+		}
+
+		return async::result(this->get_result());
+	}
+
+private:
+	void perform()
+	{
+		ssize_t r = m_op.write
+			? ::write(m_op.fd, m_op.buffer, m_op.size)
+			: ::read(m_op.fd, m_op.buffer, m_op.size);
+
+		if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return;
+
+		m_op.done = true;
+		m_op.result = r == -1? -errno: r;
+	}
+
+	task_result<size_t> get_result() const
+	{
+		if (m_op.result < 0)
+			return task_result<size_t>(std::copy_exception(std::runtime_error(m_op.write? "write failed": "read failed")));
+		return task_result<size_t>((size_t)m_op.result);
+	}
+
+	linux_io_op m_op;
+	bool m_cancelled;
+	Canceller m_canceller;
+};
+
+} // namespace detail
+
+template <typename Canceller>
+task<size_t> make_linux_fdio_task(int fd, bool write, uint8_t * buffer, size_t size, Canceller && canceller)
+{
+	assert(fd >= 0);
+
+	try
+	{
+		return task<size_t>(new detail::linux_fdio_task<Canceller>(fd, write, buffer, size, std::move(canceller)));
+	}
+	catch (...)
+	{
+		return async::raise<size_t>(std::current_exception());
+	}
+}
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_LINUX_FDIO_TASK_HPP
@@ -4,24 +4,34 @@
 #include "../task_base.hpp"
 #include "../cancel_exception.hpp"
 #include "linux_wait_context.hpp"
+#include "task_reaper.hpp"
 #include "../../utils/noncopyable.hpp"
 #include <exception>
+#include <memory>
 #include <utility>
 #include <poll.h>
 
 namespace yb {
 namespace detail {
 
+// Polls an fd. If `fd_owner` is set, it keeps the fd open
+// for as long as the task exists.
 template <typename Canceller>
 class linux_fdpoll_task
 	: public task_base<short>, noncopyable
 {
 public:
-	linux_fdpoll_task(int fd, short events, Canceller && canceller)
-		: m_fd(fd), m_events(events), m_canceller(std::move(canceller))
+	linux_fdpoll_task(int fd, short events, Canceller && canceller, std::shared_ptr<void> const & fd_owner)
+		: m_fd(fd), m_events(events), m_canceller(std::move(canceller)), m_fd_owner(fd_owner)
 	{
 	}
 
+	linux_fdpoll_task(linux_fdpoll_task && o) throw()
+		: m_fd(o.m_fd), m_events(o.m_events), m_canceller(std::move(o.m_canceller)), m_fd_owner(std::move(o.m_fd_owner))
+	{
+		o.m_fd = -1;
+	}
+
 	void cancel(cancel_level cl) throw()
 	{
 		if (m_fd != -1 && !m_canceller(cl))
@@ -33,6 +43,14 @@ public:
 		if (m_fd != -1 && !m_canceller(cl_kill))
 			m_fd = -1;
 
+		// Rather than blocking the runner until the fd gets ready,
+		// let the runner wait for it along with its other tasks.
+		// The moved-from task is left cancelled. A borrowed fd may be
+		// closed (and its number reused) once the task is gone,
+		// so only tasks that keep their fd open are left to the runner.
+		if (m_fd != -1 && m_fd_owner)
+			reap_task(*this);
+
 		if (m_fd != -1)
 		{
 			struct pollfd pf;
@@ -78,18 +96,22 @@ private:
 	int m_fd;
 	short m_events;
 	Canceller m_canceller;
+	std::shared_ptr<void> m_fd_owner;
 };
 
 } // namespace detail
 
+// Polls an fd kept open by `fd_owner`. Dropped inside a runner,
+// a task that refuses to be cancelled is finished by the runner,
+// which keeps the owner alive until then.
 template <typename Canceller>
-task<short> make_linux_pollfd_task(int fd, short events, Canceller && canceller)
+task<short> make_linux_pollfd_task(std::shared_ptr<void> const & fd_owner, int fd, short events, Canceller && canceller)
 {
 	assert(fd >= 0);
 
 	try
 	{
-		return task<short>(new detail::linux_fdpoll_task<Canceller>(fd, events, std::move(canceller)));
+		return task<short>::make(detail::linux_fdpoll_task<Canceller>(fd, events, std::move(canceller), fd_owner));
 	}
 	catch (...)
 	{
@@ -106,6 +128,15 @@ task<short> make_linux_pollfd_task(int fd, short events, Canceller && canceller)
 	}
 }
 
+// Polls an fd that the caller keeps open until the task completes.
+// If the canceller refuses to cancel, dropping the task blocks
+// until the fd gets ready.
+template <typename Canceller>
+task<short> make_linux_pollfd_task(int fd, short events, Canceller && canceller)
+{
+	return make_linux_pollfd_task(std::shared_ptr<void>(), fd, events, std::move(canceller));
+}
+
 } // namespace yb
 
 #endif // LIBYB_ASYNC_DETAIL_LINUX_FDPOLL_TASK_HPP
@@ -0,0 +1,496 @@
+#include "linux_io_uring.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+using namespace yb;
+using namespace yb::detail;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params * p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t make_user_data(size_t s, int kind)
+{
+	return ((uint64_t)s << 2) | kind;
+}
+
+linux_io_uring::linux_io_uring()
+	: m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED), m_sqes((struct io_uring_sqe *)MAP_FAILED),
+	m_sq_local_tail(0), m_unsubmitted(0), m_inflight(0), m_reported(0)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof params);
+
+	m_ring.reset(sys_io_uring_setup(256, &params));
+	if (m_ring.empty())
+		throw std::runtime_error("io_uring is not supported");
+
+	size_t const ops_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	std::vector<uint64_t> probe_buf((ops_size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+	struct io_uring_probe * probe = (struct io_uring_probe *)probe_buf.data();
+	if (sys_io_uring_register(m_ring.get(), IORING_REGISTER_PROBE, probe, 256) < 0)
+		throw std::runtime_error("io_uring is too old");
+
+	static int const required_ops[] = { IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_READ, IORING_OP_WRITE };
+	for (size_t i = 0; i < sizeof required_ops / sizeof required_ops[0]; ++i)
+	{
+		int op = required_ops[i];
+		if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			throw std::runtime_error("io_uring doesn't support a required opcode");
+	}
+
+	m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		m_sq_ring_size = m_cq_ring_size = (std::max)(m_sq_ring_size, m_cq_ring_size);
+
+	m_sq_ring = mmap(0, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring.get(), IORING_OFF_SQ_RING);
+	if (m_sq_ring == MAP_FAILED)
+		throw std::runtime_error("cannot map the io_uring submission queue");
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_cq_ring = m_sq_ring;
+	}
+	else
+	{
+		m_cq_ring = mmap(0, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring.get(), IORING_OFF_CQ_RING);
+		if (m_cq_ring == MAP_FAILED)
+		{
+			munmap(m_sq_ring, m_sq_ring_size);
+			throw std::runtime_error("cannot map the io_uring completion queue");
+		}
+	}
+
+	m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	m_sqes = (struct io_uring_sqe *)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring.get(), IORING_OFF_SQES);
+	if (m_sqes == MAP_FAILED)
+	{
+		if (m_cq_ring != m_sq_ring)
+			munmap(m_cq_ring, m_cq_ring_size);
+		munmap(m_sq_ring, m_sq_ring_size);
+		throw std::runtime_error("cannot map the io_uring submission entries");
+	}
+
+	char * sq = (char *)m_sq_ring;
+	m_sq_head = (unsigned *)(sq + params.sq_off.head);
+	m_sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	m_sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	m_sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+	m_sq_array = (unsigned *)(sq + params.sq_off.array);
+	m_sq_local_tail = *m_sq_tail;
+
+	char * cq = (char *)m_cq_ring;
+	m_cq_head = (unsigned *)(cq + params.cq_off.head);
+	m_cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	m_cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+}
+
+linux_io_uring::~linux_io_uring()
+{
+	munmap(m_sqes, m_sqes_size);
+	if (m_cq_ring != m_sq_ring)
+		munmap(m_cq_ring, m_cq_ring_size);
+	munmap(m_sq_ring, m_sq_ring_size);
+}
+
+size_t linux_io_uring::alloc_slot()
+{
+	if (!m_free_slots.empty())
+	{
+		size_t s = m_free_slots.back();
+		m_free_slots.pop_back();
+		return s;
+	}
+
+	m_slots.push_back(slot());
+	return m_slots.size() - 1;
+}
+
+void linux_io_uring::mark_dirty(size_t s)
+{
+	if (!m_slots[s].dirty)
+	{
+		m_slots[s].dirty = true;
+		m_dirty_slots.push_back(s);
+	}
+}
+
+void linux_io_uring::add(int fd, short events, linux_io_op * op, void * owner, size_t index)
+{
+	std::pair<void *, size_t> key(owner, index);
+
+	// An operation in flight keeps its slot, even if the item's index changed;
+	// otherwise, an unchanged item that was removed and added again keeps
+	// its slot too. Either way, nothing needs to be resubmitted.
+	size_t s = (size_t)-1;
+	if (op && op->issuer == this)
+	{
+		s = m_op_slots[op];
+	}
+	else
+	{
+		std::map<std::pair<void *, size_t>, size_t>::iterator it = m_items.find(key);
+		if (it != m_items.end())
+		{
+			slot const & sl = m_slots[it->second];
+			if (!sl.registered && sl.fd == fd && sl.events == events && sl.op == op)
+				s = it->second;
+			else
+				m_items.erase(it);
+		}
+	}
+
+	if (s != (size_t)-1)
+	{
+		slot & sl = m_slots[s];
+		if (sl.owner != owner || sl.index != index)
+		{
+			std::map<std::pair<void *, size_t>, size_t>::iterator it = m_items.find(std::make_pair(sl.owner, sl.index));
+			if (it != m_items.end() && it->second == s)
+				m_items.erase(it);
+		}
+
+		sl.owner = owner;
+		sl.index = index;
+		sl.registered = true;
+		sl.quiesced = false;
+		m_items[key] = s;
+		this->mark_dirty(s);
+		return;
+	}
+
+	s = this->alloc_slot();
+	slot & sl = m_slots[s];
+	sl.owner = owner;
+	sl.index = index;
+	sl.fd = fd;
+	sl.events = events;
+	sl.op = op;
+	sl.registered = true;
+	sl.dirty = false;
+	sl.cancelling = false;
+	sl.quiesced = false;
+	sl.inflight = 0;
+	m_items[key] = s;
+	this->mark_dirty(s);
+}
+
+void linux_io_uring::remove(int fd, void * owner, size_t index)
+{
+	std::map<std::pair<void *, size_t>, size_t>::iterator it = m_items.find(std::make_pair(owner, index));
+	assert(it != m_items.end() && m_slots[it->second].fd == fd);
+	(void)fd;
+
+	m_slots[it->second].registered = false;
+	this->mark_dirty(it->second);
+}
+
+void linux_io_uring::commit()
+{
+	for (size_t i = 0; i < m_dirty_slots.size(); ++i)
+	{
+		size_t s = m_dirty_slots[i];
+		slot & sl = m_slots[s];
+		sl.dirty = false;
+
+		if (sl.registered)
+		{
+			if (sl.inflight == 0 && !sl.quiesced && !(sl.op && sl.op->done))
+				this->arm(s);
+			continue;
+		}
+
+		if (sl.inflight != 0)
+		{
+			if (!sl.cancelling)
+				this->cancel_slot(s);
+			continue;
+		}
+
+		std::map<std::pair<void *, size_t>, size_t>::iterator it = m_items.find(std::make_pair(sl.owner, sl.index));
+		if (it != m_items.end() && it->second == s)
+			m_items.erase(it);
+		m_free_slots.push_back(s);
+	}
+
+	m_dirty_slots.clear();
+}
+
+void linux_io_uring::arm(size_t s)
+{
+	slot & sl = m_slots[s];
+	sl.cancelling = false;
+
+	if (!sl.op)
+	{
+		struct io_uring_sqe * sqe = this->get_sqe();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = sl.fd;
+		sqe->poll32_events = (unsigned short)sl.events;
+		sqe->user_data = make_user_data(s, ck_poll);
+		sl.inflight = 1;
+		++m_inflight;
+		return;
+	}
+
+	// Non-blocking fds fail reads with EAGAIN instead of waiting,
+	// so the operation is linked behind a poll.
+	this->reserve_sqes(2);
+
+	struct io_uring_sqe * sqe = this->get_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sl.fd;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->poll32_events = (unsigned short)sl.events;
+	sqe->user_data = make_user_data(s, ck_link);
+
+	sqe = this->get_sqe();
+	sqe->opcode = sl.op->write? IORING_OP_WRITE: IORING_OP_READ;
+	sqe->fd = sl.fd;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = (uint64_t)(uintptr_t)sl.op->buffer;
+	sqe->len = (uint32_t)(std::min)(sl.op->size, (size_t)0x7ffff000);
+	sqe->user_data = make_user_data(s, ck_io);
+
+	sl.inflight = 2;
+	m_inflight += 2;
+	sl.op->issuer = this;
+	m_op_slots[sl.op] = s;
+}
+
+void linux_io_uring::cancel_slot(size_t s)
+{
+	slot & sl = m_slots[s];
+	sl.cancelling = true;
+
+	this->reserve_sqes(sl.op? 2: 1);
+
+	struct io_uring_sqe * sqe = this->get_sqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = make_user_data(s, sl.op? ck_link: ck_poll);
+	sqe->user_data = make_user_data(s, ck_cancel);
+
+	// The read or write may have been started already.
+	if (sl.op)
+	{
+		sqe = this->get_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = make_user_data(s, ck_io);
+		sqe->user_data = make_user_data(s, ck_cancel);
+	}
+}
+
+void linux_io_uring::reserve_sqes(unsigned count)
+{
+	if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) + count > m_sq_entries)
+		this->enter(0);
+}
+
+struct io_uring_sqe * linux_io_uring::get_sqe()
+{
+	this->reserve_sqes(1);
+
+	unsigned index = m_sq_local_tail & m_sq_mask;
+	struct io_uring_sqe * sqe = &m_sqes[index];
+	memset(sqe, 0, sizeof *sqe);
+	m_sq_array[index] = index;
+	++m_sq_local_tail;
+	++m_unsubmitted;
+	return sqe;
+}
+
+void linux_io_uring::enter(unsigned min_complete)
+{
+	__atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+	for (;;)
+	{
+		int r = sys_io_uring_enter(m_ring.get(), m_unsubmitted, min_complete, min_complete? IORING_ENTER_GETEVENTS: 0);
+		if (r >= 0)
+		{
+			m_unsubmitted -= r;
+			if (m_unsubmitted == 0 || min_complete == 0)
+				break;
+			continue;
+		}
+
+		if (errno == EINTR)
+			break;
+
+		// The completion queue is full; make room and try again.
+		if (errno != EBUSY && errno != EAGAIN)
+			throw std::runtime_error("io_uring_enter failed");
+
+		this->reap();
+		min_complete = 0;
+	}
+}
+
+void linux_io_uring::reap()
+{
+	unsigned head = *m_cq_head;
+	unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head)
+	{
+		struct io_uring_cqe const & cqe = m_cqes[head & m_cq_mask];
+		this->process(cqe.user_data, cqe.res);
+	}
+
+	__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+}
+
+void linux_io_uring::process(uint64_t user_data, int res)
+{
+	int kind = (int)(user_data & 3);
+	if (kind == ck_cancel)
+		return;
+
+	size_t s = (size_t)(user_data >> 2);
+	slot & sl = m_slots[s];
+
+	assert(sl.inflight > 0);
+	--sl.inflight;
+	--m_inflight;
+
+	short revents = 0;
+	switch (kind)
+	{
+	case ck_poll:
+		if (res != -ECANCELED)
+			revents = res < 0? POLLNVAL: (short)res;
+		break;
+
+	case ck_link:
+		// If the poll fails, the linked operation is cancelled
+		// and the error is reported instead.
+		if (res < 0 && res != -ECANCELED && !sl.op->done)
+		{
+			sl.op->done = true;
+			sl.op->result = res;
+			revents = sl.events | POLLERR;
+		}
+		break;
+
+	case ck_io:
+		if (res != -ECANCELED && res != -EAGAIN && res != -EINTR)
+		{
+			sl.op->done = true;
+			sl.op->result = res;
+			revents = sl.events;
+		}
+		break;
+	}
+
+	if (sl.op && sl.inflight == 0)
+	{
+		sl.op->issuer = 0;
+		m_op_slots.erase(sl.op);
+	}
+
+	if (revents && sl.registered && !sl.quiesced)
+	{
+		ready_item item = { sl.owner, sl.index, revents };
+		m_ready.push_back(item);
+		m_ready_slots.push_back(s);
+	}
+
+	if (sl.inflight == 0)
+		this->mark_dirty(s);
+}
+
+void linux_io_uring::wait(int timeout)
+{
+	assert(m_dirty_slots.empty());
+
+	// Items that fired outside of a wait (while cancelling an operation)
+	// are reported by this wait, unless they were removed since.
+	size_t j = 0;
+	for (size_t i = m_reported; i < m_ready.size(); ++i)
+	{
+		slot const & sl = m_slots[m_ready_slots[i]];
+		if (sl.registered && sl.owner == m_ready[i].owner && sl.index == m_ready[i].index)
+		{
+			m_ready[j] = m_ready[i];
+			m_ready_slots[j] = m_ready_slots[i];
+			++j;
+		}
+	}
+
+	m_ready.resize(j);
+	m_ready_slots.resize(j);
+
+	this->enter(timeout == 0 || !m_ready.empty()? 0: 1);
+	this->reap();
+
+	m_reported = m_ready.size();
+}
+
+void linux_io_uring::cancel_and_wait(linux_io_op & op)
+{
+	this->quiesce(op, true);
+}
+
+void linux_io_uring::complete_and_wait(linux_io_op & op)
+{
+	this->quiesce(op, false);
+}
+
+// The task that owns the operation is going away; the slot is neither
+// armed again nor reported, and the operation is waited for.
+void linux_io_uring::quiesce(linux_io_op & op, bool cancel)
+{
+	std::map<linux_io_op *, size_t>::iterator it = m_op_slots.find(&op);
+	if (it == m_op_slots.end())
+		return;
+
+	size_t s = it->second;
+	m_slots[s].quiesced = true;
+	if (cancel && !m_slots[s].cancelling)
+		this->cancel_slot(s);
+
+	while (op.issuer)
+	{
+		this->enter(1);
+		this->reap();
+	}
+}
+
+void linux_io_uring::cancel_all()
+{
+	for (size_t s = 0; s < m_slots.size(); ++s)
+	{
+		slot & sl = m_slots[s];
+		sl.quiesced = true;
+		if (sl.inflight != 0 && !sl.cancelling)
+			this->cancel_slot(s);
+	}
+
+	while (m_inflight != 0)
+	{
+		this->enter(1);
+		this->reap();
+	}
+
+	m_dirty_slots.clear();
+}
@@ -0,0 +1,130 @@
+#ifndef LIBYB_ASYNC_DETAIL_LINUX_IO_URING_HPP
+#define LIBYB_ASYNC_DETAIL_LINUX_IO_URING_HPP
+
+#include "linux_wait_context.hpp"
+#include "../../utils/noncopyable.hpp"
+#include "../../utils/detail/scoped_unix_fd.hpp"
+#include <vector>
+#include <map>
+#include <utility>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+namespace yb {
+namespace detail {
+
+// Waits for poll items through an io_uring instance.
+//
+// The interface mirrors `linux_epoll_set`: poll items are identified by
+// an owner and an index and stay registered until they're removed.
+// Items with an attached I/O operation are submitted as a poll linked
+// with the read or write, so that the kernel performs the operation
+// as soon as the fd becomes ready. Everything that changed since the last
+// wait is submitted by the same syscall that reaps the completions.
+//
+// The constructor throws if the kernel doesn't support io_uring
+// or any of the required opcodes.
+class linux_io_uring
+	: public linux_io_issuer, noncopyable
+{
+public:
+	struct ready_item
+	{
+		void * owner;
+		size_t index;
+		short revents;
+	};
+
+	linux_io_uring();
+	~linux_io_uring();
+
+	void add(int fd, short events, linux_io_op * op, void * owner, size_t index);
+	void remove(int fd, void * owner, size_t index);
+	void commit();
+
+	// Blocks until at least one of the registered items is ready,
+	// unless the timeout is zero. Afterwards, `ready_items` contains
+	// the items that fired since the previous wait.
+	void wait(int timeout);
+
+	std::vector<ready_item> const & ready_items() const { return m_ready; }
+
+	void cancel_and_wait(linux_io_op & op);
+	void complete_and_wait(linux_io_op & op);
+
+	// Cancels all operations in flight and waits for them to finish.
+	void cancel_all();
+
+private:
+	enum completion_kind_t { ck_poll, ck_link, ck_io, ck_cancel };
+
+	struct slot
+	{
+		void * owner;
+		size_t index;
+		int fd;
+		short events;
+		linux_io_op * op;
+
+		bool registered;
+		bool dirty;
+		bool cancelling;
+
+		// Set when the attached operation was cancelled by its task;
+		// the operation object may no longer exist.
+		bool quiesced;
+
+		// The number of completions yet to be reaped.
+		int inflight;
+	};
+
+	size_t alloc_slot();
+	void mark_dirty(size_t s);
+	void arm(size_t s);
+	void cancel_slot(size_t s);
+	void quiesce(linux_io_op & op, bool cancel);
+
+	void reserve_sqes(unsigned count);
+	struct io_uring_sqe * get_sqe();
+	void enter(unsigned min_complete);
+	void reap();
+	void process(uint64_t user_data, int res);
+
+	scoped_unix_fd m_ring;
+
+	void * m_sq_ring;
+	size_t m_sq_ring_size;
+	void * m_cq_ring;
+	size_t m_cq_ring_size;
+	struct io_uring_sqe * m_sqes;
+	size_t m_sqes_size;
+
+	unsigned * m_sq_head;
+	unsigned * m_sq_tail;
+	unsigned m_sq_mask;
+	unsigned m_sq_entries;
+	unsigned * m_sq_array;
+	unsigned m_sq_local_tail;
+	unsigned m_unsubmitted;
+
+	unsigned * m_cq_head;
+	unsigned * m_cq_tail;
+	unsigned m_cq_mask;
+	struct io_uring_cqe * m_cqes;
+
+	std::vector<slot> m_slots;
+	std::vector<size_t> m_free_slots;
+	std::vector<size_t> m_dirty_slots;
+	std::map<std::pair<void *, size_t>, size_t> m_items;
+	std::map<linux_io_op *, size_t> m_op_slots;
+	size_t m_inflight;
+
+	std::vector<ready_item> m_ready;
+	std::vector<size_t> m_ready_slots;
+	size_t m_reported;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_LINUX_IO_URING_HPP
@@ -0,0 +1,123 @@
+#include "linux_runner_metrics.hpp"
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+using namespace yb;
+using namespace yb::detail;
+
+namespace {
+
+template <typename T>
+void increase(T & counter, T value)
+{
+	__atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+} // namespace
+
+uint64_t yb::detail::linux_monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+linux_runner_metrics::linux_runner_metrics()
+	: m_seq(0), m_enabled(false), m_started_us(0), m_iterations(0), m_control_wakeups(0)
+{
+	memset(&m_prepare_ns, 0, sizeof m_prepare_ns);
+	memset(&m_wait_ns, 0, sizeof m_wait_ns);
+	memset(&m_finish_ns, 0, sizeof m_finish_ns);
+	memset(&m_poll_items, 0, sizeof m_poll_items);
+}
+
+void linux_runner_metrics::enable(bool enable)
+{
+	if (enable && __atomic_load_n(&m_started_us, __ATOMIC_RELAXED) == 0)
+		__atomic_store_n(&m_started_us, linux_monotonic_ns() / 1000, __ATOMIC_RELAXED);
+	__atomic_store_n(&m_enabled, enable, __ATOMIC_RELAXED);
+}
+
+void linux_runner_metrics::begin_update()
+{
+	__atomic_store_n(&m_seq, m_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void linux_runner_metrics::end_update()
+{
+	__atomic_store_n(&m_seq, m_seq + 1, __ATOMIC_RELEASE);
+}
+
+void linux_runner_metrics::record(histogram & h, uint64_t value)
+{
+	size_t bucket = value == 0? 0: 64 - __builtin_clzll(value);
+	if (bucket >= runner_histogram::bucket_count)
+		bucket = runner_histogram::bucket_count - 1;
+
+	increase(h.buckets[bucket], (uint64_t)1);
+	increase(h.count, (uint64_t)1);
+	increase(h.total, value);
+	if (value > h.max)
+		__atomic_store_n(&h.max, value, __ATOMIC_RELAXED);
+}
+
+void linux_runner_metrics::record_iteration(uint64_t prepare_ns, uint64_t wait_ns, uint64_t finish_ns, size_t poll_items)
+{
+	this->begin_update();
+	increase(m_iterations, (uint64_t)1);
+	record(m_prepare_ns, prepare_ns);
+	record(m_wait_ns, wait_ns);
+	record(m_finish_ns, finish_ns);
+	record(m_poll_items, poll_items);
+	this->end_update();
+}
+
+void linux_runner_metrics::record_control_wakeup()
+{
+	this->begin_update();
+	increase(m_control_wakeups, (uint64_t)1);
+	this->end_update();
+}
+
+void linux_runner_metrics::load(runner_histogram & out, histogram const & h)
+{
+	for (size_t i = 0; i < runner_histogram::bucket_count; ++i)
+		out.buckets[i] = __atomic_load_n(&h.buckets[i], __ATOMIC_RELAXED);
+	out.count = __atomic_load_n(&h.count, __ATOMIC_RELAXED);
+	out.total = __atomic_load_n(&h.total, __ATOMIC_RELAXED);
+	out.max = __atomic_load_n(&h.max, __ATOMIC_RELAXED);
+}
+
+runner_stats linux_runner_metrics::snapshot(size_t live_promises) const
+{
+	runner_stats res;
+	res.enabled = this->enabled();
+
+	uint64_t started_us = __atomic_load_n(&m_started_us, __ATOMIC_RELAXED);
+	res.elapsed_us = started_us? linux_monotonic_ns() / 1000 - started_us: 0;
+
+	res.live_promises = live_promises;
+
+	for (;;)
+	{
+		uint32_t seq = __atomic_load_n(&m_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+		{
+			sched_yield();
+			continue;
+		}
+
+		res.iterations = __atomic_load_n(&m_iterations, __ATOMIC_RELAXED);
+		res.control_wakeups = __atomic_load_n(&m_control_wakeups, __ATOMIC_RELAXED);
+
+		load(res.prepare_ns, m_prepare_ns);
+		load(res.wait_ns, m_wait_ns);
+		load(res.finish_ns, m_finish_ns);
+		load(res.poll_items, m_poll_items);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&m_seq, __ATOMIC_RELAXED) == seq)
+			return res;
+	}
+}
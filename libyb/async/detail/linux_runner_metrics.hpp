@@ -0,0 +1,68 @@
+#ifndef LIBYB_ASYNC_DETAIL_LINUX_RUNNER_METRICS_HPP
+#define LIBYB_ASYNC_DETAIL_LINUX_RUNNER_METRICS_HPP
+
+#include "../runner_stats.hpp"
+#include "../../utils/noncopyable.hpp"
+
+namespace yb {
+namespace detail {
+
+uint64_t linux_monotonic_ns();
+
+// Collects the statistics of a dispatch loop. Only the dispatch thread
+// records samples, so the counters are updated by plain atomic stores
+// under a sequence lock; other threads may take consistent snapshots
+// at any time, retrying while a sample is being recorded.
+class linux_runner_metrics
+	: noncopyable
+{
+public:
+	linux_runner_metrics();
+
+	// Disabled collectors cost the loop a single load per iteration.
+	void enable(bool enable);
+
+	bool enabled() const
+	{
+		return __atomic_load_n(&m_enabled, __ATOMIC_RELAXED);
+	}
+
+	void record_iteration(uint64_t prepare_ns, uint64_t wait_ns, uint64_t finish_ns, size_t poll_items);
+	void record_control_wakeup();
+
+	runner_stats snapshot(size_t live_promises) const;
+
+private:
+	struct histogram
+	{
+		uint64_t buckets[runner_histogram::bucket_count];
+		uint64_t count;
+		uint64_t total;
+		uint64_t max;
+	};
+
+	void begin_update();
+	void end_update();
+
+	static void record(histogram & h, uint64_t value);
+	static void load(runner_histogram & out, histogram const & h);
+
+	// Odd while the dispatch thread updates the counters.
+	uint32_t m_seq;
+
+	bool m_enabled;
+	uint64_t m_started_us;
+
+	uint64_t m_iterations;
+	uint64_t m_control_wakeups;
+
+	histogram m_prepare_ns;
+	histogram m_wait_ns;
+	histogram m_finish_ns;
+	histogram m_poll_items;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_LINUX_RUNNER_METRICS_HPP
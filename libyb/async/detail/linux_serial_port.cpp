@@ -1,5 +1,5 @@
 #include "../serial_port.hpp"
-#include "linux_fdpoll_task.hpp"
+#include "linux_fdio_task.hpp"
 #include "../../utils/detail/scoped_unix_fd.hpp"
 #include <stdexcept>
 #include <sys/types.h>
@@ -47,22 +47,14 @@ void serial_port::close()
 
 task<size_t> serial_port::read(uint8_t * buffer, size_t size)
 {
-	return make_linux_pollfd_task(m_pimpl->fd.get(), POLLIN, [](cancel_level cl) {
+	return make_linux_fdio_task(m_pimpl->fd.get(), false, buffer, size, [](cancel_level cl) {
 		return cl < cl_abort;
-	}).then([this, buffer, size](short revents) -> task<size_t> {
-		if (!(revents & POLLIN))
-			return async::raise<size_t>(std::runtime_error("poll failed"));
-		return async::value((size_t)::read(m_pimpl->fd.get(), buffer, size));
 	});
 }
 
 task<size_t> serial_port::write(uint8_t const * buffer, size_t size)
 {
-	return make_linux_pollfd_task(m_pimpl->fd.get(), POLLOUT, [](cancel_level cl) {
+	return make_linux_fdio_task(m_pimpl->fd.get(), true, const_cast<uint8_t *>(buffer), size, [](cancel_level cl) {
 		return cl < cl_abort;
-	}).then([this, buffer, size](short revents) -> task<size_t> {
-		if (!(revents & POLLIN))
-			return async::raise<size_t>(std::runtime_error("poll failed"));
-		return async::value((size_t)::write(m_pimpl->fd.get(), buffer, size));
 	});
 }
@@ -1,14 +1,70 @@
 #include "../sync_runner.hpp"
 #include "linux_wait_context.hpp"
+#include "linux_timer_wheel.hpp"
+#include "linux_runner_metrics.hpp"
 using namespace yb;
+using namespace yb::detail;
+
+struct sync_runner::impl
+{
+	// The implementation is created once a task waits for a deadline
+	// or the statistics are enabled; the wheel only in the former case.
+	std::unique_ptr<linux_timer_wheel> timers;
+	linux_runner_metrics metrics;
+};
+
+sync_runner::sync_runner()
+	: m_reaper(this), m_invalidated(false), m_prepared_epoch(0)
+{
+}
+
+sync_runner::~sync_runner()
+{
+}
+
+void sync_runner::enable_stats(bool enable)
+{
+	if (!m_pimpl)
+		m_pimpl.reset(new impl());
+	m_pimpl->metrics.enable(enable);
+}
+
+runner_stats sync_runner::stats() const
+{
+	if (!m_pimpl)
+		return linux_runner_metrics().snapshot(0);
+	return m_pimpl->metrics.snapshot(0);
+}
 
 void sync_runner::poll_one(task_wait_preparation_context & wait_ctx)
 {
 	task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
+	scoped_task_reaper reaper(&m_reaper);
+
+	bool measure = m_pimpl && m_pimpl->metrics.enabled();
+	uint64_t start_ns = measure? linux_monotonic_ns(): 0;
+
+	unsigned epoch = this_thread_preparation_epoch();
 
 	wait_ctx.clear();
+	wait_ctx.set_full_preparation(m_invalidated || epoch != m_prepared_epoch);
+	m_invalidated = false;
+	m_prepared_epoch = epoch;
 	m_parallel_tasks.prepare_wait(wait_ctx);
 
+	if (!wait_ctx_impl.m_timers.empty())
+	{
+		if (!m_pimpl)
+			m_pimpl.reset(new impl());
+		if (!m_pimpl->timers)
+			m_pimpl->timers.reset(new linux_timer_wheel());
+		m_pimpl->timers->arm_all(wait_ctx_impl, 0);
+	}
+
+	uint64_t prepared_ns = measure? linux_monotonic_ns(): 0;
+	uint64_t woken_ns = prepared_ns;
+	size_t poll_items = 0;
+
 	if (wait_ctx_impl.m_finished_tasks)
 	{
 		task_wait_finalization_context finish_ctx;
@@ -18,10 +74,39 @@ void sync_runner::poll_one(task_wait_preparation_context & wait_ctx)
 	}
 	else
 	{
-		int r = poll(wait_ctx_impl.m_pollfds.data(), wait_ctx_impl.m_pollfds.size(), -1);
-		assert(r > 0);
+		linux_timer_wheel * timers = m_pimpl? m_pimpl->timers.get(): 0;
+		if (timers)
+		{
+			timers->commit();
+
+			struct pollfd pfd = {};
+			pfd.fd = timers->fd();
+			pfd.events = POLLIN;
+			wait_ctx_impl.m_pollfds.push_back(pfd);
+		}
+
+		poll_items = wait_ctx_impl.m_pollfds.size();
+		if (measure)
+			prepared_ns = linux_monotonic_ns();
 
-		for (size_t i = 0; r != 0 && i < wait_ctx_impl.m_pollfds.size(); ++i)
+		int r = poll(wait_ctx_impl.m_pollfds.data(), wait_ctx_impl.m_pollfds.size(), timers && timers->has_fired()? 0: -1);
+		assert(r >= 0);
+
+		if (measure)
+			woken_ns = linux_monotonic_ns();
+
+		if (timers)
+		{
+			bool timer_ready = (wait_ctx_impl.m_pollfds.back().revents & POLLIN) != 0;
+			wait_ctx_impl.m_pollfds.pop_back();
+
+			if (timer_ready)
+				--r;
+			if (timer_ready || timers->has_fired())
+				r += timers->signal_expired(wait_ctx_impl);
+		}
+
+		for (size_t i = 0; r != 0 && m_parallel_tasks.has_task() && i < wait_ctx_impl.m_pollfds.size(); ++i)
 		{
 			if (wait_ctx_impl.m_pollfds[i].revents)
 			{
@@ -35,4 +120,7 @@ void sync_runner::poll_one(task_wait_preparation_context & wait_ctx)
 			}
 		}
 	}
+
+	if (measure)
+		m_pimpl->metrics.record_iteration(prepared_ns - start_ns, woken_ns - prepared_ns, linux_monotonic_ns() - woken_ns, poll_items);
 }
@@ -0,0 +1,37 @@
+#include "task_node_pool.hpp"
+#include <pthread.h>
+using namespace yb;
+using namespace yb::detail;
+
+static __thread task_node_cache * g_cache = 0;
+static pthread_key_t g_cache_key;
+static pthread_once_t g_cache_key_once = PTHREAD_ONCE_INIT;
+
+static void destroy_cache(void * p)
+{
+	g_cache = 0;
+	destroy_task_node_cache(static_cast<task_node_cache *>(p));
+}
+
+static void create_cache_key()
+{
+	pthread_key_create(&g_cache_key, &destroy_cache);
+}
+
+task_node_cache * yb::detail::this_thread_task_node_cache() throw()
+{
+	if (!g_cache)
+	{
+		pthread_once(&g_cache_key_once, &create_cache_key);
+
+		// Without a cache, nodes are allocated from the heap directly.
+		g_cache = create_task_node_cache();
+		if (g_cache && pthread_setspecific(g_cache_key, g_cache) != 0)
+		{
+			destroy_task_node_cache(g_cache);
+			g_cache = 0;
+		}
+	}
+
+	return g_cache;
+}
@@ -0,0 +1,93 @@
+#include "task_trace_buffer.hpp"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+using namespace yb;
+using namespace yb::detail;
+
+static __thread task_trace_buffer * g_buffer = 0;
+static task_trace_buffer * g_buffers = 0;
+static unsigned g_next_thread = 0;
+static pthread_key_t g_buffer_key;
+static pthread_once_t g_buffer_key_once = PTHREAD_ONCE_INIT;
+
+static void release_buffer(void * p)
+{
+	g_buffer = 0;
+	__atomic_store_n(&static_cast<task_trace_buffer *>(p)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void create_buffer_key()
+{
+	pthread_key_create(&g_buffer_key, &release_buffer);
+}
+
+static task_trace_buffer * claim_buffer()
+{
+	for (task_trace_buffer * buf = first_task_trace_buffer(); buf; buf = buf->next)
+	{
+		long expected = 0;
+		if (__atomic_compare_exchange_n(&buf->owned, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return buf;
+	}
+
+	// The buffer bypasses `operator new`, so that tracing
+	// doesn't show up in the allocation counts.
+	task_trace_buffer * buf = (task_trace_buffer *)calloc(1, sizeof(task_trace_buffer));
+	if (!buf)
+		return 0;
+
+	buf->owned = 1;
+	buf->next = __atomic_load_n(&g_buffers, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&g_buffers, &buf->next, buf, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+	}
+
+	return buf;
+}
+
+task_trace_buffer * yb::detail::this_thread_task_trace_buffer() throw()
+{
+	if (!g_buffer)
+	{
+		pthread_once(&g_buffer_key_once, &create_buffer_key);
+
+		task_trace_buffer * buf = claim_buffer();
+		if (!buf)
+			return 0;
+
+		// The events of the previous owner keep their thread number.
+		buf->thread = __atomic_add_fetch(&g_next_thread, 1, __ATOMIC_RELAXED);
+		if (pthread_setspecific(g_buffer_key, buf) != 0)
+		{
+			release_buffer(buf);
+			return 0;
+		}
+
+		g_buffer = buf;
+	}
+
+	return g_buffer;
+}
+
+task_trace_buffer * yb::detail::first_task_trace_buffer() throw()
+{
+	return __atomic_load_n(&g_buffers, __ATOMIC_ACQUIRE);
+}
+
+void yb::detail::publish_task_trace_head(task_trace_buffer & buf, uint64_t head) throw()
+{
+	__atomic_store_n(&buf.head, head, __ATOMIC_RELEASE);
+}
+
+uint64_t yb::detail::load_task_trace_head(task_trace_buffer const & buf) throw()
+{
+	return __atomic_load_n(&buf.head, __ATOMIC_ACQUIRE);
+}
+
+uint64_t yb::detail::task_trace_clock_ns() throw()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -1,48 +1,118 @@
 #include "../timer.hpp"
-#include "linux_fdpoll_task.hpp"
-#include "../../utils/detail/scoped_unix_fd.hpp"
-#include <stdexcept>
-#include <sys/timerfd.h>
-#include <fcntl.h>
+#include "../task_base.hpp"
+#include "../cancel_exception.hpp"
+#include "linux_timer_wheel.hpp"
+#include "task_node_pool.hpp"
+#include "../../utils/noncopyable.hpp"
 using namespace yb;
 using namespace yb::detail;
 
+namespace {
+
+// Waits for its entry to be fired by the wheel of the runner
+// that prepared it.
+class linux_timer_task
+	: public task_base<void>, public pooled_task_node, noncopyable
+{
+public:
+	linux_timer_task(uint64_t deadline, uint64_t slack)
+		: m_entry(deadline, slack), m_cancelled(false)
+	{
+	}
+
+	~linux_timer_task()
+	{
+		linux_timer_wheel::disarm(m_entry);
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		if (cl >= cl_abort && !m_entry.fired)
+		{
+			linux_timer_wheel::disarm(m_entry);
+			m_cancelled = true;
+		}
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		this->cancel(cl_kill);
+		if (m_cancelled)
+			return task_result<void>(std::copy_exception(task_cancelled()));
+		return task_result<void>();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		if (!m_cancelled && !m_entry.fired && m_entry.deadline <= linux_monotonic_us())
+		{
+			linux_timer_wheel::disarm(m_entry);
+			m_entry.fired = true;
+		}
+
+		if (m_cancelled || m_entry.fired)
+		{
+			ctx.set_finished();
+		}
+		else
+		{
+			task_wait_preparation_context_impl * impl = ctx.get();
+			impl->m_timers.push_back(std::make_pair(impl->m_pollfds.size(), &m_entry));
+
+			struct pollfd pf = {};
+			pf.fd = -1;
+			impl->m_pollfds.push_back(pf);
+		}
+	}
+
+	task<void> finish_wait(task_wait_finalization_context &) throw()
+	{
+		if (m_cancelled)
+			return async::raise<void>(task_cancelled());
+		if (m_entry.fired)
+			return async::value();
+		return nulltask;
+	}
+
+private:
+	linux_timer_entry m_entry;
+	bool m_cancelled;
+};
+
+} // namespace
+
+uint64_t yb::monotonic_time_us()
+{
+	return linux_monotonic_us();
+}
+
+// The timers are multiplexed on the runners' timer wheels
+// and need no per-timer state.
 struct timer::impl
 {
-	scoped_unix_fd fd;
 };
 
 timer::timer()
-	: m_pimpl(new impl())
 {
-	m_pimpl->fd.reset(timerfd_create(CLOCK_MONOTONIC, 0));
-	if (m_pimpl->fd.empty())
-		throw std::runtime_error("cannot create timerfd");
-	if (fcntl(m_pimpl->fd.get(), F_SETFL, O_NONBLOCK) == -1)
-		throw std::runtime_error("cannot set O_NONBLOCK");
 }
 
 timer::~timer()
 {
 }
 
-task<void> timer::wait_ms(int milliseconds)
+task<void> timer::wait_until_us(uint64_t deadline_us, uint64_t slack_us)
+{
+	return yb::wait_until_us(deadline_us, slack_us);
+}
+
+task<void> yb::wait_until_us(uint64_t deadline_us, uint64_t slack_us)
 {
-	assert(milliseconds > 0);
-
-	struct itimerspec ts = {};
-	ts.it_value.tv_sec = milliseconds / 1000;
-	ts.it_value.tv_nsec = (milliseconds % 1000) * 1000000;
-	if (timerfd_settime(m_pimpl->fd.get(), 0, &ts, 0) != 0)
-		return async::raise<void>(std::runtime_error("cannot set timerfd"));
-
-	return make_linux_pollfd_task(m_pimpl->fd.get(), POLLIN, [this](cancel_level cl) {
-		if (cl < cl_abort)
-			return true;
-		struct itimerspec ts = {};
-		timerfd_settime(m_pimpl->fd.get(), 0, &ts, 0);
-		return false;
-	}).then([](short revents) {
-		return revents & POLLIN? async::value(): async::raise<void>(std::runtime_error("timerfd poll error"));
-	});
+	try
+	{
+		return task<void>(new linux_timer_task(deadline_us, slack_us));
+	}
+	catch (...)
+	{
+		return async::raise<void>();
+	}
 }
@@ -0,0 +1,345 @@
+#include "linux_timer_wheel.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+using namespace yb;
+using namespace yb::detail;
+
+namespace {
+
+uint64_t const no_expiry = ~(uint64_t)0;
+
+void list_init(linux_timer_link & list)
+{
+	list.prev = list.next = &list;
+}
+
+void list_push(linux_timer_link & list, linux_timer_link & e)
+{
+	e.prev = list.prev;
+	e.next = &list;
+	list.prev->next = &e;
+	list.prev = &e;
+}
+
+void list_unlink(linux_timer_link & e)
+{
+	e.prev->next = e.next;
+	e.next->prev = e.prev;
+	e.prev = e.next = 0;
+}
+
+// Picks the time in [deadline, deadline + slack] with the most
+// trailing zero bits.
+uint64_t coalesce(uint64_t deadline, uint64_t slack)
+{
+	uint64_t last = deadline + slack;
+	if (last < deadline)
+		last = no_expiry - 1;
+
+	uint64_t diff = deadline ^ last;
+	if (diff == 0)
+		return deadline;
+
+	int high_bit = 63 - __builtin_clzll(diff);
+	return last & ~(((uint64_t)1 << high_bit) - 1);
+}
+
+// The mask of the slots at the level with the given shift
+// that start at `now` or later.
+uint64_t pending_slot_mask(uint64_t now, size_t shift)
+{
+	size_t first = (now >> shift) & (linux_timer_wheel::slot_count - 1);
+	if (now & (((uint64_t)1 << shift) - 1))
+		++first;
+	return first == linux_timer_wheel::slot_count? 0: ~(uint64_t)0 << first;
+}
+
+} // namespace
+
+uint64_t yb::detail::linux_monotonic_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+linux_timer_wheel::linux_timer_wheel()
+	: m_programmed(no_expiry)
+{
+	for (size_t level = 0; level < level_count; ++level)
+	{
+		for (size_t slot = 0; slot < slot_count; ++slot)
+			list_init(m_slots[level][slot]);
+		m_occupied[level] = 0;
+	}
+
+	list_init(m_overflow);
+	list_init(m_fired);
+
+	m_fd.reset(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+	if (m_fd.empty())
+		throw std::runtime_error("cannot create timerfd");
+
+	m_now = linux_monotonic_us();
+}
+
+linux_timer_wheel::~linux_timer_wheel()
+{
+	// The tasks owning the entries may outlive the wheel.
+	linux_timer_link * lists[] = { &m_overflow, &m_fired };
+	for (size_t i = 0; i < level_count * slot_count + 2; ++i)
+	{
+		linux_timer_link & list = i < level_count * slot_count? m_slots[i / slot_count][i % slot_count]: *lists[i - level_count * slot_count];
+		while (list.next != &list)
+		{
+			linux_timer_entry & e = static_cast<linux_timer_entry &>(*list.next);
+			list_unlink(e);
+			e.wheel = 0;
+			e.list = 0;
+		}
+	}
+}
+
+void linux_timer_wheel::arm(linux_timer_entry & e, void * owner, size_t index)
+{
+	if (e.wheel != this)
+	{
+		disarm(e);
+		e.expiry = coalesce(e.deadline, e.slack);
+		e.wheel = this;
+		this->insert(e);
+	}
+
+	e.owner = owner;
+	e.index = index;
+}
+
+void linux_timer_wheel::disarm(linux_timer_entry & e) throw()
+{
+	linux_timer_wheel * wheel = e.wheel;
+	if (!wheel)
+		return;
+
+	list_unlink(e);
+
+	if (e.list != &wheel->m_overflow && e.list != &wheel->m_fired && e.list->next == e.list)
+	{
+		size_t i = e.list - &wheel->m_slots[0][0];
+		wheel->m_occupied[i / slot_count] &= ~((uint64_t)1 << (i % slot_count));
+	}
+
+	e.wheel = 0;
+	e.list = 0;
+}
+
+void linux_timer_wheel::arm_all(task_wait_preparation_context_impl const & ctx, void * owner)
+{
+	for (size_t i = 0; i < ctx.m_timers.size(); ++i)
+		this->arm(*ctx.m_timers[i].second, owner, ctx.m_timers[i].first);
+}
+
+void linux_timer_wheel::insert(linux_timer_entry & e)
+{
+	uint64_t t = (std::max)(e.expiry, m_now);
+
+	// The entry goes to the lowest level at which it shares
+	// the rotation with the current time.
+	uint64_t diff = t ^ m_now;
+	size_t level = diff == 0? 0: (63 - __builtin_clzll(diff)) / slot_bits;
+
+	if (level >= level_count)
+	{
+		e.list = &m_overflow;
+	}
+	else
+	{
+		size_t slot = (t >> (level * slot_bits)) & (slot_count - 1);
+		e.list = &m_slots[level][slot];
+		m_occupied[level] |= (uint64_t)1 << slot;
+	}
+
+	list_push(*e.list, e);
+}
+
+void linux_timer_wheel::cascade(linux_timer_link & list)
+{
+	linux_timer_link * p = list.next;
+	list_init(list);
+
+	while (p != &list)
+	{
+		linux_timer_link * next = p->next;
+		this->insert(static_cast<linux_timer_entry &>(*p));
+		p = next;
+	}
+}
+
+// Returns the earliest time at which a slot has to be either
+// expired or cascaded.
+uint64_t linux_timer_wheel::next_event() const
+{
+	for (size_t level = 0; level < level_count; ++level)
+	{
+		size_t shift = level * slot_bits;
+		uint64_t mask = m_occupied[level] & pending_slot_mask(m_now, shift);
+		if (mask)
+		{
+			uint64_t rotation = (m_now >> (shift + slot_bits)) << (shift + slot_bits);
+			return rotation | ((uint64_t)__builtin_ctzll(mask) << shift);
+		}
+	}
+
+	if (m_overflow.next != &m_overflow)
+	{
+		uint64_t top_mask = ((uint64_t)1 << (level_count * slot_bits)) - 1;
+		return (m_now + top_mask) & ~top_mask;
+	}
+
+	return no_expiry;
+}
+
+// The slots of lower levels precede those of the higher levels,
+// so the earliest expiry is in the first occupied slot.
+uint64_t linux_timer_wheel::next_expiry() const
+{
+	linux_timer_link const * list = &m_overflow;
+	for (size_t level = 0; level < level_count; ++level)
+	{
+		size_t shift = level * slot_bits;
+		uint64_t mask = m_occupied[level] & pending_slot_mask(m_now, shift);
+		if (mask)
+		{
+			list = &m_slots[level][__builtin_ctzll(mask)];
+			break;
+		}
+	}
+
+	uint64_t res = no_expiry;
+	for (linux_timer_link const * p = list->next; p != list; p = p->next)
+		res = (std::min)(res, static_cast<linux_timer_entry const *>(p)->expiry);
+	return (std::max)(res, m_now);
+}
+
+void linux_timer_wheel::advance(uint64_t now)
+{
+	for (;;)
+	{
+		uint64_t t = this->next_event();
+		if (t > now)
+			break;
+
+		m_now = t;
+
+		uint64_t top_mask = ((uint64_t)1 << (level_count * slot_bits)) - 1;
+		if ((t & top_mask) == 0)
+			this->cascade(m_overflow);
+
+		for (size_t level = level_count - 1; level != 0; --level)
+		{
+			size_t shift = level * slot_bits;
+			if (t & (((uint64_t)1 << shift) - 1))
+				continue;
+
+			size_t slot = (t >> shift) & (slot_count - 1);
+			if (m_occupied[level] & ((uint64_t)1 << slot))
+			{
+				m_occupied[level] &= ~((uint64_t)1 << slot);
+				this->cascade(m_slots[level][slot]);
+			}
+		}
+
+		size_t slot = t & (slot_count - 1);
+		if (m_occupied[0] & ((uint64_t)1 << slot))
+		{
+			m_occupied[0] &= ~((uint64_t)1 << slot);
+
+			linux_timer_link & list = m_slots[0][slot];
+			while (list.next != &list)
+			{
+				linux_timer_entry & e = static_cast<linux_timer_entry &>(*list.next);
+				list_unlink(e);
+				list_push(m_fired, e);
+				e.list = &m_fired;
+				e.fired = true;
+			}
+		}
+
+		m_now = t + 1;
+	}
+
+	if (m_now <= now)
+		m_now = now + 1;
+}
+
+void linux_timer_wheel::commit()
+{
+	uint64_t t = this->next_expiry();
+	if (t == m_programmed)
+		return;
+
+	struct itimerspec ts = {};
+	if (t != no_expiry)
+	{
+		ts.it_value.tv_sec = t / 1000000;
+		ts.it_value.tv_nsec = (t % 1000000) * 1000;
+	}
+
+	int r = timerfd_settime(m_fd.get(), TFD_TIMER_ABSTIME, &ts, 0);
+	assert(r == 0);
+	(void)r;
+
+	m_programmed = t;
+}
+
+std::vector<linux_timer_entry *> const & linux_timer_wheel::expire()
+{
+	// A one-shot timerfd is disarmed once it fires.
+	uint64_t ticks;
+	if (read(m_fd.get(), &ticks, sizeof ticks) == sizeof ticks)
+		m_programmed = no_expiry;
+
+	this->advance(linux_monotonic_us());
+
+	m_expired.clear();
+	for (linux_timer_link * p = m_fired.next; p != &m_fired; p = p->next)
+		m_expired.push_back(static_cast<linux_timer_entry *>(p));
+	return m_expired;
+}
+
+bool linux_timer_wheel::is_prepared(linux_timer_entry & e, task_wait_preparation_context_impl const & ctx) throw()
+{
+	typedef std::pair<size_t, linux_timer_entry *> timer_item;
+	std::vector<timer_item>::const_iterator it = std::lower_bound(ctx.m_timers.begin(), ctx.m_timers.end(), timer_item(e.index, 0));
+	if (it != ctx.m_timers.end() && it->first == e.index && it->second == &e)
+		return true;
+
+	if (e.fired)
+		disarm(e);
+	return false;
+}
+
+size_t linux_timer_wheel::signal_expired(task_wait_preparation_context_impl & ctx)
+{
+	std::vector<linux_timer_entry *> const & expired = this->expire();
+
+	size_t res = 0;
+	for (size_t i = 0; i < expired.size(); ++i)
+	{
+		linux_timer_entry & e = *expired[i];
+		if (e.owner != 0 || !is_prepared(e, ctx))
+			continue;
+
+		struct pollfd & pfd = ctx.m_pollfds[e.index];
+		if (!pfd.revents)
+		{
+			pfd.revents = POLLIN;
+			++res;
+		}
+	}
+
+	return res;
+}
@@ -0,0 +1,139 @@
+#ifndef LIBYB_ASYNC_DETAIL_LINUX_TIMER_WHEEL_HPP
+#define LIBYB_ASYNC_DETAIL_LINUX_TIMER_WHEEL_HPP
+
+#include "linux_wait_context.hpp"
+#include "../../utils/noncopyable.hpp"
+#include "../../utils/detail/scoped_unix_fd.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace yb {
+namespace detail {
+
+class linux_timer_wheel;
+
+struct linux_timer_link
+{
+	linux_timer_link * prev;
+	linux_timer_link * next;
+};
+
+// A deadline a task waits for. The task adds the entry to its wait
+// context together with a dummy poll item (with a negative fd, which poll
+// ignores); the runner links the entry into its wheel and signals
+// the poll item once the deadline passes.
+struct linux_timer_entry
+	: linux_timer_link
+{
+	linux_timer_entry(uint64_t deadline = 0, uint64_t slack = 0)
+		: deadline(deadline), slack(slack), fired(false), wheel(0), list(0), expiry(0), owner(0), index(0)
+	{
+		prev = next = 0;
+	}
+
+	// The absolute time in microseconds of CLOCK_MONOTONIC and
+	// the amount of time the expiry may be delayed by.
+	uint64_t deadline;
+	uint64_t slack;
+
+	// Set once the deadline passed.
+	bool fired;
+
+	// The following are maintained by the wheel.
+	linux_timer_wheel * wheel;
+	linux_timer_link * list;
+	uint64_t expiry;
+	void * owner;
+	size_t index;
+};
+
+uint64_t linux_monotonic_us();
+
+// A hierarchical timing wheel multiplexing all timers of a runner
+// on a single timerfd.
+//
+// There are `level_count` levels of 64 slots. A slot of the level `k`
+// spans 64^k microseconds; an entry is placed at the lowest level
+// at which its expiry falls into the current rotation and is moved
+// to the lower levels as the time reaches its slot. Entries further
+// than the highest level can reach wait in an overflow list. Arming and
+// disarming an entry is O(1) and empty slots are skipped using
+// per-level occupancy bitmaps.
+//
+// The entries that expire are moved to a list of fired entries and
+// are reported after every wait until their tasks disarm them;
+// this makes the timers level-triggered like the other poll items.
+class linux_timer_wheel
+	: noncopyable
+{
+public:
+	static size_t const slot_bits = 6;
+	static size_t const slot_count = 1 << slot_bits;
+	static size_t const level_count = 6;
+
+	linux_timer_wheel();
+	~linux_timer_wheel();
+
+	int fd() const { return m_fd.get(); }
+
+	// The next microsecond the wheel will process.
+	uint64_t time() const { return m_now; }
+
+	// Links the entry into the wheel, or updates its owner and index
+	// if it already is. The expiry is rounded up within the entry's slack
+	// to the value with the most trailing zero bits, so that timers
+	// with overlapping slack expire together.
+	void arm(linux_timer_entry & e, void * owner, size_t index);
+
+	// Unlinks the entry from the wheel it's armed in, if any.
+	static void disarm(linux_timer_entry & e) throw();
+
+	// Arms the timers of a prepared wait context; the entries are
+	// attributed to `owner` at their poll item indexes.
+	void arm_all(task_wait_preparation_context_impl const & ctx, void * owner);
+
+	// Programs the timerfd to fire at the earliest expiry.
+	void commit();
+
+	bool has_fired() const { return m_fired.next != &m_fired; }
+
+	// Consumes the timerfd's expiration count and processes the wheel
+	// up to the current time. Returns all fired entries that were not
+	// disarmed yet.
+	std::vector<linux_timer_entry *> const & expire();
+
+	// Expires the wheel and signals the poll items of the fired entries
+	// that were armed by `arm_all(ctx, 0)`. Returns the number of poll
+	// items that got signalled.
+	size_t signal_expired(task_wait_preparation_context_impl & ctx);
+
+	// Processes the wheel up to and including the time `now`.
+	void advance(uint64_t now);
+
+	// Returns true if the entry is still part of `ctx` at the poll item
+	// it was armed with. Fired entries that aren't are disarmed, since no
+	// runner would ever finalize them.
+	static bool is_prepared(linux_timer_entry & e, task_wait_preparation_context_impl const & ctx) throw();
+
+private:
+	void insert(linux_timer_entry & e);
+	void cascade(linux_timer_link & list);
+	uint64_t next_event() const;
+	uint64_t next_expiry() const;
+
+	linux_timer_link m_slots[level_count][slot_count];
+	uint64_t m_occupied[level_count];
+	linux_timer_link m_overflow;
+	linux_timer_link m_fired;
+
+	uint64_t m_now;
+	uint64_t m_programmed;
+
+	scoped_unix_fd m_fd;
+	std::vector<linux_timer_entry *> m_expired;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_LINUX_TIMER_WHEEL_HPP
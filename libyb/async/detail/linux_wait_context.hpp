@@ -3,7 +3,10 @@
 
 #include "wait_context.hpp"
 #include <vector>
+#include <utility>
 #include <sys/poll.h>
+#include <sys/types.h>
+#include <stdint.h>
 
 namespace yb {
 
@@ -11,10 +14,62 @@ struct task_wait_poll_item
 {
 };
 
+struct linux_io_op;
+
+namespace detail {
+struct linux_timer_entry;
+}
+
+// A runner that performs I/O operations on behalf of tasks.
+class linux_io_issuer
+{
+public:
+	// Blocks until the kernel no longer uses the operation's buffer.
+	// The operation may still complete with data.
+	virtual void cancel_and_wait(linux_io_op & op) = 0;
+
+	// Blocks until the operation completes without cancelling it.
+	// If the kernel gives up on the operation (e.g. with EAGAIN),
+	// it's left to the task and no longer in flight.
+	virtual void complete_and_wait(linux_io_op & op) = 0;
+
+protected:
+	~linux_io_issuer() {}
+};
+
+// A read or a write that a task wants to perform once its poll item fires.
+//
+// Runners that can submit the operation to the kernel directly do so
+// instead of polling; they set `issuer` while the operation is in flight
+// and `done` and `result` (the byte count or a negated errno)
+// once it completes. Other runners only signal the poll item and leave
+// the operation to the task.
+struct linux_io_op
+{
+	int fd;
+	bool write;
+	uint8_t * buffer;
+	size_t size;
+
+	linux_io_issuer * issuer;
+	bool done;
+	ssize_t result;
+};
+
 struct task_wait_preparation_context_impl
 {
 	std::vector<struct pollfd> m_pollfds;
 	size_t m_finished_tasks;
+	size_t m_volatile_tasks;
+
+	// Pairs of a poll item index and the operation attached to it,
+	// ordered by the index.
+	std::vector<std::pair<size_t, linux_io_op *> > m_io_ops;
+
+	// Pairs of a poll item index and the deadline the item waits for,
+	// ordered by the index. The poll items of timers have a negative fd
+	// and are signalled by the runner's timer wheel.
+	std::vector<std::pair<size_t, detail::linux_timer_entry *> > m_timers;
 };
 
 } // namespace yb
@@ -4,6 +4,8 @@
 #include "../task_base.hpp"
 #include "../task.hpp"
 #include "wait_context.hpp"
+#include "task_node_pool.hpp"
+#include "../task_trace.hpp"
 
 namespace yb {
 namespace detail {
@@ -27,7 +29,7 @@ struct loop_state<void>
 
 template <typename S, typename F, typename T>
 class loop_task
-	: public task_base<void>, private loop_state<T>
+	: public task_base<void>, public pooled_task_node, private loop_state<T>
 {
 public:
 	loop_task(task<S> && t, F const & f, loop_state<T> && state);
@@ -150,6 +152,9 @@ task<void> loop_task<S, F, T>::finish_wait(task_wait_finalization_context & ctx)
 		m_task = invoke_loop_body(m_f, std::move(r), *this, m_cancel_level);
 		if (m_task.empty())
 			return async::value();
+
+		if (task_trace_enabled())
+			record_task_trace(ttk_continued, static_cast<task_base<void> const *>(this));
 	}
 
 	return nulltask;
@@ -4,70 +4,111 @@
 using namespace yb;
 using namespace yb::detail;
 
+parallel_composition_task::parallel_composition_task(task<void> && t)
+	: m_running(false)
+{
+	m_tasks.push_back(parallel_child<void>(std::move(t)));
+}
+
 parallel_composition_task::parallel_composition_task(task<void> && t, task<void> && u)
+	: m_running(false)
+{
+	m_tasks.reserve(2);
+	m_tasks.push_back(parallel_child<void>(std::move(t)));
+	m_tasks.push_back(parallel_child<void>(std::move(u)));
+}
+
+void parallel_composition_task::add(parallel_child<void> && child)
+{
+	if (m_running)
+		m_appended.push_back(std::move(child));
+	else
+		m_tasks.push_back(std::move(child));
+}
+
+void parallel_composition_task::append(task<void> && t)
+{
+	this->add(parallel_child<void>(std::move(t)));
+}
+
+void parallel_composition_task::adopt(parallel_composition_task & o)
+{
+	assert(!o.m_running);
+	o.add_appended();
+
+	for (size_t i = 0; i < o.m_tasks.size(); ++i)
+		this->add(std::move(o.m_tasks[i]));
+	o.m_tasks.clear();
+}
+
+void parallel_composition_task::add_appended()
 {
-	m_tasks.resize(2);
-	m_tasks.front().t = std::move(t);
-	m_tasks.back().t = std::move(u);
+	for (size_t i = 0; i < m_appended.size(); ++i)
+		m_tasks.push_back(std::move(m_appended[i]));
+	m_appended.clear();
 }
 
 void parallel_composition_task::cancel(cancel_level cl) throw()
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); ++it)
-		it->t.cancel(cl);
+	for (size_t i = 0; i < m_tasks.size(); ++i)
+		m_tasks[i].cancel(cl);
+	for (size_t i = 0; i < m_appended.size(); ++i)
+		m_appended[i].cancel(cl);
 }
 
 task_result<void> parallel_composition_task::cancel_and_wait() throw()
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); ++it)
-		it->t.cancel_and_wait(); // XXX: handle exc results
+	for (size_t i = 0; i < m_tasks.size(); ++i)
+		m_tasks[i].t.cancel_and_wait(); // XXX: handle exc results
+	for (size_t i = 0; i < m_appended.size(); ++i)
+		m_appended[i].t.cancel_and_wait();
 	m_tasks.clear();
+	m_appended.clear();
 	return task_result<void>();
 }
 
 void parallel_composition_task::prepare_wait(task_wait_preparation_context & ctx)
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); ++it)
+	this->add_appended();
+
+	m_running = true;
+	try
 	{
-		task_wait_memento_builder mb(ctx);
-		it->t.prepare_wait(ctx);
-		it->m = mb.finish();
+		for (size_t i = 0; i < m_tasks.size(); ++i)
+			m_tasks[i].prepare_wait(ctx);
 	}
+	catch (...)
+	{
+		m_running = false;
+		throw;
+	}
+
+	m_running = false;
 }
 
 task<void> parallel_composition_task::finish_wait(task_wait_finalization_context & ctx) throw()
 {
-	for (std::list<parallel_task>::iterator it = m_tasks.begin(); it != m_tasks.end(); )
+	m_running = true;
+	for (size_t i = 0; i < m_tasks.size(); )
 	{
-		if (ctx.contains(it->m))
+		if (m_tasks[i].finish_wait(ctx) && m_tasks[i].t.has_result())
 		{
-			it->t.finish_wait(ctx); // XXX: handle exc results
-			if (it->t.has_result())
-			{
-				it = m_tasks.erase(it);
-				continue;
-			}
+			// The order of the tasks doesn't matter; the last one
+			// keeps its memento, so it can still be finalized.
+			if (i + 1 != m_tasks.size())
+				m_tasks[i] = std::move(m_tasks.back());
+			m_tasks.pop_back();
+			continue;
 		}
 
-		++it;
+		++i;
 	}
+	m_running = false;
 
-	switch (m_tasks.size())
-	{
-	case 0:
+	// The composition stays in place while it has tasks left, so that
+	// runners can keep finalizing it during the same wait. The appended
+	// tasks join the others once the composition is prepared again.
+	if (m_tasks.empty() && m_appended.empty())
 		return async::value();
-	case 1:
-		return std::move(m_tasks.front().t);
-	default:
-		return nulltask;
-	}
-}
-
-parallel_composition_task::parallel_task::parallel_task()
-{
-}
-
-parallel_composition_task::parallel_task::parallel_task(parallel_task && o)
-	: t(std::move(o.t))
-{
+	return nulltask;
 }
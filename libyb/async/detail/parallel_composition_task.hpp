@@ -3,36 +3,162 @@
 
 #include "../task_base.hpp"
 #include "wait_context.hpp"
-#include <list>
+#include <vector>
+#include <memory>
 
 namespace yb {
 namespace detail {
 
+// A task run in parallel with others. The task keeps its preparation
+// between waits and is prepared again only after it was finalized
+// or cancelled (or if it's volatile), so that a wait costs time
+// proportional to the number of tasks that made progress.
+template <typename R>
+struct parallel_child
+{
+	task<R> t;
+	task_wait_memento m;
+
+	std::unique_ptr<task_wait_preparation_context> ctx;
+	bool prepared;
+
+	parallel_child();
+	explicit parallel_child(task<R> && t);
+	parallel_child(parallel_child && o);
+
+	parallel_child & operator=(parallel_child && o);
+
+	void cancel(cancel_level cl) throw();
+
+	// Prepares the task unless its previous preparation can be reused
+	// and appends the preparation to `ctx`.
+	void prepare_wait(task_wait_preparation_context & ctx);
+
+	// Finalizes the task if the wait concerned it. A task that was
+	// finalized already is no longer described by its memento; runners
+	// may finalize several poll items from the same wait.
+	bool finish_wait(task_wait_finalization_context & ctx) throw();
+};
+
+// Runs tasks in parallel; the tasks are kept in a single array.
 class parallel_composition_task
 	: public task_base<void>
 {
 public:
+	explicit parallel_composition_task(task<void> && t);
 	parallel_composition_task(task<void> && t, task<void> && u);
 
+	// Adds a task to the composition.
+	void append(task<void> && t);
+
+	// Moves the tasks of another composition into this one,
+	// so that chained compositions don't nest.
+	void adopt(parallel_composition_task & o);
+
 	void cancel(cancel_level cl) throw();
 	task_result<void> cancel_and_wait() throw();
 	void prepare_wait(task_wait_preparation_context & ctx);
 	task<void> finish_wait(task_wait_finalization_context & ctx) throw();
 
 private:
-	struct parallel_task
-	{
-		task<void> t;
-		task_wait_memento m;
+	void add(parallel_child<void> && child);
+	void add_appended();
 
-		parallel_task();
-		parallel_task(parallel_task && o);
-	};
+	std::vector<parallel_child<void> > m_tasks;
 
-	std::list<parallel_task> m_tasks;
+	// Tasks added while the composition is being prepared or finalized,
+	// e.g. posted to a sync_runner from a continuation; growing `m_tasks`
+	// then would move the task that is being run.
+	std::vector<parallel_child<void> > m_appended;
+	bool m_running;
 };
 
 } // namespace detail
 } // namespace yb
 
+namespace yb {
+namespace detail {
+
+template <typename R>
+parallel_child<R>::parallel_child()
+	: prepared(false)
+{
+}
+
+template <typename R>
+parallel_child<R>::parallel_child(task<R> && t)
+	: t(std::move(t)), prepared(false)
+{
+}
+
+template <typename R>
+parallel_child<R>::parallel_child(parallel_child && o)
+	: t(std::move(o.t)), m(o.m), ctx(std::move(o.ctx)), prepared(o.prepared)
+{
+}
+
+template <typename R>
+parallel_child<R> & parallel_child<R>::operator=(parallel_child && o)
+{
+	t = std::move(o.t);
+	m = o.m;
+	ctx = std::move(o.ctx);
+	prepared = o.prepared;
+	return *this;
+}
+
+template <typename R>
+void parallel_child<R>::cancel(cancel_level cl) throw()
+{
+	t.cancel(cl);
+	prepared = false;
+}
+
+template <typename R>
+void parallel_child<R>::prepare_wait(task_wait_preparation_context & ctx)
+{
+	if (!this->ctx)
+		this->ctx.reset(new task_wait_preparation_context());
+
+	if (!prepared || ctx.full_preparation() || this->ctx->checkpoint().volatile_task_count != 0)
+	{
+		this->ctx->clear();
+		this->ctx->set_full_preparation(ctx.full_preparation());
+		t.prepare_wait(*this->ctx);
+		prepared = true;
+	}
+
+	task_wait_memento_builder mb(ctx);
+	ctx.append(*this->ctx);
+	m = mb.finish();
+}
+
+template <typename R>
+bool parallel_child<R>::finish_wait(task_wait_finalization_context & ctx) throw()
+{
+	if (!prepared || !ctx.contains(m))
+		return false;
+
+	task_wait_finalization_context sub_ctx;
+	sub_ctx.prep_ctx = this->ctx.get();
+	if (ctx.finished_tasks)
+	{
+		sub_ctx.finished_tasks = m.finished_task_count;
+		sub_ctx.selected_poll_item = 0;
+	}
+	else
+	{
+		ctx.prep_ctx->copy_results_to(*this->ctx, m.poll_item_first);
+		sub_ctx.finished_tasks = 0;
+		sub_ctx.selected_poll_item = ctx.selected_poll_item - m.poll_item_first;
+	}
+
+	prepared = false;
+	t.finish_wait(sub_ctx);
+	return true;
+}
+
+} // namespace detail
+} // namespace yb
+
 #endif // LIBYB_ASYNC_DETAIL_PARALLEL_COMPOSITION_TASK_HPP
@@ -15,6 +15,12 @@ public:
 		m_buffer->addref();
 	}
 
+	promise_task_impl(promise_task_impl && o) throw()
+		: m_buffer(o.m_buffer)
+	{
+		o.m_buffer = 0;
+	}
+
 	~promise_task_impl()
 	{
 		if (m_buffer)
@@ -44,6 +50,8 @@ public:
 	{
 		if (!m_buffer || !m_buffer->empty())
 			ctx.set_finished();
+		else
+			ctx.set_volatile();
 	}
 
 	task<T> finish_wait(task_wait_finalization_context &) throw()
@@ -3,6 +3,8 @@
 
 #include "../task_base.hpp"
 #include "task_fwd.hpp"
+#include "task_node_pool.hpp"
+#include "../../utils/noncopyable.hpp"
 #include <memory> // unique_ptr
 #include <cassert>
 #include <exception> // exception_ptr
@@ -10,24 +12,111 @@
 namespace yb {
 namespace detail {
 
+// A stage of a sequential composition, i.e. a task and the continuation
+// that created it. The stages are linked in the order in which they run;
+// stages of different result types share this interface.
+class sequential_stage_base
+	: public pooled_task_node, noncopyable
+{
+public:
+	sequential_stage_base()
+		: m_next(0)
+	{
+	}
+
+	virtual ~sequential_stage_base() {}
+
+	virtual void cancel(cancel_level cl) throw() = 0;
+	virtual void cancel_and_wait() throw() = 0;
+	virtual void prepare_wait(task_wait_preparation_context & ctx) = 0;
+	virtual void finish_wait(task_wait_finalization_context & ctx) throw() = 0;
+	virtual bool has_result() const throw() = 0;
+
+	// Creates the stage's task from the result of the previous stage.
+	// The first stage of a composition is created with its task.
+	virtual void run(sequential_stage_base &) throw() {}
+
+	// Moves the stages out of the stage's task if the task
+	// is a composition itself.
+	virtual bool unwrap(sequential_stage_base *& first, sequential_stage_base *& last) throw() = 0;
+
+	sequential_stage_base * m_next;
+};
+
+template <typename R>
+class sequential_stage
+	: public sequential_stage_base
+{
+public:
+	sequential_stage();
+	explicit sequential_stage(task<R> && t);
+
+	void cancel(cancel_level cl) throw();
+	void cancel_and_wait() throw();
+	void prepare_wait(task_wait_preparation_context & ctx);
+	void finish_wait(task_wait_finalization_context & ctx) throw();
+	bool has_result() const throw();
+	bool unwrap(sequential_stage_base *& first, sequential_stage_base *& last) throw();
+
+	task<R> m_task;
+};
+
 template <typename R, typename S, typename F>
+class sequential_continuation
+	: public sequential_stage<R>
+{
+public:
+	explicit sequential_continuation(F && next);
+
+	void run(sequential_stage_base & prev) throw();
+
+private:
+	F m_next;
+};
+
+// Runs a task and a chain of continuations, each creating the next task
+// from the result of the previous one.
+//
+// A continuation added to a running composition extends it in place
+// and when a continuation returns a composition, its stages are spliced
+// into this one. The runner therefore reaches the running task through
+// a single composition, no matter how long the chain is, and finished
+// stages are dropped in a loop rather than by recursion. The composition
+// itself is small enough to be stored inline; only the stages are
+// allocated from the pool.
+template <typename R>
 class sequential_composition_task
 	: public task_base<R>
 {
 public:
-	sequential_composition_task(task<S> && task, F next);
+	typedef R result_type;
+
+	sequential_composition_task(sequential_stage_base * first, sequential_stage_base * last) throw();
+	sequential_composition_task(sequential_composition_task && o) throw();
+	~sequential_composition_task();
 
 	void cancel(cancel_level cl) throw();
 	task_result<R> cancel_and_wait() throw();
-
 	void prepare_wait(task_wait_preparation_context & ctx);
 	task<R> finish_wait(task_wait_finalization_context & ctx) throw();
 
+	// Returns the composition run by `t`, if there is one.
+	static sequential_composition_task * from(task<R> & t);
+
+	// Moves the stages out of the composition run by `t`;
+	// `t` is left empty.
+	static void release(task<R> & t, sequential_stage_base *& first, sequential_stage_base *& last) throw();
+
 private:
-	task<S> m_task;
-	F m_next;
+	void advance() throw();
+
+	sequential_stage_base * m_first;
+	sequential_stage_base * m_last;
 };
 
+template <typename R, typename S, typename F>
+task<R> make_sequential_composition(task<S> && t, F && next);
+
 } // namespace detail
 } // namespace yb
 
@@ -35,68 +124,204 @@ private:
 namespace yb {
 namespace detail {
 
-template <typename R, typename S, typename F>
-sequential_composition_task<R, S, F>::sequential_composition_task(task<S> && task, F next)
-	: m_next(std::move(next))
+template <typename R>
+sequential_stage<R>::sequential_stage()
 {
-	assert(!task.has_result() && !task.empty());
-	m_task = std::move(task);
 }
 
-template <typename R, typename S, typename F>
-void sequential_composition_task<R, S, F>::cancel(cancel_level cl) throw()
+template <typename R>
+sequential_stage<R>::sequential_stage(task<R> && t)
+	: m_task(std::move(t))
+{
+}
+
+template <typename R>
+void sequential_stage<R>::cancel(cancel_level cl) throw()
 {
 	m_task.cancel(cl);
 }
 
+template <typename R>
+void sequential_stage<R>::cancel_and_wait() throw()
+{
+	m_task = async::result(m_task.cancel_and_wait());
+}
+
+template <typename R>
+void sequential_stage<R>::prepare_wait(task_wait_preparation_context & ctx)
+{
+	assert(m_task.has_task());
+	m_task.prepare_wait(ctx);
+}
+
+template <typename R>
+void sequential_stage<R>::finish_wait(task_wait_finalization_context & ctx) throw()
+{
+	m_task.finish_wait(ctx);
+}
+
+template <typename R>
+bool sequential_stage<R>::has_result() const throw()
+{
+	return m_task.has_result();
+}
+
+template <typename R>
+bool sequential_stage<R>::unwrap(sequential_stage_base *& first, sequential_stage_base *& last) throw()
+{
+	if (!sequential_composition_task<R>::from(m_task))
+		return false;
+
+	sequential_composition_task<R>::release(m_task, first, last);
+	return true;
+}
+
+template <typename R, typename S, typename F>
+sequential_continuation<R, S, F>::sequential_continuation(F && next)
+	: m_next(std::move(next))
+{
+}
+
 template <typename R, typename S, typename F>
-task_result<R> sequential_composition_task<R, S, F>::cancel_and_wait() throw()
+void sequential_continuation<R, S, F>::run(sequential_stage_base & prev) throw()
 {
-	task_result<S> s = m_task.cancel_and_wait();
 	try
 	{
-		task<R> r = m_next(s);
-		if (r.has_task())
-			return r.cancel_and_wait();
-
-		assert(r.has_result());
-		return r.get_result();
+		this->m_task = m_next(static_cast<sequential_stage<S> &>(prev).m_task.get_result());
 	}
 	catch (...)
 	{
-		return task_result<R>(std::current_exception());
+		this->m_task = async::raise<R>();
 	}
 }
 
-template <typename R, typename S, typename F>
-void sequential_composition_task<R, S, F>::prepare_wait(task_wait_preparation_context & ctx)
+template <typename R>
+sequential_composition_task<R>::sequential_composition_task(sequential_stage_base * first, sequential_stage_base * last) throw()
+	: m_first(first), m_last(last)
 {
-	assert(m_task.has_task());
-	m_task.prepare_wait(ctx);
 }
 
-template <typename R, typename S, typename F>
-task<R> sequential_composition_task<R, S, F>::finish_wait(task_wait_finalization_context & ctx) throw()
+template <typename R>
+sequential_composition_task<R>::sequential_composition_task(sequential_composition_task && o) throw()
+	: m_first(o.m_first), m_last(o.m_last)
 {
-	m_task.finish_wait(ctx);
+	o.m_first = 0;
+	o.m_last = 0;
+}
 
-	if (m_task.has_result())
+template <typename R>
+sequential_composition_task<R>::~sequential_composition_task()
+{
+	while (m_first)
 	{
-		try
-		{
-			task_result<S> s = m_task.get_result();
-			return m_next(std::move(s));
-		}
-		catch (...)
-		{
-			return async::raise<R>();
-		}
+		sequential_stage_base * next = m_first->m_next;
+		delete m_first;
+		m_first = next;
 	}
+}
 
-	return nulltask;
+template <typename R>
+sequential_composition_task<R> * sequential_composition_task<R>::from(task<R> & t)
+{
+	return t.has_task()? dynamic_cast<sequential_composition_task<R> *>(t.get_task()): 0;
 }
 
+template <typename R>
+void sequential_composition_task<R>::release(task<R> & t, sequential_stage_base *& first, sequential_stage_base *& last) throw()
+{
+	sequential_composition_task<R> * comp = from(t);
+	assert(comp);
+
+	first = comp->m_first;
+	last = comp->m_last;
+	comp->m_first = 0;
+	comp->m_last = 0;
+
+	// There's nothing left to cancel.
+	t.destroy_task();
 }
+
+template <typename R>
+void sequential_composition_task<R>::advance() throw()
+{
+	assert(m_first->has_result() && m_first->m_next);
+
+	sequential_stage_base * next = m_first->m_next;
+	next->run(*m_first);
+	delete m_first;
+	m_first = next;
+
+	sequential_stage_base * first;
+	sequential_stage_base * last;
+	if (next->unwrap(first, last))
+	{
+		last->m_next = next->m_next;
+		if (m_last == next)
+			m_last = last;
+		m_first = first;
+		delete next;
+	}
+}
+
+template <typename R>
+void sequential_composition_task<R>::cancel(cancel_level cl) throw()
+{
+	m_first->cancel(cl);
+}
+
+template <typename R>
+task_result<R> sequential_composition_task<R>::cancel_and_wait() throw()
+{
+	m_first->cancel_and_wait();
+	while (m_first->m_next)
+	{
+		this->advance();
+		m_first->cancel_and_wait();
+	}
+
+	assert(m_first == m_last);
+	return static_cast<sequential_stage<R> *>(m_first)->m_task.get_result();
 }
 
+template <typename R>
+void sequential_composition_task<R>::prepare_wait(task_wait_preparation_context & ctx)
+{
+	m_first->prepare_wait(ctx);
+}
+
+template <typename R>
+task<R> sequential_composition_task<R>::finish_wait(task_wait_finalization_context & ctx) throw()
+{
+	m_first->finish_wait(ctx);
+	while (m_first->has_result() && m_first->m_next)
+		this->advance();
+
+	if (m_first->m_next)
+		return nulltask;
+
+	// Only the last stage is left, its task replaces the composition.
+	assert(m_first == m_last);
+	return std::move(static_cast<sequential_stage<R> *>(m_first)->m_task);
+}
+
+template <typename R, typename S, typename F>
+task<R> make_sequential_composition(task<S> && t, F && next)
+{
+	typedef sequential_continuation<R, S, typename std::remove_reference<F>::type> continuation_type;
+	std::unique_ptr<continuation_type> cont(new continuation_type(std::move(next)));
+
+	sequential_stage_base * first;
+	sequential_stage_base * last;
+	if (sequential_composition_task<S>::from(t))
+		sequential_composition_task<S>::release(t, first, last);
+	else
+		first = last = new sequential_stage<S>(std::move(t));
+
+	last->m_next = cont.get();
+	return task<R>::make(sequential_composition_task<R>(first, cont.release()));
+}
+
+} // namespace detail
+} // namespace yb
+
 #endif // LIBYB_ASYNC_DETAIL_SEQUENTION_COMPOSITION_TASK_HPP
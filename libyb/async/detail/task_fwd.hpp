@@ -6,7 +6,9 @@
 #include "../../utils/noncopyable.hpp"
 #include "../cancellation_token.hpp"
 #include <memory> // unique_ptr
+#include <vector>
 #include <exception> // exception_ptr, exception
+#include <stdint.h>
 
 #include <type_traits> // conditional
 
@@ -71,10 +73,22 @@ class task_wait_finalization_context;
 template <typename R>
 class task_base;
 
+namespace detail {
+template <typename R> class sequential_composition_task;
+}
+
 struct nulltask_t
 {
 };
 
+namespace detail {
+
+// Task objects up to this size are stored inside `task<R>` itself;
+// on 64-bit targets, such a task then occupies a single cache line.
+static size_t const task_inline_capacity = 7 * sizeof(void *);
+
+} // namespace detail
+
 static nulltask_t nulltask;
 
 template <typename R>
@@ -94,6 +108,13 @@ public:
 	task(std::exception_ptr exc);
 	~task();
 
+	// Takes ownership of a task object. Objects that fit the inline
+	// capacity are stored inside the task, the rest are moved to the heap.
+	// Moving the task relocates an inline object, so its move constructor
+	// must not throw and nothing outside may refer to it.
+	template <typename Impl>
+	static task make(Impl && impl);
+
 	task & operator=(task && o);
 
 	void clear() throw();
@@ -126,6 +147,15 @@ public:
 
 	task<R> abort_on(cancel_level cl, cancel_level abort_cl = cl_abort);
 
+	// Cancels the task with `cl` if it doesn't complete before the deadline
+	// (in microseconds of `monotonic_time_us`) and fails it with
+	// `task_timed_out` once it stops. The timer may fire up to `slack_us` late.
+	task<R> with_deadline_us(uint64_t deadline_us, cancel_level cl = cl_abort, uint64_t slack_us = 0);
+
+	// As above, relative to now, with a slack of 1/16 of the duration,
+	// so that the timeouts of concurrent requests can share wakeups.
+	task<R> timeout_us(uint64_t duration_us, cancel_level cl = cl_abort);
+
 	// task<void> only
 	task<void> finish_on(cancel_level cl, cancel_level abort_cl = cl_abort);
 
@@ -137,7 +167,24 @@ public:
 private:
 	typedef task_base<R> * task_base_ptr;
 
-	enum kind_t { k_empty, k_result, k_task };
+	enum kind_t { k_empty, k_result, k_task, k_inline_task };
+
+	template <typename Impl>
+	task(Impl && impl, std::true_type);
+
+	template <typename Impl>
+	task(Impl && impl, std::false_type);
+
+	task_base_ptr get_task() const;
+	void destroy_task() throw();
+	void move_from(task & o) throw();
+
+	// Extends parallel compositions in place instead of nesting them.
+	friend task<void> operator|(task<void> && lhs, task<void> && rhs);
+
+	// Sequential compositions are extended in place as well.
+	template <typename T>
+	friend class detail::sequential_composition_task;
 
 	task_base_ptr & as_task() { return reinterpret_cast<task_base_ptr &>(m_storage); }
 	task_base_ptr const & as_task() const { return reinterpret_cast<task_base_ptr const &>(m_storage); }
@@ -147,7 +194,10 @@ private:
 
 	kind_t m_kind;
 	typename std::aligned_storage<
-		detail::yb_max<sizeof(task_base_ptr), sizeof(task_result<R>)>::value,
+		detail::yb_max<
+			detail::yb_max<sizeof(task_base_ptr), sizeof(task_result<R>)>::value,
+			detail::task_inline_capacity
+			>::value,
 		detail::yb_lcm<
 			std::alignment_of<task_base_ptr>::value,
 			std::alignment_of<task_result<R>>::value
@@ -167,6 +217,23 @@ task<void> loop(F && f);
 template <typename S, typename F>
 task<void> loop(task<S> && t, F f);
 
+namespace detail {
+template <typename R> struct when_all_policy;
+template <typename R> struct when_any_policy;
+}
+
+// Runs the tasks in parallel and completes with their results, in order,
+// once all of them complete. The first failure cancels the other tasks
+// with `cl`; the composition fails with it once they stop.
+template <typename R>
+task<typename detail::when_all_policy<R>::result_type> when_all(std::vector<task<R> > && tasks, cancel_level cl = cl_abort);
+
+// Runs the tasks in parallel until one of them completes, then cancels
+// the others with `cl`. Once they stop, completes with the index
+// and the result of the first task (just the index for `task<void>`).
+template <typename R>
+task<typename detail::when_any_policy<R>::result_type> when_any(std::vector<task<R> > && tasks, cancel_level cl = cl_abort);
+
 namespace async {
 
 template <typename R>
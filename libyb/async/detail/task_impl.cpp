@@ -10,8 +10,29 @@ yb::task<void> yb::operator|(task<void> && lhs, task<void> && rhs)
 	if (!rhs.has_task())
 		return std::move(lhs);
 
+	// Compositions are always allocated on the heap.
+	detail::parallel_composition_task * lhs_comp = lhs.m_kind == task<void>::k_task?
+		dynamic_cast<detail::parallel_composition_task *>(lhs.as_task()): 0;
+	detail::parallel_composition_task * rhs_comp = rhs.m_kind == task<void>::k_task?
+		dynamic_cast<detail::parallel_composition_task *>(rhs.as_task()): 0;
+
 	try
 	{
+		if (lhs_comp)
+		{
+			if (rhs_comp)
+				lhs_comp->adopt(*rhs_comp);
+			else
+				lhs_comp->append(std::move(rhs));
+			return std::move(lhs);
+		}
+
+		if (rhs_comp)
+		{
+			rhs_comp->append(std::move(lhs));
+			return std::move(rhs);
+		}
+
 		return yb::task<void>(new detail::parallel_composition_task(std::move(lhs), std::move(rhs)));
 	}
 	catch (...)
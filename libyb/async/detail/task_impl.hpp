@@ -4,10 +4,34 @@
 #include "sequential_composition_task.hpp"
 #include "loop_task.hpp"
 #include "cancel_level_upgrade_task.hpp"
+#include "deadline_task.hpp"
 #include "cancellation_token_task.hpp"
+#include "when_task.hpp"
+#include "../task_trace.hpp"
 #include <type_traits>
+#include <typeinfo>
 
 namespace yb {
+namespace detail {
+
+template <typename Impl>
+class inline_task
+	: public Impl
+{
+public:
+	explicit inline_task(Impl && impl) throw()
+		: Impl(std::move(impl))
+	{
+	}
+
+private:
+	task_base<typename Impl::result_type> * relocate(void * storage) throw()
+	{
+		return new(storage) inline_task<Impl>(static_cast<Impl &&>(*this));
+	}
+};
+
+} // namespace detail
 
 template <typename R>
 task<R>::task()
@@ -23,21 +47,9 @@ task<R>::task(nulltask_t)
 
 template <typename R>
 task<R>::task(task<R> && o)
-	: m_kind(o.m_kind)
+	: m_kind(k_empty)
 {
-	switch (m_kind)
-	{
-	case k_result:
-		new(&m_storage) task_result<R>(std::move(o.as_result()));
-		break;
-	case k_task:
-		new(&m_storage) task_base_ptr(o.as_task());
-		o.as_task().~task_base_ptr();
-		o.m_kind = k_empty;
-		break;
-	case k_empty:
-		break;
-	}
+	this->move_from(o);
 }
 
 template <typename R>
@@ -45,13 +57,17 @@ task<R>::task(task_base<result_type> * impl)
 	: m_kind(k_task)
 {
 	new(&m_storage) task_base_ptr(impl);
+	if (detail::task_trace_enabled())
+		detail::record_task_trace(ttk_created, impl, 0, typeid(*impl).name());
 }
 
 template <typename R>
 task<R>::task(std::unique_ptr<task_base<result_type> > impl)
 	: m_kind(k_task)
 {
-	new(&m_storage) task_base_ptr(impl.release());
+	task_base_ptr p = *new(&m_storage) task_base_ptr(impl.release());
+	if (detail::task_trace_enabled())
+		detail::record_task_trace(ttk_created, p, 0, typeid(*p).name());
 }
 
 template <typename R>
@@ -75,6 +91,44 @@ task<R>::task(std::exception_ptr exc)
 	new(&m_storage) task_result<R>(std::move(exc));
 }
 
+template <typename R>
+template <typename Impl>
+task<R>::task(Impl && impl, std::true_type)
+	: m_kind(k_inline_task)
+{
+	typedef typename std::remove_reference<Impl>::type impl_type;
+	task_base_ptr p = new(&m_storage) detail::inline_task<impl_type>(std::move(impl));
+
+	// `get_task` relies on the object starting at the storage.
+	assert((void *)p == (void *)&m_storage);
+
+	if (detail::task_trace_enabled())
+		detail::record_task_trace(ttk_created, p, 0, typeid(impl_type).name());
+}
+
+template <typename R>
+template <typename Impl>
+task<R>::task(Impl && impl, std::false_type)
+	: m_kind(k_task)
+{
+	typedef typename std::remove_reference<Impl>::type impl_type;
+	task_base_ptr p = *new(&m_storage) task_base_ptr(new impl_type(std::move(impl)));
+	if (detail::task_trace_enabled())
+		detail::record_task_trace(ttk_created, p, 0, typeid(impl_type).name());
+}
+
+template <typename R>
+template <typename Impl>
+task<R> task<R>::make(Impl && impl)
+{
+	typedef detail::inline_task<typename std::remove_reference<Impl>::type> inline_type;
+	typedef std::integral_constant<bool,
+		sizeof(inline_type) <= sizeof(m_storage)
+		&& std::alignment_of<inline_type>::value <= std::alignment_of<decltype(m_storage)>::value
+		> fits_inline;
+	return task<R>(std::move(impl), fits_inline());
+}
+
 template <typename R>
 task<R>::~task()
 {
@@ -82,17 +136,71 @@ task<R>::~task()
 }
 
 template <typename R>
-void task<R>::clear() throw()
+typename task<R>::task_base_ptr task<R>::get_task() const
 {
-	switch (m_kind)
+	assert(this->has_task());
+	if (m_kind == k_task)
+		return this->as_task();
+	return reinterpret_cast<task_base_ptr>(const_cast<void *>(static_cast<void const *>(&m_storage)));
+}
+
+template <typename R>
+void task<R>::destroy_task() throw()
+{
+	task_base_ptr p = this->get_task();
+	if (m_kind == k_task)
 	{
+		delete p;
+		this->as_task().~task_base_ptr();
+	}
+	else
+	{
+		p->~task_base<R>();
+	}
+
+	m_kind = k_empty;
+}
+
+template <typename R>
+void task<R>::move_from(task<R> & o) throw()
+{
+	assert(m_kind == k_empty);
+
+	switch (o.m_kind)
+	{
+	case k_result:
+		new(&m_storage) task_result<R>(std::move(o.as_result()));
+		break;
 	case k_task:
+		new(&m_storage) task_base_ptr(o.as_task());
+		o.as_task().~task_base_ptr();
+		o.m_kind = k_empty;
+		m_kind = k_task;
+		return;
+	case k_inline_task:
 		{
-			task_base_ptr p = this->as_task();
-			p->cancel_and_wait();
-			delete p;
+			task_base_ptr p = o.get_task()->relocate(&m_storage);
+			if (detail::task_trace_enabled())
+				detail::record_task_trace(ttk_relocated, o.get_task(), p);
 		}
-		this->as_task().~task_base_ptr();
+		o.destroy_task();
+		m_kind = k_inline_task;
+		return;
+	case k_empty:
+		break;
+	}
+
+	m_kind = o.m_kind;
+}
+
+template <typename R>
+void task<R>::clear() throw()
+{
+	switch (m_kind)
+	{
+	case k_task:
+	case k_inline_task:
+		this->cancel_and_wait();
 		break;
 	case k_result:
 		this->as_result().~task_result();
@@ -107,9 +215,9 @@ void task<R>::clear() throw()
 template <typename R>
 void task<R>::normalize() throw()
 {
-	while (m_kind == k_task)
+	while (this->has_task())
 	{
-		task<R> n = this->as_task()->run();
+		task<R> n = this->get_task()->run();
 		if (n.empty())
 			break;
 		*this = n;
@@ -126,32 +234,14 @@ template <typename R>
 task<R> & task<R>::operator=(task<R> && o)
 {
 	this->clear();
-	kind_t new_kind = o.m_kind;
-
-	switch (o.m_kind)
-	{
-	case k_task:
-		new(&m_storage) task_base_ptr(o.as_task());
-		o.as_task().~task_base_ptr();
-		o.m_kind = k_empty;
-		break;
-
-	case k_result:
-		new(&m_storage) task_result<R>(std::move(o.as_result()));
-		break;
-
-	case k_empty:
-		break;
-	}
-
-	m_kind = new_kind;
+	this->move_from(o);
 	return *this;
 }
 
 template <typename R>
 bool task<R>::has_task() const
 {
-	return m_kind == k_task;
+	return m_kind == k_task || m_kind == k_inline_task;
 }
 
 template <typename R>
@@ -170,38 +260,44 @@ task_result<R> task<R>::get_result()
 template <typename R>
 void task<R>::prepare_wait(task_wait_preparation_context & ctx)
 {
-	if (m_kind == k_task)
+	if (this->has_task())
 	{
-		task_base_ptr p = this->as_task();
-		p->prepare_wait(ctx);
+		if (detail::task_trace_enabled())
+			detail::record_task_trace(ttk_prepared, this->get_task());
+		this->get_task()->prepare_wait(ctx);
 	}
 }
 
 template <typename R>
 void task<R>::finish_wait(task_wait_finalization_context & ctx)
 {
-	assert(m_kind == k_task);
-	task_base_ptr p = this->as_task();
-	task<R> n = p->finish_wait(ctx);
+	task<R> n = this->get_task()->finish_wait(ctx);
 
-	if (!n.empty())
+	if (detail::task_trace_enabled())
 	{
-		assert(m_kind == k_task);
-		delete p;
-		this->as_task().~task_base_ptr();
-		m_kind = k_empty;
+		detail::record_task_trace(ttk_finalized, this->get_task());
+		if (n.has_task())
+			detail::record_task_trace(ttk_continued, this->get_task(), n.get_task());
+		else if (n.has_result())
+			detail::record_task_trace(ttk_completed, this->get_task(), 0, 0, cl_none, n.as_result().has_exception());
+	}
 
-		*this = std::move(n);
+	if (!n.empty())
+	{
+		assert(this->has_task());
+		this->destroy_task();
+		this->move_from(n);
 	}
 }
 
 template <typename R>
 void task<R>::cancel(cancel_level cl)
 {
-	if (m_kind == k_task)
+	if (this->has_task())
 	{
-		task_base_ptr p = this->as_task();
-		p->cancel(cl);
+		if (detail::task_trace_enabled())
+			detail::record_task_trace(ttk_cancelled, this->get_task(), 0, 0, cl);
+		this->get_task()->cancel(cl);
 	}
 }
 
@@ -210,14 +306,17 @@ task_result<R> task<R>::cancel_and_wait()
 {
 	assert(!this->empty());
 
-	if (m_kind == k_task)
+	if (this->has_task())
 	{
-		task_base_ptr p = this->as_task();
-		task_result<R> r = p->cancel_and_wait();
-		delete p;
+		bool traced = detail::task_trace_enabled();
+		if (traced)
+			detail::record_task_trace(ttk_cancelled, this->get_task(), 0, 0, cl_kill);
 
-		this->as_task().~task_base_ptr();
-		m_kind = k_empty;
+		task_result<R> r = this->get_task()->cancel_and_wait();
+		if (traced)
+			detail::record_task_trace(ttk_completed, this->get_task(), 0, 0, cl_kill, r.has_exception());
+
+		this->destroy_task();
 		return std::move(r);
 	}
 
@@ -237,7 +336,7 @@ auto task<R>::continue_with(F f) -> decltype(f(*(task_result<R>*)0))
 		if (this->has_result())
 			return f(std::move(this->as_result()));
 		else
-			return task<S>(new detail::sequential_composition_task<S, R, F>(std::move(*this), std::move(f)));
+			return detail::make_sequential_composition<S>(std::move(*this), std::move(f));
 	}
 	catch (...)
 	{
@@ -356,7 +455,7 @@ task<void> task<void>::follow_with(F f)
 template <typename R>
 task<R> task<R>::abort_on(cancel_level cl, cancel_level abort_cl)
 {
-	if (m_kind == k_task)
+	if (this->has_task())
 	{
 		try
 		{
@@ -374,7 +473,7 @@ task<R> task<R>::abort_on(cancel_level cl, cancel_level abort_cl)
 template <>
 inline task<void> task<void>::finish_on(cancel_level cl, cancel_level abort_cl)
 {
-	if (m_kind == k_task)
+	if (this->has_task())
 	{
 		try
 		{
@@ -389,6 +488,34 @@ inline task<void> task<void>::finish_on(cancel_level cl, cancel_level abort_cl)
 	return std::move(*this);
 }
 
+template <typename R>
+task<R> task<R>::with_deadline_us(uint64_t deadline_us, cancel_level cl, uint64_t slack_us)
+{
+	if (!this->has_task())
+		return std::move(*this);
+
+	try
+	{
+		// The timer only has a result if it couldn't be created.
+		task<void> timer = wait_until_us(deadline_us, slack_us);
+		if (timer.has_result())
+			timer.get_result().rethrow();
+		return task<R>(new detail::deadline_task<R>(std::move(*this), std::move(timer), cl));
+	}
+	catch (...)
+	{
+		std::exception_ptr exc = std::current_exception();
+		this->cancel_and_wait();
+		return async::raise<R>(exc);
+	}
+}
+
+template <typename R>
+task<R> task<R>::timeout_us(uint64_t duration_us, cancel_level cl)
+{
+	return this->with_deadline_us(monotonic_time_us() + duration_us, cl, duration_us / 16);
+}
+
 template <typename R>
 task<void> task<R>::ignore_result()
 {
@@ -404,7 +531,7 @@ inline task<void> task<void>::ignore_result()
 template <typename R>
 task<R> task<R>::cancellable(cancellation_token & ct)
 {
-	if (m_kind != k_task)
+	if (!this->has_task())
 		return std::move(*this);
 
 	detail::cancellation_token_core<R> * core = new detail::cancellation_token_core<R>();
@@ -419,7 +546,7 @@ task<R> task<R>::cancellable(cancellation_token & ct)
 template <>
 inline task<void> task<void>::finishable(cancellation_token & ct)
 {
-	if (m_kind != k_task)
+	if (!this->has_task())
 		return std::move(*this);
 
 	detail::cancellation_token_core<void> * core = new detail::cancellation_token_core<void>();
@@ -0,0 +1,125 @@
+#include "task_node_pool.hpp"
+#include <new>
+#include <stdlib.h>
+using namespace yb;
+using namespace yb::detail;
+
+namespace {
+
+size_t const granularity = 16;
+size_t const class_count = 32;
+size_t const max_cached_blocks = 64;
+
+struct free_block
+{
+	free_block * next;
+};
+
+size_t size_class(size_t size)
+{
+	return size == 0? 0: (size - 1) / granularity;
+}
+
+} // namespace
+
+struct yb::detail::task_node_cache
+{
+	free_block * free_lists[class_count];
+	size_t free_counts[class_count];
+	task_node_pool_stats stats;
+};
+
+static void release_blocks(task_node_cache * cache) throw()
+{
+	for (size_t i = 0; i < class_count; ++i)
+	{
+		while (free_block * b = cache->free_lists[i])
+		{
+			cache->free_lists[i] = b->next;
+			::operator delete(b);
+		}
+
+		cache->free_counts[i] = 0;
+	}
+
+	cache->stats.cached_blocks = 0;
+}
+
+task_node_cache * yb::detail::create_task_node_cache() throw()
+{
+	// The cache itself bypasses `operator new`, so that it's not
+	// accounted for as one of the blocks.
+	return (task_node_cache *)calloc(1, sizeof(task_node_cache));
+}
+
+void yb::detail::destroy_task_node_cache(task_node_cache * cache) throw()
+{
+	release_blocks(cache);
+	free(cache);
+}
+
+void * yb::detail::task_node_alloc(size_t size)
+{
+	task_node_cache * cache = this_thread_task_node_cache();
+	size_t cls = size_class(size);
+
+	if (cache)
+		++cache->stats.allocations;
+
+	if (cls >= class_count)
+	{
+		if (cache)
+			++cache->stats.heap_allocations;
+		return ::operator new(size);
+	}
+
+	if (cache && cache->free_lists[cls])
+	{
+		free_block * b = cache->free_lists[cls];
+		cache->free_lists[cls] = b->next;
+		--cache->free_counts[cls];
+		--cache->stats.cached_blocks;
+		++cache->stats.cache_hits;
+		return b;
+	}
+
+	void * res = ::operator new((cls + 1) * granularity);
+	if (cache)
+		++cache->stats.heap_allocations;
+	return res;
+}
+
+void yb::detail::task_node_free(void * p, size_t size) throw()
+{
+	if (!p)
+		return;
+
+	task_node_cache * cache = this_thread_task_node_cache();
+	size_t cls = size_class(size);
+
+	if (!cache || cls >= class_count || cache->free_counts[cls] == max_cached_blocks)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	free_block * b = static_cast<free_block *>(p);
+	b->next = cache->free_lists[cls];
+	cache->free_lists[cls] = b;
+	++cache->free_counts[cls];
+	++cache->stats.cached_blocks;
+}
+
+task_node_pool_stats yb::get_task_node_pool_stats()
+{
+	task_node_pool_stats res = {};
+	if (task_node_cache * cache = this_thread_task_node_cache())
+		res = cache->stats;
+	return res;
+}
+
+void yb::trim_task_node_pool() throw()
+{
+	if (task_node_cache * cache = this_thread_task_node_cache())
+		release_blocks(cache);
+}
@@ -0,0 +1,65 @@
+#ifndef LIBYB_ASYNC_DETAIL_TASK_NODE_POOL_HPP
+#define LIBYB_ASYNC_DETAIL_TASK_NODE_POOL_HPP
+
+#include <stddef.h>
+
+namespace yb {
+
+// Counters of the calling thread's task node cache.
+struct task_node_pool_stats
+{
+	// The number of nodes allocated through the pool.
+	size_t allocations;
+
+	// The number of those that were served from the cache.
+	size_t cache_hits;
+
+	// The number of blocks allocated from the heap, including
+	// the nodes too large to be pooled.
+	size_t heap_allocations;
+
+	// The number of freed blocks the cache currently holds.
+	size_t cached_blocks;
+};
+
+task_node_pool_stats get_task_node_pool_stats();
+
+// Returns all blocks cached by the calling thread to the heap.
+void trim_task_node_pool() throw();
+
+namespace detail {
+
+// Task nodes are allocated from per-thread caches of free blocks,
+// segregated into size classes. A block is returned to the cache
+// of the thread that frees it; since a runner finalizes its tasks
+// on its own thread, nodes created in continuations recycle
+// the blocks of their predecessors without any locking.
+void * task_node_alloc(size_t size);
+void task_node_free(void * p, size_t size) throw();
+
+class pooled_task_node
+{
+public:
+	static void * operator new(size_t size)
+	{
+		return task_node_alloc(size);
+	}
+
+	static void operator delete(void * p, size_t size) throw()
+	{
+		task_node_free(p, size);
+	}
+};
+
+// Implemented per platform; the cache of each thread is destroyed
+// when the thread exits.
+struct task_node_cache;
+task_node_cache * this_thread_task_node_cache() throw();
+
+task_node_cache * create_task_node_cache() throw();
+void destroy_task_node_cache(task_node_cache * cache) throw();
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_TASK_NODE_POOL_HPP
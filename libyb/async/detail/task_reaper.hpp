@@ -0,0 +1,117 @@
+#ifndef LIBYB_ASYNC_DETAIL_TASK_REAPER_HPP
+#define LIBYB_ASYNC_DETAIL_TASK_REAPER_HPP
+
+#include "../task_base.hpp"
+#include "../../utils/noncopyable.hpp"
+#include <utility>
+
+namespace yb {
+namespace detail {
+
+// A runner installs a reaper on its thread while it finalizes tasks.
+// Leaf tasks that would have to block in `cancel_and_wait` hand
+// themselves over to the reaper instead; the runner then finishes
+// them along with its other tasks.
+class task_reaper
+{
+public:
+	// Takes over the task; if it can't, it has to wait for the task
+	// before returning.
+	virtual void reap(task<void> && t) throw() = 0;
+
+protected:
+	~task_reaper() {}
+};
+
+task_reaper * this_thread_task_reaper() throw();
+task_reaper * exchange_this_thread_task_reaper(task_reaper * reaper) throw();
+
+class scoped_task_reaper
+	: noncopyable
+{
+public:
+	explicit scoped_task_reaper(task_reaper * reaper) throw()
+		: m_prev(exchange_this_thread_task_reaper(reaper))
+	{
+	}
+
+	~scoped_task_reaper()
+	{
+		exchange_this_thread_task_reaper(m_prev);
+	}
+
+private:
+	task_reaper * m_prev;
+};
+
+// Runs a leaf task, whose result nobody is interested in anymore.
+// The leaf must complete in `finish_wait`, it may not continue
+// with another task.
+template <typename Impl>
+class reaped_task
+	: public task_base<void>, noncopyable
+{
+public:
+	explicit reaped_task(Impl && impl)
+		: m_impl(std::move(impl))
+	{
+	}
+
+	void cancel(cancel_level cl) throw()
+	{
+		m_impl.cancel(cl);
+	}
+
+	task_result<void> cancel_and_wait() throw()
+	{
+		m_impl.cancel_and_wait();
+		return task_result<void>();
+	}
+
+	void prepare_wait(task_wait_preparation_context & ctx)
+	{
+		m_impl.prepare_wait(ctx);
+	}
+
+	task<void> finish_wait(task_wait_finalization_context & ctx) throw()
+	{
+		if (m_impl.finish_wait(ctx).empty())
+			return nulltask;
+		return async::value();
+	}
+
+private:
+	Impl m_impl;
+};
+
+// Moves the leaf to the thread's reaper. Returns false and leaves
+// the leaf intact if there's no reaper or the leaf can't be moved.
+//
+// The reaper finishes the leaf after its owner has dropped it, so
+// the leaf must own whatever it waits on (or keep it alive); a leaf
+// waiting on a borrowed fd or handle has to wait itself.
+template <typename Impl>
+bool reap_task(Impl & impl) throw()
+{
+	task_reaper * reaper = this_thread_task_reaper();
+	if (!reaper)
+		return false;
+
+	task_base<void> * p;
+	try
+	{
+		p = new reaped_task<Impl>(std::move(impl));
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	reaper->reap(task<void>(p));
+	return true;
+}
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_TASK_REAPER_HPP
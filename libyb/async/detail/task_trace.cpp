@@ -0,0 +1,258 @@
+#include "task_trace_buffer.hpp"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <ostream>
+using namespace yb;
+using namespace yb::detail;
+
+bool yb::detail::g_task_trace_enabled = false;
+
+static uint64_t volatile g_epoch_ns = 0;
+
+void yb::detail::record_task_trace(task_trace_kind kind, void const * task, void const * other,
+	char const * type, cancel_level cl, bool failed) throw()
+{
+	task_trace_buffer * buf = this_thread_task_trace_buffer();
+	if (!buf)
+		return;
+
+	// Only this thread ever changes the head.
+	uint64_t head = buf->head;
+
+	task_trace_event & e = buf->events[head % task_trace_capacity];
+	e.time_ns = task_trace_clock_ns();
+	e.thread = buf->thread;
+	e.kind = kind;
+	e.task = task;
+	e.other = other;
+	e.type = type;
+	e.cl = cl;
+	e.failed = failed;
+
+	publish_task_trace_head(*buf, head + 1);
+}
+
+void yb::enable_task_trace(bool enable)
+{
+	*static_cast<bool volatile *>(&g_task_trace_enabled) = enable;
+}
+
+void yb::clear_task_trace()
+{
+	g_epoch_ns = task_trace_clock_ns();
+}
+
+static bool event_time_less(task_trace_event const & lhs, task_trace_event const & rhs)
+{
+	return lhs.time_ns < rhs.time_ns;
+}
+
+std::vector<task_trace_event> yb::collect_task_trace()
+{
+	uint64_t epoch_ns = g_epoch_ns;
+
+	std::vector<task_trace_event> res, events, merged;
+	for (task_trace_buffer * buf = first_task_trace_buffer(); buf; buf = buf->next)
+	{
+		uint64_t head = load_task_trace_head(*buf);
+		uint64_t tail = head > task_trace_capacity? head - task_trace_capacity: 0;
+
+		events.clear();
+		for (uint64_t i = tail; i != head; ++i)
+			events.push_back(buf->events[i % task_trace_capacity]);
+
+		// The writer may have kept going while the events were copied;
+		// it overwrites the slot of the event `head - capacity` before
+		// publishing `head + 1`.
+		uint64_t new_head = load_task_trace_head(*buf);
+		uint64_t valid_tail = new_head + 1 > task_trace_capacity? new_head + 1 - task_trace_capacity: 0;
+		if (valid_tail > tail)
+			events.erase(events.begin(), events.begin() + (size_t)(std::min)(valid_tail - tail, head - tail));
+
+		events.erase(std::remove_if(events.begin(), events.end(), [epoch_ns](task_trace_event const & e) {
+			return e.time_ns < epoch_ns;
+		}), events.end());
+
+		// The events of each buffer are already ordered.
+		merged.clear();
+		merged.reserve(res.size() + events.size());
+		std::merge(res.begin(), res.end(), events.begin(), events.end(), std::back_inserter(merged), &event_time_less);
+		res.swap(merged);
+	}
+
+	return res;
+}
+
+namespace {
+
+char const * cancel_level_name(cancel_level cl)
+{
+	if (cl >= cl_kill)
+		return "kill";
+	if (cl >= cl_abort)
+		return "abort";
+	if (cl >= cl_quit)
+		return "quit";
+	return "none";
+}
+
+class chrome_trace_writer
+{
+public:
+	chrome_trace_writer(std::ostream & out, uint64_t start_ns)
+		: m_out(out), m_start_ns(start_ns), m_next_id(1), m_first(true)
+	{
+		m_out << "{\"traceEvents\":[";
+	}
+
+	~chrome_trace_writer()
+	{
+		m_out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+	}
+
+	void write(task_trace_event const & e)
+	{
+		switch (e.kind)
+		{
+		case ttk_created:
+			if (m_slices.find(e.task) != m_slices.end())
+				this->end(e, e.task, 0);
+			this->begin(e, e.task, e.type);
+			break;
+		case ttk_prepared:
+			this->instant(e, "prepare");
+			break;
+		case ttk_finalized:
+			this->instant(e, "finish");
+			break;
+		case ttk_continued:
+			if (e.other)
+			{
+				slice & next = this->get(e, e.other);
+				this->event(e, "n", this->get(e, e.task), "continue");
+				m_out << ",\"args\":{\"next\":\"" << next.id << "\"}}";
+				this->end(e, e.task, 0);
+			}
+			else
+			{
+				this->instant(e, "iterate");
+			}
+			break;
+		case ttk_cancelled:
+			this->event(e, "n", this->get(e, e.task), "cancel");
+			m_out << ",\"args\":{\"level\":\"" << cancel_level_name(e.cl) << "\"}}";
+			break;
+		case ttk_completed:
+			this->end(e, e.task, e.failed? "true": "false");
+			break;
+		case ttk_relocated:
+			{
+				std::map<void const *, slice>::iterator it = m_slices.find(e.task);
+				if (it != m_slices.end())
+				{
+					m_slices[e.other] = it->second;
+					m_slices.erase(it);
+				}
+			}
+			break;
+		}
+	}
+
+private:
+	struct slice
+	{
+		uint64_t id;
+		char const * name;
+	};
+
+	slice & get(task_trace_event const & e, void const * task)
+	{
+		std::map<void const *, slice>::iterator it = m_slices.find(task);
+		if (it != m_slices.end())
+			return it->second;
+
+		// The task was created before the events that are still available.
+		return this->begin(e, task, 0);
+	}
+
+	slice & begin(task_trace_event const & e, void const * task, char const * name)
+	{
+		slice & s = m_slices[task];
+		s.id = m_next_id++;
+		s.name = name? name: "task";
+		this->event(e, "b", s, s.name);
+		m_out << "}";
+		return s;
+	}
+
+	void end(task_trace_event const & e, void const * task, char const * failed)
+	{
+		std::map<void const *, slice>::iterator it = m_slices.find(task);
+		if (it == m_slices.end())
+			return;
+
+		this->event(e, "e", it->second, it->second.name);
+		if (failed)
+			m_out << ",\"args\":{\"failed\":" << failed << "}";
+		m_out << "}";
+		m_slices.erase(it);
+	}
+
+	void instant(task_trace_event const & e, char const * name)
+	{
+		this->event(e, "n", this->get(e, e.task), name);
+		m_out << "}";
+	}
+
+	// Writes all fields but the arguments and leaves the object open.
+	void event(task_trace_event const & e, char const * phase, slice const & s, char const * name)
+	{
+		uint64_t rel_ns = e.time_ns - m_start_ns;
+		char frac[4] = {
+			char('0' + rel_ns / 100 % 10),
+			char('0' + rel_ns / 10 % 10),
+			char('0' + rel_ns % 10),
+			0
+			};
+
+		m_out << (m_first? "\n": ",\n");
+		m_first = false;
+
+		m_out << "{\"name\":\"";
+		this->write_string(name);
+		m_out << "\",\"cat\":\"task\",\"ph\":\"" << phase << "\",\"id\":\"" << s.id
+			<< "\",\"pid\":1,\"tid\":" << e.thread << ",\"ts\":" << rel_ns / 1000 << "." << frac;
+	}
+
+	void write_string(char const * s)
+	{
+		for (; *s; ++s)
+		{
+			if (*s == '"' || *s == '\\')
+				m_out << '\\';
+			if ((unsigned char)*s >= 0x20)
+				m_out << *s;
+		}
+	}
+
+	std::ostream & m_out;
+	uint64_t m_start_ns;
+	uint64_t m_next_id;
+	bool m_first;
+	std::map<void const *, slice> m_slices;
+};
+
+} // namespace
+
+void yb::write_task_trace(std::ostream & out, std::vector<task_trace_event> const & events)
+{
+	chrome_trace_writer w(out, events.empty()? 0: events.front().time_ns);
+	for (size_t i = 0; i < events.size(); ++i)
+		w.write(events[i]);
+}
+
+void yb::write_task_trace(std::ostream & out)
+{
+	write_task_trace(out, collect_task_trace());
+}
@@ -0,0 +1,37 @@
+#ifndef LIBYB_ASYNC_DETAIL_TASK_TRACE_BUFFER_HPP
+#define LIBYB_ASYNC_DETAIL_TASK_TRACE_BUFFER_HPP
+
+#include "../task_trace.hpp"
+
+namespace yb {
+namespace detail {
+
+// A ring buffer of the events recorded by a single thread. Only
+// the owning thread writes the events; it publishes each one by
+// advancing `head`. Readers copy the events and then discard those
+// the writer may have overwritten in the meantime.
+//
+// The buffers are never freed. When a thread exits, its buffer
+// keeps the events and is handed over to the next new thread.
+struct task_trace_buffer
+{
+	task_trace_buffer * next;
+	long owned;
+	unsigned thread;
+	uint64_t head;
+	task_trace_event events[task_trace_capacity];
+};
+
+// Implemented per platform.
+task_trace_buffer * this_thread_task_trace_buffer() throw();
+task_trace_buffer * first_task_trace_buffer() throw();
+
+void publish_task_trace_head(task_trace_buffer & buf, uint64_t head) throw();
+uint64_t load_task_trace_head(task_trace_buffer const & buf) throw();
+
+uint64_t task_trace_clock_ns() throw();
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_TASK_TRACE_BUFFER_HPP
@@ -1,8 +1,20 @@
 #include "unix_wait_context.hpp"
 using namespace yb;
 
+static __thread unsigned g_preparation_epoch = 0;
+
+void yb::detail::invalidate_this_thread_preparations() throw()
+{
+	++g_preparation_epoch;
+}
+
+unsigned yb::detail::this_thread_preparation_epoch() throw()
+{
+	return g_preparation_epoch;
+}
+
 task_wait_preparation_context::task_wait_preparation_context()
-	: m_pimpl(new task_wait_preparation_context_impl())
+	: m_pimpl(new task_wait_preparation_context_impl()), m_full_preparation(false)
 {
 }
 
@@ -14,12 +26,14 @@ void task_wait_preparation_context::clear()
 {
 	m_pimpl->m_pollfds.clear();
 	m_pimpl->m_finished_tasks = 0;
+	m_pimpl->m_volatile_tasks = 0;
 }
 
 task_wait_checkpoint task_wait_preparation_context::checkpoint() const
 {
 	task_wait_checkpoint res;
 	res.finished_task_count = m_pimpl->m_finished_tasks;
+	res.volatile_task_count = m_pimpl->m_volatile_tasks;
 	res.poll_item_count = m_pimpl->m_pollfds.size();
 	return res;
 }
@@ -28,3 +42,24 @@ void task_wait_preparation_context::set_finished()
 {
 	++m_pimpl->m_finished_tasks;
 }
+
+void task_wait_preparation_context::set_volatile()
+{
+	++m_pimpl->m_volatile_tasks;
+}
+
+void task_wait_preparation_context::append(task_wait_preparation_context const & sub)
+{
+	task_wait_preparation_context_impl const & sub_impl = *sub.m_pimpl;
+
+	m_pimpl->m_pollfds.insert(m_pimpl->m_pollfds.end(), sub_impl.m_pollfds.begin(), sub_impl.m_pollfds.end());
+	m_pimpl->m_finished_tasks += sub_impl.m_finished_tasks;
+	m_pimpl->m_volatile_tasks += sub_impl.m_volatile_tasks;
+}
+
+void task_wait_preparation_context::copy_results_to(task_wait_preparation_context & sub, size_t first) const
+{
+	std::vector<struct pollfd> & sub_pollfds = sub.m_pimpl->m_pollfds;
+	for (size_t i = 0; i < sub_pollfds.size(); ++i)
+		sub_pollfds[i].revents = m_pimpl->m_pollfds[first + i].revents;
+}
@@ -11,6 +11,7 @@ namespace yb {
 struct task_wait_preparation_context_impl
 {
 	size_t m_finished_tasks;
+	size_t m_volatile_tasks;
 	std::vector<struct pollfd> m_pollfds;
 };
 
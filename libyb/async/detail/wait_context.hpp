@@ -13,6 +13,7 @@ struct task_wait_checkpoint
 {
 	size_t poll_item_count;
 	size_t finished_task_count;
+	size_t volatile_task_count;
 };
 
 struct task_wait_memento
@@ -21,6 +22,7 @@ struct task_wait_memento
 	size_t poll_item_last;
 
 	size_t finished_task_count;
+	size_t volatile_task_count;
 };
 
 class task_wait_preparation_context
@@ -32,13 +34,50 @@ public:
 	void clear();
 	void add_poll_item(task_wait_poll_item const & item);
 	void set_finished();
+
+	// Marks the task as waiting for a state change that no poll item
+	// will signal, e.g. for another task in the same runner to fill a channel.
+	// Runners that keep poll items registered across iterations
+	// will prepare such tasks again on every iteration.
+	void set_volatile();
+
 	task_wait_preparation_context_impl * get() const;
 	task_wait_checkpoint checkpoint() const;
 
+	// Appends the poll items and the task counts of another context.
+	// Tasks use this to keep the preparation of their subtasks
+	// until the subtasks are finalized or cancelled.
+	void append(task_wait_preparation_context const & sub);
+
+	// Copies the outcome of the wait for the poll items that were
+	// appended from `sub` at the index `first` back to `sub`.
+	void copy_results_to(task_wait_preparation_context & sub, size_t first) const;
+
+	// Set by runners when a task may have changed without its parent
+	// noticing, e.g. when it was cancelled through a future. Tasks must
+	// then prepare all their subtasks again instead of reusing
+	// the previous preparation.
+	void set_full_preparation(bool full) { m_full_preparation = full; }
+	bool full_preparation() const { return m_full_preparation; }
+
 private:
 	std::unique_ptr<task_wait_preparation_context_impl> m_pimpl;
+	bool m_full_preparation;
 };
 
+namespace detail {
+
+// Called when a task changes without its runner noticing, e.g. when
+// a cancellation token cancels it. Runners on the calling thread then
+// prepare all their tasks again before they wait the next time.
+void invalidate_this_thread_preparations() throw();
+
+// Changes with every call to `invalidate_this_thread_preparations`
+// on the calling thread.
+unsigned this_thread_preparation_epoch() throw();
+
+} // namespace detail
+
 class task_wait_memento_builder
 	: noncopyable
 {
@@ -54,6 +93,7 @@ public:
 
 		task_wait_memento res;
 		res.finished_task_count = chkp.finished_task_count - m_checkpoint.finished_task_count;
+		res.volatile_task_count = chkp.volatile_task_count - m_checkpoint.volatile_task_count;
 		res.poll_item_first = m_checkpoint.poll_item_count;
 		res.poll_item_last = chkp.poll_item_count;
 		return res;
@@ -0,0 +1,274 @@
+#ifndef LIBYB_ASYNC_DETAIL_WHEN_TASK_HPP
+#define LIBYB_ASYNC_DETAIL_WHEN_TASK_HPP
+
+#include "../task_base.hpp"
+#include "parallel_composition_task.hpp"
+#include "task_node_pool.hpp"
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+namespace yb {
+namespace detail {
+
+static size_t const no_winner = (size_t)-1;
+
+// A policy decides which result settles the composition
+// and what the composition completes with.
+template <typename R>
+struct when_all_policy
+{
+	typedef std::vector<R> result_type;
+
+	static bool settles(task_result<R> const & r)
+	{
+		return r.has_exception();
+	}
+
+	static task<result_type> result(std::vector<parallel_child<R> > & children, size_t winner)
+	{
+		if (winner != no_winner)
+			return async::raise<result_type>(children[winner].t.get_result().exception());
+
+		try
+		{
+			result_type res;
+			res.reserve(children.size());
+			for (size_t i = 0; i < children.size(); ++i)
+				res.push_back(children[i].t.get_result().get());
+			return async::value(std::move(res));
+		}
+		catch (...)
+		{
+			return async::raise<result_type>();
+		}
+	}
+};
+
+template <>
+struct when_all_policy<void>
+{
+	typedef void result_type;
+
+	static bool settles(task_result<void> const & r)
+	{
+		return r.has_exception();
+	}
+
+	static task<void> result(std::vector<parallel_child<void> > & children, size_t winner)
+	{
+		if (winner != no_winner)
+			return async::raise<void>(children[winner].t.get_result().exception());
+		return async::value();
+	}
+};
+
+template <typename R>
+struct when_any_policy
+{
+	typedef std::pair<size_t, R> result_type;
+
+	static bool settles(task_result<R> const &)
+	{
+		return true;
+	}
+
+	static task<result_type> result(std::vector<parallel_child<R> > & children, size_t winner)
+	{
+		if (winner == no_winner)
+			return async::raise<result_type>(std::invalid_argument("when_any needs at least one task"));
+
+		task_result<R> r = children[winner].t.get_result();
+		if (r.has_exception())
+			return async::raise<result_type>(r.exception());
+		return async::value(std::make_pair(winner, r.get()));
+	}
+};
+
+template <>
+struct when_any_policy<void>
+{
+	typedef size_t result_type;
+
+	static bool settles(task_result<void> const &)
+	{
+		return true;
+	}
+
+	static task<size_t> result(std::vector<parallel_child<void> > & children, size_t winner)
+	{
+		if (winner == no_winner)
+			return async::raise<size_t>(std::invalid_argument("when_any needs at least one task"));
+
+		task_result<void> r = children[winner].t.get_result();
+		if (r.has_exception())
+			return async::raise<size_t>(r.exception());
+		return async::value(winner);
+	}
+};
+
+// Runs tasks in parallel, keeping them in a single array. The first
+// result that settles the composition cancels the remaining tasks;
+// the composition completes once all the tasks do.
+template <typename R, typename Policy>
+class when_task
+	: public task_base<typename Policy::result_type>, public pooled_task_node
+{
+public:
+	typedef typename Policy::result_type result_type;
+
+	when_task(std::vector<task<R> > && tasks, cancel_level cl);
+
+	bool has_result() const { return m_pending == 0; }
+	task<result_type> get_result();
+
+	void cancel(cancel_level cl) throw();
+	task_result<result_type> cancel_and_wait() throw();
+	void prepare_wait(task_wait_preparation_context & ctx);
+	task<result_type> finish_wait(task_wait_finalization_context & ctx) throw();
+
+private:
+	void complete(size_t index) throw();
+
+	std::vector<parallel_child<R> > m_children;
+	size_t m_pending;
+	size_t m_winner;
+	cancel_level m_cl;
+};
+
+template <typename R, typename Policy>
+when_task<R, Policy>::when_task(std::vector<task<R> > && tasks, cancel_level cl)
+	: m_pending(tasks.size()), m_winner(no_winner), m_cl(cl)
+{
+	m_children.reserve(tasks.size());
+	for (size_t i = 0; i < tasks.size(); ++i)
+	{
+		assert(!tasks[i].empty());
+		m_children.push_back(parallel_child<R>(std::move(tasks[i])));
+	}
+	tasks.clear();
+
+	for (size_t i = 0; i < m_children.size(); ++i)
+	{
+		if (m_children[i].t.has_result())
+			this->complete(i);
+	}
+}
+
+template <typename R, typename Policy>
+void when_task<R, Policy>::complete(size_t index) throw()
+{
+	assert(m_pending != 0);
+	--m_pending;
+
+	if (m_winner != no_winner)
+		return;
+
+	// Peeks at the result without consuming it.
+	task_result<R> r = m_children[index].t.get_result();
+	bool settles = Policy::settles(r);
+	m_children[index].t = async::result(std::move(r));
+
+	if (settles)
+	{
+		m_winner = index;
+		for (size_t i = 0; i < m_children.size(); ++i)
+		{
+			if (m_children[i].t.has_task())
+				m_children[i].cancel(m_cl);
+		}
+	}
+}
+
+template <typename R, typename Policy>
+task<typename Policy::result_type> when_task<R, Policy>::get_result()
+{
+	assert(m_pending == 0);
+	return Policy::result(m_children, m_winner);
+}
+
+template <typename R, typename Policy>
+void when_task<R, Policy>::cancel(cancel_level cl) throw()
+{
+	for (size_t i = 0; i < m_children.size(); ++i)
+	{
+		if (m_children[i].t.has_task())
+			m_children[i].cancel(cl);
+	}
+}
+
+template <typename R, typename Policy>
+task_result<typename Policy::result_type> when_task<R, Policy>::cancel_and_wait() throw()
+{
+	for (size_t i = 0; i < m_children.size(); ++i)
+	{
+		if (m_children[i].t.has_task())
+		{
+			m_children[i].t = async::result(m_children[i].t.cancel_and_wait());
+			this->complete(i);
+		}
+	}
+
+	return this->get_result().get_result();
+}
+
+template <typename R, typename Policy>
+void when_task<R, Policy>::prepare_wait(task_wait_preparation_context & ctx)
+{
+	for (size_t i = 0; i < m_children.size(); ++i)
+	{
+		if (m_children[i].t.has_task())
+			m_children[i].prepare_wait(ctx);
+	}
+}
+
+template <typename R, typename Policy>
+task<typename Policy::result_type> when_task<R, Policy>::finish_wait(task_wait_finalization_context & ctx) throw()
+{
+	for (size_t i = 0; i < m_children.size(); ++i)
+	{
+		if (m_children[i].t.has_task() && m_children[i].finish_wait(ctx) && m_children[i].t.has_result())
+			this->complete(i);
+	}
+
+	if (m_pending == 0)
+		return this->get_result();
+	return nulltask;
+}
+
+template <typename Policy, typename R>
+task<typename Policy::result_type> when(std::vector<task<R> > && tasks, cancel_level cl)
+{
+	typedef typename Policy::result_type result_type;
+
+	try
+	{
+		std::unique_ptr<when_task<R, Policy> > res(new when_task<R, Policy>(std::move(tasks), cl));
+		if (res->has_result())
+			return res->get_result();
+		return task<result_type>(res.release());
+	}
+	catch (...)
+	{
+		tasks.clear();
+		return async::raise<result_type>();
+	}
+}
+
+} // namespace detail
+
+template <typename R>
+task<typename detail::when_all_policy<R>::result_type> when_all(std::vector<task<R> > && tasks, cancel_level cl)
+{
+	return detail::when<detail::when_all_policy<R> >(std::move(tasks), cl);
+}
+
+template <typename R>
+task<typename detail::when_any_policy<R>::result_type> when_any(std::vector<task<R> > && tasks, cancel_level cl)
+{
+	return detail::when<detail::when_any_policy<R> >(std::move(tasks), cl);
+}
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_WHEN_TASK_HPP
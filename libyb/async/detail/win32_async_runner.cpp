@@ -1,6 +1,8 @@
 #include "../async_runner.hpp"
 #include "../../utils/noncopyable.hpp"
 #include "win32_wait_context.hpp"
+#include "win32_runner_metrics.hpp"
+#include "task_reaper.hpp"
 #include <list>
 #include <windows.h>
 #include <stdexcept>
@@ -8,10 +10,17 @@
 using namespace yb;
 using namespace yb::detail;
 
+namespace {
+
+char closed_completions_tag;
+async_completion * const closed_completions = reinterpret_cast<async_completion *>(&closed_completions_tag);
+
+} // namespace
+
 struct async_promise_base::impl
 {
 	explicit impl(async_runner * runner)
-		: m_refcount(0), m_runner(runner), m_applied_cancel(cl_none), m_requested_cancel(cl_none)
+		: m_refcount(0), m_runner(runner), m_applied_cancel(cl_none), m_requested_cancel(cl_none), m_completions(0)
 	{
 		hFinishedEvent = CreateEvent(0, TRUE, FALSE, 0);
 		if (!hFinishedEvent)
@@ -28,6 +37,9 @@ struct async_promise_base::impl
 	cancel_level m_applied_cancel;
 	cancel_level m_requested_cancel;
 	HANDLE hFinishedEvent;
+
+	// The callbacks to run once the promise finishes, most recent first.
+	async_completion * volatile m_completions;
 };
 
 async_promise_base::async_promise_base(async_runner * runner)
@@ -50,9 +62,49 @@ void async_promise_base::release()
 		delete this;
 }
 
+void async_promise_base::set_runner(async_runner * runner)
+{
+	m_pimpl->m_runner = runner;
+}
+
 void async_promise_base::mark_finished()
 {
 	SetEvent(m_pimpl->hFinishedEvent);
+
+	async_completion * c = (async_completion *)InterlockedExchangePointer((PVOID volatile *)&m_pimpl->m_completions, closed_completions);
+
+	async_completion * first = 0;
+	while (c)
+	{
+		async_completion * next = c->m_next;
+		c->m_next = first;
+		first = c;
+		c = next;
+	}
+
+	while (first)
+	{
+		async_completion * next = first->m_next;
+		first->run();
+		first = next;
+	}
+}
+
+void async_promise_base::add_completion(async_completion * c)
+{
+	for (;;)
+	{
+		async_completion * head = m_pimpl->m_completions;
+		if (head == closed_completions)
+		{
+			c->run();
+			return;
+		}
+
+		c->m_next = head;
+		if (InterlockedCompareExchangePointer((PVOID volatile *)&m_pimpl->m_completions, c, head) == head)
+			return;
+	}
 }
 
 void async_promise_base::wait()
@@ -60,13 +112,16 @@ void async_promise_base::wait()
 	WaitForSingleObject(m_pimpl->hFinishedEvent, INFINITE);
 }
 
-void async_promise_base::perform_pending_cancels()
+bool async_promise_base::perform_pending_cancels()
 {
 	if (m_pimpl->m_applied_cancel < m_pimpl->m_requested_cancel)
 	{
 		m_pimpl->m_applied_cancel = m_pimpl->m_requested_cancel;
 		this->do_cancel(m_pimpl->m_applied_cancel);
+		return true;
 	}
+
+	return false;
 }
 
 namespace {
@@ -154,8 +209,29 @@ struct parallel_promise
 
 struct async_runner::impl
 {
-	impl()
-		: hThread(0), stopped(false)
+	// Posts the tasks that the promises' tasks drop, but which can't
+	// be cancelled right away, back to the runner.
+	struct runner_reaper
+		: task_reaper
+	{
+		explicit runner_reaper(async_runner * owner)
+			: owner(owner)
+		{
+		}
+
+		void reap(task<void> && t) throw()
+		{
+			// If the post fails, the task is waited for right here.
+			scoped_task_reaper blocking(0);
+			owner->post_detached(std::move(t));
+			t.clear();
+		}
+
+		async_runner * owner;
+	};
+
+	explicit impl(async_runner * owner)
+		: reaper(owner), hThread(0), stopped(false)
 	{
 		hQueueUpdated.attach(CreateEvent(0, FALSE, FALSE, 0));
 		if (!hQueueUpdated.get())
@@ -200,10 +276,19 @@ struct async_runner::impl
 	{
 		task_wait_preparation_context wait_ctx;
 		task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
+		unsigned prepared_epoch = this_thread_preparation_epoch();
 
 		for (;;)
 		{
+			bool measure = metrics.enabled();
+			uint64_t start_ns = measure? win32_monotonic_ns(): 0;
+
+			// Tasks that changed without the runner noticing
+			// invalidate the preparations of all promises.
+			unsigned epoch = this_thread_preparation_epoch();
 			wait_ctx.clear();
+			wait_ctx.set_full_preparation(epoch != prepared_epoch);
+			prepared_epoch = epoch;
 
 			{
 				cs_holder l(queue_mutex);
@@ -225,25 +310,43 @@ struct async_runner::impl
 
 			wait_ctx_impl.m_handles.push_back(hQueueUpdated.get());
 
+			uint64_t prepared_ns = measure? win32_monotonic_ns(): 0;
+			uint64_t woken_ns = prepared_ns;
+			size_t poll_items = 0;
+
 			if (wait_ctx_impl.m_finished_tasks)
 			{
 				task_wait_finalization_context finish_ctx;
+				finish_ctx.prep_ctx = &wait_ctx;
 				finish_ctx.finished_tasks = wait_ctx_impl.m_finished_tasks;
 				this->finish_wait(finish_ctx);
 			}
 			else
 			{
+				poll_items = wait_ctx_impl.m_handles.size();
 				DWORD dwRes = WaitForMultipleObjects(wait_ctx_impl.m_handles.size(), wait_ctx_impl.m_handles.data(), FALSE, INFINITE);
 				assert(dwRes >= WAIT_OBJECT_0 && dwRes < WAIT_OBJECT_0 + wait_ctx_impl.m_handles.size());
 
-				if (dwRes - WAIT_OBJECT_0 == wait_ctx_impl.m_handles.size() - 1)
-					continue;
+				if (measure)
+					woken_ns = win32_monotonic_ns();
 
-				task_wait_finalization_context finish_ctx;
-				finish_ctx.finished_tasks = false;
-				finish_ctx.selected_poll_item = dwRes - WAIT_OBJECT_0;
-				this->finish_wait(finish_ctx);
+				if (dwRes - WAIT_OBJECT_0 == wait_ctx_impl.m_handles.size() - 1)
+				{
+					if (measure)
+						metrics.record_control_wakeup();
+				}
+				else
+				{
+					task_wait_finalization_context finish_ctx;
+					finish_ctx.prep_ctx = &wait_ctx;
+					finish_ctx.finished_tasks = false;
+					finish_ctx.selected_poll_item = dwRes - WAIT_OBJECT_0;
+					this->finish_wait(finish_ctx);
+				}
 			}
+
+			if (measure)
+				metrics.record_iteration(prepared_ns - start_ns, woken_ns - prepared_ns, win32_monotonic_ns() - woken_ns, poll_items);
 		}
 	}
 
@@ -268,6 +371,7 @@ struct async_runner::impl
 	{
 		try
 		{
+			scoped_task_reaper scoped_reaper(&reaper);
 			this->run();
 		}
 		catch (...)
@@ -285,6 +389,9 @@ struct async_runner::impl
 		return 0;
 	}
 
+	runner_reaper reaper;
+	win32_runner_metrics metrics;
+
 	CRITICAL_SECTION queue_mutex;
 	std::list<parallel_promise> promises;
 
@@ -294,8 +401,8 @@ struct async_runner::impl
 	bool stopped;
 };
 
-async_runner::async_runner()
-	: m_pimpl(new impl())
+async_runner::async_runner(runner_backend_t)
+	: m_pimpl(new impl(this))
 {
 	m_pimpl->start();
 }
@@ -304,8 +411,35 @@ async_runner::~async_runner()
 {
 }
 
-async_runner::submit_context::submit_context(async_runner & runner)
-	: m_runner(runner)
+runner_backend_t async_runner::backend() const
+{
+	return rb_wait_objects;
+}
+
+size_t async_runner::load() const
+{
+	cs_holder l(m_pimpl->queue_mutex);
+	return m_pimpl->promises.size();
+}
+
+void async_runner::enable_stats(bool enable)
+{
+	m_pimpl->metrics.enable(enable);
+}
+
+runner_stats async_runner::stats() const
+{
+	return m_pimpl->metrics.snapshot(this->load());
+}
+
+void async_runner::join_group(std::vector<async_runner *> const *)
+{
+	// Promises are never stolen, the pool only balances
+	// the load when posting.
+}
+
+async_runner::submit_context::submit_context(async_runner & runner, bool stealable)
+	: m_runner(runner), m_stealable(stealable)
 {
 	EnterCriticalSection(&m_runner.m_pimpl->queue_mutex);
 	m_runner.m_pimpl->promises.push_back(parallel_promise());
@@ -0,0 +1,210 @@
+#include "concurrent_channel_detail.hpp"
+#include <stdexcept>
+#include <windows.h>
+using namespace yb;
+using namespace yb::detail;
+
+// Volatile reads have acquire semantics with msvc.
+static uint32_t load(uint32_t const & v)
+{
+	return *static_cast<uint32_t const volatile *>(&v);
+}
+
+static void store(uint32_t & v, uint32_t value)
+{
+	InterlockedExchange((LONG volatile *)&v, (LONG)value);
+}
+
+static bool compare_exchange(uint32_t & v, uint32_t & expected, uint32_t value)
+{
+	uint32_t prev = (uint32_t)InterlockedCompareExchange((LONG volatile *)&v, (LONG)value, (LONG)expected);
+	if (prev == expected)
+		return true;
+	expected = prev;
+	return false;
+}
+
+concurrent_channel_core::concurrent_channel_core(size_t capacity, bool spsc)
+	: m_mask(0), m_seq(0), m_spsc(spsc), m_refcount(1), m_tail(0), m_head(0)
+{
+	// Tickets wrap around, they must stay unambiguous.
+	if (capacity > 0x80000000u)
+		throw std::length_error("concurrent_channel capacity is too large");
+
+	uint32_t size = 1;
+	while (size < capacity)
+		size *= 2;
+	m_mask = size - 1;
+
+	m_waiters[wk_receiver] = 0;
+	m_waiters[wk_sender] = 0;
+
+	if (!m_spsc)
+	{
+		m_seq = new uint32_t[size];
+		for (uint32_t i = 0; i != size; ++i)
+			m_seq[i] = i;
+	}
+}
+
+concurrent_channel_core::~concurrent_channel_core()
+{
+	delete [] m_seq;
+}
+
+void concurrent_channel_core::addref() throw()
+{
+	InterlockedIncrement(&m_refcount);
+}
+
+void concurrent_channel_core::release() throw()
+{
+	if (!InterlockedDecrement(&m_refcount))
+		delete this;
+}
+
+bool concurrent_channel_core::begin_push(uint32_t & ticket) throw()
+{
+	if (m_spsc)
+	{
+		uint32_t tail = m_tail;
+		if (tail - load(m_head) > m_mask)
+			return false;
+		ticket = tail;
+		return true;
+	}
+
+	uint32_t pos = load(m_tail);
+	for (;;)
+	{
+		int32_t diff = (int32_t)(load(m_seq[pos & m_mask]) - pos);
+		if (diff == 0)
+		{
+			if (compare_exchange(m_tail, pos, pos + 1))
+				break;
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = load(m_tail);
+		}
+	}
+
+	ticket = pos;
+	return true;
+}
+
+void concurrent_channel_core::end_push(uint32_t ticket) throw()
+{
+	if (m_spsc)
+		store(m_tail, ticket + 1);
+	else
+		store(m_seq[ticket & m_mask], ticket + 1);
+
+	MemoryBarrier();
+	this->wake(wk_receiver);
+	this->wake(wk_sender);
+}
+
+bool concurrent_channel_core::begin_pop(uint32_t & ticket) throw()
+{
+	if (m_spsc)
+	{
+		uint32_t head = m_head;
+		if (load(m_tail) == head)
+			return false;
+		ticket = head;
+		return true;
+	}
+
+	uint32_t pos = load(m_head);
+	for (;;)
+	{
+		int32_t diff = (int32_t)(load(m_seq[pos & m_mask]) - (pos + 1));
+		if (diff == 0)
+		{
+			if (compare_exchange(m_head, pos, pos + 1))
+				break;
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = load(m_head);
+		}
+	}
+
+	ticket = pos;
+	return true;
+}
+
+void concurrent_channel_core::end_pop(uint32_t ticket) throw()
+{
+	if (m_spsc)
+		store(m_head, ticket + 1);
+	else
+		store(m_seq[ticket & m_mask], ticket + m_mask + 1);
+
+	MemoryBarrier();
+	this->wake(wk_sender);
+	this->wake(wk_receiver);
+}
+
+bool concurrent_channel_core::ready(waiter_kind kind) const throw()
+{
+	if (m_spsc)
+	{
+		uint32_t tail = load(m_tail);
+		uint32_t head = load(m_head);
+		return kind == wk_receiver? tail != head: tail - head <= m_mask;
+	}
+
+	if (kind == wk_receiver)
+	{
+		uint32_t pos = load(m_head);
+		return (int32_t)(load(m_seq[pos & m_mask]) - (pos + 1)) >= 0;
+	}
+	else
+	{
+		uint32_t pos = load(m_tail);
+		return (int32_t)(load(m_seq[pos & m_mask]) - pos) >= 0;
+	}
+}
+
+void concurrent_channel_core::wake(waiter_kind kind) throw()
+{
+	if (*static_cast<long volatile *>(&m_waiters[kind]) != 0 && this->ready(kind))
+		m_events[kind].set();
+}
+
+bool concurrent_channel_core::begin_wait(waiter_kind kind)
+{
+	InterlockedIncrement(&m_waiters[kind]);
+
+	if (this->ready(kind))
+	{
+		InterlockedDecrement(&m_waiters[kind]);
+		return false;
+	}
+
+	return true;
+}
+
+void concurrent_channel_core::end_wait(waiter_kind kind) throw()
+{
+	InterlockedDecrement(&m_waiters[kind]);
+
+	m_events[kind].reset();
+	MemoryBarrier();
+	this->wake(kind);
+}
+
+task<void> concurrent_channel_core::wait(waiter_kind kind)
+{
+	return m_events[kind].wait();
+}
@@ -4,20 +4,24 @@
 #include "../task.hpp"
 #include "win32_affinity_task.hpp"
 #include "win32_wait_context.hpp"
+#include "task_reaper.hpp"
 #include "../../utils/noncopyable.hpp"
 #include "../cancel_exception.hpp"
 #include <windows.h>
+#include <memory>
 
 namespace yb {
 
-// The canceller must not throw an exception
+// The canceller must not throw an exception. If `handle_owner` is set,
+// it keeps the handle open for as long as the task exists.
 template <typename Canceller>
 class win32_handle_task
 	: public task_base<void>, noncopyable
 {
 public:
-	win32_handle_task(HANDLE handle, Canceller const & canceller);
-	win32_handle_task(HANDLE handle, Canceller && canceller);
+	win32_handle_task(HANDLE handle, Canceller const & canceller, std::shared_ptr<void> const & handle_owner = std::shared_ptr<void>());
+	win32_handle_task(HANDLE handle, Canceller && canceller, std::shared_ptr<void> const & handle_owner = std::shared_ptr<void>());
+	win32_handle_task(win32_handle_task && o) throw();
 
 	void cancel(cancel_level cl) throw();
 	task_result<void> cancel_and_wait() throw();
@@ -27,25 +31,41 @@ public:
 private:
 	HANDLE m_handle;
 	Canceller m_canceller;
+	std::shared_ptr<void> m_handle_owner;
 };
 
+// Waits for a handle that the caller keeps open until the task completes.
+// If the canceller refuses to cancel, dropping the task blocks until
+// the handle gets signalled.
 template <typename Canceller>
 task<void> make_win32_handle_task(HANDLE handle, Canceller && canceller) throw();
 
+// Waits for a handle kept open by `handle_owner`. Dropped inside a runner,
+// a task that refuses to be cancelled is finished by the runner.
+template <typename Canceller>
+task<void> make_win32_handle_task(std::shared_ptr<void> const & handle_owner, HANDLE handle, Canceller && canceller) throw();
+
 } // namespace yb
 
 namespace yb {
 
 template <typename Canceller>
-win32_handle_task<Canceller>::win32_handle_task(HANDLE handle, Canceller const & canceller)
-	: m_handle(handle), m_canceller(canceller)
+win32_handle_task<Canceller>::win32_handle_task(HANDLE handle, Canceller const & canceller, std::shared_ptr<void> const & handle_owner)
+	: m_handle(handle), m_canceller(canceller), m_handle_owner(handle_owner)
+{
+}
+
+template <typename Canceller>
+win32_handle_task<Canceller>::win32_handle_task(HANDLE handle, Canceller && canceller, std::shared_ptr<void> const & handle_owner)
+	: m_handle(handle), m_canceller(std::move(canceller)), m_handle_owner(handle_owner)
 {
 }
 
 template <typename Canceller>
-win32_handle_task<Canceller>::win32_handle_task(HANDLE handle, Canceller && canceller)
-	: m_handle(handle), m_canceller(std::move(canceller))
+win32_handle_task<Canceller>::win32_handle_task(win32_handle_task && o) throw()
+	: m_handle(o.m_handle), m_canceller(std::move(o.m_canceller)), m_handle_owner(std::move(o.m_handle_owner))
 {
+	o.m_handle = 0;
 }
 
 template <typename Canceller>
@@ -69,6 +89,12 @@ task_result<void> win32_handle_task<Canceller>::cancel_and_wait() throw()
 	if (m_handle && !m_canceller(cl_kill))
 		m_handle = 0;
 
+	// Inside a runner, an owned handle is waited for along with
+	// the runner's other tasks; a borrowed one may be closed
+	// as soon as the task is gone.
+	if (m_handle && m_handle_owner)
+		detail::reap_task(*this);
+
 	if (m_handle)
 	{
 		WaitForSingleObject(m_handle, INFINITE);
@@ -89,11 +115,17 @@ void win32_handle_task<Canceller>::cancel(cancel_level cl) throw()
 
 template <typename Canceller>
 task<void> make_win32_handle_task(HANDLE handle, Canceller && canceller) throw()
+{
+	return make_win32_handle_task(std::shared_ptr<void>(), handle, std::forward<Canceller>(canceller));
+}
+
+template <typename Canceller>
+task<void> make_win32_handle_task(std::shared_ptr<void> const & handle_owner, HANDLE handle, Canceller && canceller) throw()
 {
 	try
 	{
 		return task<void>(
-			new win32_handle_task<typename std::remove_reference<Canceller>::type>(handle, std::forward<Canceller>(canceller)));
+			new win32_handle_task<typename std::remove_reference<Canceller>::type>(handle, std::forward<Canceller>(canceller), handle_owner));
 	}
 	catch (...)
 	{
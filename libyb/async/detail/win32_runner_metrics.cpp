@@ -0,0 +1,76 @@
+#include "win32_runner_metrics.hpp"
+#include <string.h>
+using namespace yb;
+using namespace yb::detail;
+
+uint64_t yb::detail::win32_monotonic_ns()
+{
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000 + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}
+
+win32_runner_metrics::win32_runner_metrics()
+	: m_enabled(false), m_started_us(0)
+{
+	InitializeCriticalSection(&m_cs);
+	memset(&m_stats, 0, sizeof m_stats);
+}
+
+win32_runner_metrics::~win32_runner_metrics()
+{
+	DeleteCriticalSection(&m_cs);
+}
+
+void win32_runner_metrics::enable(bool enable)
+{
+	EnterCriticalSection(&m_cs);
+	if (enable && m_started_us == 0)
+		m_started_us = win32_monotonic_ns() / 1000;
+	*static_cast<bool volatile *>(&m_enabled) = enable;
+	LeaveCriticalSection(&m_cs);
+}
+
+void win32_runner_metrics::record(runner_histogram & h, uint64_t value)
+{
+	size_t bucket = 0;
+	while (bucket < runner_histogram::bucket_count - 1 && (value >> bucket) != 0)
+		++bucket;
+
+	++h.buckets[bucket];
+	++h.count;
+	h.total += value;
+	if (value > h.max)
+		h.max = value;
+}
+
+void win32_runner_metrics::record_iteration(uint64_t prepare_ns, uint64_t wait_ns, uint64_t finish_ns, size_t poll_items)
+{
+	EnterCriticalSection(&m_cs);
+	++m_stats.iterations;
+	record(m_stats.prepare_ns, prepare_ns);
+	record(m_stats.wait_ns, wait_ns);
+	record(m_stats.finish_ns, finish_ns);
+	record(m_stats.poll_items, poll_items);
+	LeaveCriticalSection(&m_cs);
+}
+
+void win32_runner_metrics::record_control_wakeup()
+{
+	EnterCriticalSection(&m_cs);
+	++m_stats.control_wakeups;
+	LeaveCriticalSection(&m_cs);
+}
+
+runner_stats win32_runner_metrics::snapshot(size_t live_promises) const
+{
+	EnterCriticalSection(&m_cs);
+	runner_stats res = m_stats;
+	res.enabled = m_enabled;
+	res.elapsed_us = m_started_us? win32_monotonic_ns() / 1000 - m_started_us: 0;
+	LeaveCriticalSection(&m_cs);
+
+	res.live_promises = live_promises;
+	return res;
+}
@@ -0,0 +1,50 @@
+#ifndef LIBYB_ASYNC_DETAIL_WIN32_RUNNER_METRICS_HPP
+#define LIBYB_ASYNC_DETAIL_WIN32_RUNNER_METRICS_HPP
+
+#include "../runner_stats.hpp"
+#include "../../utils/noncopyable.hpp"
+#include <windows.h>
+
+namespace yb {
+namespace detail {
+
+uint64_t win32_monotonic_ns();
+
+// Collects the statistics of a dispatch loop. The samples are recorded
+// under a critical section, which is only entered while the collection
+// is enabled; snapshots taken from other threads are consistent.
+class win32_runner_metrics
+	: noncopyable
+{
+public:
+	win32_runner_metrics();
+	~win32_runner_metrics();
+
+	// Disabled collectors cost the loop a single load per iteration.
+	void enable(bool enable);
+
+	bool enabled() const
+	{
+		return *static_cast<bool const volatile *>(&m_enabled);
+	}
+
+	void record_iteration(uint64_t prepare_ns, uint64_t wait_ns, uint64_t finish_ns, size_t poll_items);
+	void record_control_wakeup();
+
+	runner_stats snapshot(size_t live_promises) const;
+
+private:
+	static void record(runner_histogram & h, uint64_t value);
+
+	mutable CRITICAL_SECTION m_cs;
+	bool m_enabled;
+	uint64_t m_started_us;
+
+	// All fields but `enabled`, `elapsed_us` and `live_promises`.
+	runner_stats m_stats;
+};
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_DETAIL_WIN32_RUNNER_METRICS_HPP
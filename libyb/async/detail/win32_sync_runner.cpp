@@ -1,17 +1,62 @@
 #include "../sync_runner.hpp"
 #include "win32_wait_context.hpp"
+#include "win32_runner_metrics.hpp"
 using namespace yb;
+using namespace yb::detail;
+
+struct sync_runner::impl
+{
+	// The implementation is created once the statistics are enabled.
+	win32_runner_metrics metrics;
+};
+
+sync_runner::sync_runner()
+	: m_reaper(this), m_invalidated(false), m_prepared_epoch(0)
+{
+}
+
+sync_runner::~sync_runner()
+{
+}
+
+void sync_runner::enable_stats(bool enable)
+{
+	if (!m_pimpl)
+		m_pimpl.reset(new impl());
+	m_pimpl->metrics.enable(enable);
+}
+
+runner_stats sync_runner::stats() const
+{
+	if (!m_pimpl)
+		return win32_runner_metrics().snapshot(0);
+	return m_pimpl->metrics.snapshot(0);
+}
 
 void sync_runner::poll_one(task_wait_preparation_context & wait_ctx)
 {
 	task_wait_preparation_context_impl & wait_ctx_impl = *wait_ctx.get();
+	scoped_task_reaper reaper(&m_reaper);
+
+	bool measure = m_pimpl && m_pimpl->metrics.enabled();
+	uint64_t start_ns = measure? win32_monotonic_ns(): 0;
+
+	unsigned epoch = this_thread_preparation_epoch();
 
 	wait_ctx.clear();
+	wait_ctx.set_full_preparation(m_invalidated || epoch != m_prepared_epoch);
+	m_invalidated = false;
+	m_prepared_epoch = epoch;
 	m_parallel_tasks.prepare_wait(wait_ctx);
 
+	uint64_t prepared_ns = measure? win32_monotonic_ns(): 0;
+	uint64_t woken_ns = prepared_ns;
+	size_t poll_items = 0;
+
 	if (wait_ctx_impl.m_finished_tasks)
 	{
 		task_wait_finalization_context finish_ctx;
+		finish_ctx.prep_ctx = &wait_ctx;
 		finish_ctx.finished_tasks = wait_ctx_impl.m_finished_tasks;
 		m_parallel_tasks.finish_wait(finish_ctx);
 	}
@@ -19,12 +64,20 @@ void sync_runner::poll_one(task_wait_preparation_context & wait_ctx)
 	{
 		assert(!wait_ctx_impl.m_handles.empty());
 
+		poll_items = wait_ctx_impl.m_handles.size();
 		DWORD dwRes = WaitForMultipleObjects(wait_ctx_impl.m_handles.size(), wait_ctx_impl.m_handles.data(), FALSE, INFINITE);
 		assert(dwRes >= WAIT_OBJECT_0 && dwRes < WAIT_OBJECT_0 + wait_ctx_impl.m_handles.size());
 
+		if (measure)
+			woken_ns = win32_monotonic_ns();
+
 		task_wait_finalization_context finish_ctx;
+		finish_ctx.prep_ctx = &wait_ctx;
 		finish_ctx.finished_tasks = false;
 		finish_ctx.selected_poll_item = dwRes - WAIT_OBJECT_0;
 		m_parallel_tasks.finish_wait(finish_ctx);
 	}
+
+	if (measure)
+		m_pimpl->metrics.record_iteration(prepared_ns - start_ns, woken_ns - prepared_ns, win32_monotonic_ns() - woken_ns, poll_items);
 }
@@ -0,0 +1,33 @@
+#include "task_node_pool.hpp"
+#include <windows.h>
+using namespace yb;
+using namespace yb::detail;
+
+static __declspec(thread) task_node_cache * g_cache = 0;
+
+static void WINAPI destroy_cache(void * p)
+{
+	if (p)
+	{
+		g_cache = 0;
+		destroy_task_node_cache(static_cast<task_node_cache *>(p));
+	}
+}
+
+static DWORD const g_cache_index = FlsAlloc(&destroy_cache);
+
+task_node_cache * yb::detail::this_thread_task_node_cache() throw()
+{
+	if (!g_cache && g_cache_index != FLS_OUT_OF_INDEXES)
+	{
+		// Without a cache, nodes are allocated from the heap directly.
+		g_cache = create_task_node_cache();
+		if (g_cache && !FlsSetValue(g_cache_index, g_cache))
+		{
+			destroy_task_node_cache(g_cache);
+			g_cache = 0;
+		}
+	}
+
+	return g_cache;
+}
@@ -0,0 +1,17 @@
+#include "task_reaper.hpp"
+using namespace yb;
+using namespace yb::detail;
+
+static __declspec(thread) task_reaper * g_reaper = 0;
+
+task_reaper * yb::detail::this_thread_task_reaper() throw()
+{
+	return g_reaper;
+}
+
+task_reaper * yb::detail::exchange_this_thread_task_reaper(task_reaper * reaper) throw()
+{
+	task_reaper * res = g_reaper;
+	g_reaper = reaper;
+	return res;
+}
@@ -0,0 +1,91 @@
+#include "task_trace_buffer.hpp"
+#include <windows.h>
+#include <stdlib.h>
+using namespace yb;
+using namespace yb::detail;
+
+static __declspec(thread) task_trace_buffer * g_buffer = 0;
+static task_trace_buffer * volatile g_buffers = 0;
+static LONG volatile g_next_thread = 0;
+
+static void WINAPI release_buffer(void * p)
+{
+	if (p)
+	{
+		g_buffer = 0;
+		InterlockedExchange(&static_cast<task_trace_buffer *>(p)->owned, 0);
+	}
+}
+
+static DWORD const g_buffer_index = FlsAlloc(&release_buffer);
+
+static task_trace_buffer * claim_buffer()
+{
+	for (task_trace_buffer * buf = first_task_trace_buffer(); buf; buf = buf->next)
+	{
+		if (InterlockedCompareExchange(&buf->owned, 1, 0) == 0)
+			return buf;
+	}
+
+	// The buffer bypasses `operator new`, so that tracing
+	// doesn't show up in the allocation counts.
+	task_trace_buffer * buf = (task_trace_buffer *)calloc(1, sizeof(task_trace_buffer));
+	if (!buf)
+		return 0;
+
+	buf->owned = 1;
+	for (;;)
+	{
+		task_trace_buffer * next = g_buffers;
+		buf->next = next;
+		if (InterlockedCompareExchangePointer((PVOID volatile *)&g_buffers, buf, next) == next)
+			break;
+	}
+
+	return buf;
+}
+
+task_trace_buffer * yb::detail::this_thread_task_trace_buffer() throw()
+{
+	if (!g_buffer && g_buffer_index != FLS_OUT_OF_INDEXES)
+	{
+		task_trace_buffer * buf = claim_buffer();
+		if (!buf)
+			return 0;
+
+		// The events of the previous owner keep their thread number.
+		buf->thread = InterlockedIncrement(&g_next_thread);
+		if (!FlsSetValue(g_buffer_index, buf))
+		{
+			release_buffer(buf);
+			return 0;
+		}
+
+		g_buffer = buf;
+	}
+
+	return g_buffer;
+}
+
+task_trace_buffer * yb::detail::first_task_trace_buffer() throw()
+{
+	return g_buffers;
+}
+
+void yb::detail::publish_task_trace_head(task_trace_buffer & buf, uint64_t head) throw()
+{
+	InterlockedExchange64((LONGLONG volatile *)&buf.head, head);
+}
+
+uint64_t yb::detail::load_task_trace_head(task_trace_buffer const & buf) throw()
+{
+	return InterlockedCompareExchange64((LONGLONG volatile *)&buf.head, 0, 0);
+}
+
+uint64_t yb::detail::task_trace_clock_ns() throw()
+{
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000 + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}
@@ -3,6 +3,14 @@
 #include <stdexcept>
 using namespace yb;
 
+uint64_t yb::monotonic_time_us()
+{
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
 struct timer::impl
 {
 	HANDLE hTimer;
@@ -21,10 +29,15 @@ timer::~timer()
 	CloseHandle(m_pimpl->hTimer);
 }
 
-task<void> timer::wait_ms(int milliseconds)
+// Waitable timers are absolute only in the system time, which may
+// be adjusted, so the deadline is converted to a relative due time.
+// The slack is not used.
+task<void> timer::wait_until_us(uint64_t deadline_us, uint64_t slack_us)
 {
+	uint64_t now = monotonic_time_us();
+
 	LARGE_INTEGER tout;
-	tout.QuadPart = milliseconds * -10*1000ull;
+	tout.QuadPart = deadline_us > now? -(LONGLONG)(deadline_us - now) * 10: -1;
 	if (!SetWaitableTimer(m_pimpl->hTimer, &tout, 0, 0, 0, FALSE))
 		return async::raise<void>(std::runtime_error("couldn't set the timer"));
 
@@ -40,3 +53,9 @@ task<void> timer::wait_ms(int milliseconds)
 		}
 	});
 }
+
+task<void> yb::wait_until_us(uint64_t deadline_us, uint64_t slack_us)
+{
+	std::shared_ptr<timer> tmr(new timer());
+	return tmr->wait_until_us(deadline_us, slack_us).follow_with([tmr]{});
+}
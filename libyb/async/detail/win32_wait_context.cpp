@@ -1,8 +1,20 @@
 #include "win32_wait_context.hpp"
 using namespace yb;
 
+static __declspec(thread) unsigned g_preparation_epoch = 0;
+
+void yb::detail::invalidate_this_thread_preparations() throw()
+{
+	++g_preparation_epoch;
+}
+
+unsigned yb::detail::this_thread_preparation_epoch() throw()
+{
+	return g_preparation_epoch;
+}
+
 task_wait_preparation_context::task_wait_preparation_context()
-	: m_pimpl(new task_wait_preparation_context_impl())
+	: m_pimpl(new task_wait_preparation_context_impl()), m_full_preparation(false)
 {
 }
 
@@ -14,6 +26,7 @@ void task_wait_preparation_context::clear()
 {
 	m_pimpl->m_handles.clear();
 	m_pimpl->m_finished_tasks = 0;
+	m_pimpl->m_volatile_tasks = 0;
 }
 
 void task_wait_preparation_context::add_poll_item(task_wait_poll_item const & item)
@@ -31,10 +44,30 @@ void task_wait_preparation_context::set_finished()
 	++m_pimpl->m_finished_tasks;
 }
 
+void task_wait_preparation_context::set_volatile()
+{
+	++m_pimpl->m_volatile_tasks;
+}
+
 task_wait_checkpoint task_wait_preparation_context::checkpoint() const
 {
 	task_wait_checkpoint res;
 	res.finished_task_count = m_pimpl->m_finished_tasks;
+	res.volatile_task_count = m_pimpl->m_volatile_tasks;
 	res.poll_item_count = m_pimpl->m_handles.size();
 	return res;
 }
+
+void task_wait_preparation_context::append(task_wait_preparation_context const & sub)
+{
+	task_wait_preparation_context_impl const & sub_impl = *sub.m_pimpl;
+
+	m_pimpl->m_handles.insert(m_pimpl->m_handles.end(), sub_impl.m_handles.begin(), sub_impl.m_handles.end());
+	m_pimpl->m_finished_tasks += sub_impl.m_finished_tasks;
+	m_pimpl->m_volatile_tasks += sub_impl.m_volatile_tasks;
+}
+
+void task_wait_preparation_context::copy_results_to(task_wait_preparation_context &, size_t) const
+{
+	// Handles carry no results besides being selected.
+}
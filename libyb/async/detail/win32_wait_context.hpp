@@ -16,6 +16,7 @@ struct task_wait_preparation_context_impl
 {
 	std::vector<HANDLE> m_handles;
 	size_t m_finished_tasks;
+	size_t m_volatile_tasks;
 };
 
 } // namespace yb
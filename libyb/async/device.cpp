@@ -1,23 +1,125 @@
 #include "device.hpp"
+#include <algorithm>
 using namespace yb;
 
+size_t const device::cmd_limit;
+
+device::device()
+	: m_dispatch_depth(0), m_purge_pending(false)
+{
+}
+
 device::receiver_registration device::register_receiver(packet_handler & r)
 {
-	m_receivers.push_front(&r);
-	return m_receivers.begin();
+	return this->register_receiver(r, 0, cmd_limit);
+}
+
+device::receiver_registration device::register_receiver(packet_handler & r, device_config const & config)
+{
+	return this->register_receiver(r, config.cmd, config.cmd_count);
+}
+
+device::receiver_registration device::register_receiver(packet_handler & r, uint8_t cmd, uint8_t cmd_count)
+{
+	// Commands past the limit are never received.
+	size_t last = (std::min)((size_t)cmd + cmd_count, cmd_limit);
+
+	receiver rec = { &r };
+	m_receivers.push_back(rec);
+	receiver_registration reg = std::prev(m_receivers.end());
+
+	try
+	{
+		for (size_t i = cmd; i < last; ++i)
+			m_dispatch_table[i].push_back(&*reg);
+	}
+	catch (...)
+	{
+		for (size_t i = cmd; i < last; ++i)
+		{
+			if (!m_dispatch_table[i].empty() && m_dispatch_table[i].back() == &*reg)
+				m_dispatch_table[i].pop_back();
+		}
+		m_receivers.erase(reg);
+		throw;
+	}
+
+	return reg;
 }
 
 void device::unregister_receiver(receiver_registration reg)
 {
-	m_receivers.erase(reg);
+	reg->handler = 0;
+	if (m_dispatch_depth)
+		m_purge_pending = true;
+	else
+		this->purge();
+}
+
+void device::purge()
+{
+	struct is_unregistered
+	{
+		bool operator()(receiver const * r) const { return r->handler == 0; }
+		bool operator()(receiver const & r) const { return r.handler == 0; }
+	};
+
+	for (size_t i = 0; i < cmd_limit; ++i)
+	{
+		std::vector<receiver *> & receivers = m_dispatch_table[i];
+		receivers.erase(std::remove_if(receivers.begin(), receivers.end(), is_unregistered()), receivers.end());
+	}
+
+	m_receivers.remove_if(is_unregistered());
+	m_purge_pending = false;
 }
 
+class device::dispatch_scope
+{
+public:
+	explicit dispatch_scope(device & dev)
+		: m_dev(dev)
+	{
+		++m_dev.m_dispatch_depth;
+	}
+
+	~dispatch_scope()
+	{
+		if (--m_dev.m_dispatch_depth == 0 && m_dev.m_purge_pending)
+			m_dev.purge();
+	}
+
+private:
+	device & m_dev;
+};
+
 void device::handle_packet(packet const & p)
 {
-	for (std::list<packet_handler *>::const_iterator it = m_receivers.begin(); it != m_receivers.end();)
+	if (p[0] >= cmd_limit)
+		return;
+
+	dispatch_scope scope(*this);
+	this->dispatch(m_dispatch_table[p[0]], p);
+}
+
+void device::handle_packets(vector_ref<packet> const & packets)
+{
+	dispatch_scope scope(*this);
+	for (size_t i = 0; i < packets.size(); ++i)
+	{
+		packet const & p = packets[i];
+		if (p[0] < cmd_limit)
+			this->dispatch(m_dispatch_table[p[0]], p);
+	}
+}
+
+void device::dispatch(std::vector<receiver *> const & receivers, packet const & p)
+{
+	// The vector may grow while the packet is being handled, but no entry
+	// is removed; the receivers registered in the meantime are skipped.
+	for (size_t i = 0, count = receivers.size(); i != count; ++i)
 	{
-		std::list<packet_handler *>::const_iterator next = std::next(it);
-		(*it)->handle_packet(p);
-		it = next;
+		if (packet_handler * h = receivers[i]->handler)
+			h->handle_packet(p);
 	}
 }
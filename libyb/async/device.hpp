@@ -3,28 +3,66 @@
 
 #include "../packet.hpp"
 #include "../packet_handler.hpp"
+#include "../descriptor.hpp"
 #include "task.hpp"
 #include <list>
+#include <vector>
 
 namespace yb {
 
 class device
 	: protected packet_handler
 {
+	struct receiver
+	{
+		packet_handler * handler;
+	};
+
 public:
-	typedef std::list<packet_handler *>::iterator receiver_registration;
+	typedef std::list<receiver>::iterator receiver_registration;
+
+	// Packets carry a 4-bit command.
+	static size_t const cmd_limit = 16;
 
+	device();
 	virtual ~device() {}
 	virtual task<void> write_packet(packet const & p) = 0;
 
+	// Registers a receiver for all packets.
 	receiver_registration register_receiver(packet_handler & r);
+
+	// Registers a receiver for the packets of the commands
+	// [cmd, cmd + cmd_count) only, e.g. those of an interface.
+	receiver_registration register_receiver(packet_handler & r, uint8_t cmd, uint8_t cmd_count = 1);
+	receiver_registration register_receiver(packet_handler & r, device_config const & config);
+
+	// Receivers can be registered and unregistered while handling
+	// a packet. A receiver registered during the dispatch of a packet
+	// doesn't see that packet.
 	void unregister_receiver(receiver_registration reg);
 
 protected:
 	void handle_packet(packet const & p);
 
+	// Dispatches the packets one after another; each packet reaches
+	// all its receivers before the next one is dispatched.
+	void handle_packets(vector_ref<packet> const & packets);
+
 private:
-	std::list<packet_handler *> m_receivers;
+	class dispatch_scope;
+
+	void dispatch(std::vector<receiver *> const & receivers, packet const & p);
+	void purge();
+
+	std::list<receiver> m_receivers;
+
+	// The receivers of each command, in the order of their registration.
+	std::vector<receiver *> m_dispatch_table[cmd_limit];
+
+	// Unregistered receivers stay in the table until no dispatch
+	// is in progress.
+	size_t m_dispatch_depth;
+	bool m_purge_pending;
 };
 
 } // namespace yb
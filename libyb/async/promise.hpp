@@ -41,7 +41,7 @@ public:
 	task<T> wait_for() const
 	{
 		return protect([this] {
-			return task<T>(new promise_task_impl<T>(m_buffer));
+			return task<T>::make(promise_task_impl<T>(m_buffer));
 		});
 	}
 
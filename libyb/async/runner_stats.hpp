@@ -0,0 +1,87 @@
+#ifndef LIBYB_ASYNC_RUNNER_STATS_HPP
+#define LIBYB_ASYNC_RUNNER_STATS_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace yb {
+
+// A distribution of per-iteration samples. The bucket `i` counts
+// the samples in [2^(i-1), 2^i); the bucket 0 counts zeros.
+struct runner_histogram
+{
+	static size_t const bucket_count = 48;
+
+	uint64_t buckets[bucket_count];
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+
+	double mean() const
+	{
+		return count? double(total) / count: 0;
+	}
+
+	// Returns an upper estimate of the sample below which
+	// the given fraction of the samples lies.
+	uint64_t percentile(double fraction) const
+	{
+		if (count == 0)
+			return 0;
+
+		uint64_t rank = (uint64_t)(fraction * count);
+		if (rank >= count)
+			rank = count - 1;
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; ++i)
+		{
+			seen += buckets[i];
+			if (seen > rank)
+			{
+				uint64_t bound = i == 0? 0: ((uint64_t)1 << i) - 1;
+				return bound < max? bound: max;
+			}
+		}
+
+		return max;
+	}
+};
+
+// A snapshot of a runner's dispatch loop statistics. The counters
+// accumulate from the moment the collection is first enabled.
+struct runner_stats
+{
+	bool enabled;
+
+	// The time since the collection was first enabled.
+	uint64_t elapsed_us;
+
+	uint64_t iterations;
+
+	// The number of iterations woken up by the control event,
+	// i.e. by newly posted tasks or by cancellations.
+	uint64_t control_wakeups;
+
+	// The number of promises posted to the runner that haven't
+	// finished yet; always zero for sync runners.
+	size_t live_promises;
+
+	// The time each iteration spent preparing the tasks, waiting
+	// for their poll items and finalizing them, in nanoseconds.
+	runner_histogram prepare_ns;
+	runner_histogram wait_ns;
+	runner_histogram finish_ns;
+
+	// The number of poll items each iteration waited for.
+	runner_histogram poll_items;
+
+	double iterations_per_second() const
+	{
+		return elapsed_us? iterations * 1e6 / elapsed_us: 0;
+	}
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_RUNNER_STATS_HPP
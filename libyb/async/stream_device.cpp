@@ -1,22 +1,34 @@
 #include "stream_device.hpp"
 #include "task.hpp"
+#include <algorithm>
+#include <stdexcept>
 using namespace yb;
 
-stream_device::stream_device()
-	: m_start_write(channel<void>::create())
+stream_device::stream_device(size_t buffer_size, size_t transfer_size)
+	: m_start_write(channel<void>::create()), m_write_idle(false),
+	m_write_head(0), m_write_size(0), m_transfer_size(transfer_size), m_backlog_accepted(0)
 {
+	// The buffer must hold the longest packet.
+	if (buffer_size < packet::max_size + 1 || transfer_size == 0)
+		throw std::length_error("stream_device buffer is too small");
+
+	m_write_buffer.resize(buffer_size);
 }
 
 task<void> stream_device::write_loop(stream & s)
 {
-	return wait_for(m_start_write).finish_on(cl_quit).then([this, &s] {
-		return s.write_all(m_write_buffer.data(), m_write_buffer.size());
-	}).then([this]() -> task<void> {
-		m_write_buffer.swap(m_write_backlog);
-		m_write_backlog.clear();
-		if (!m_write_buffer.empty())
-			m_start_write.fire();
-		return async::value();
+	if (m_write_size == 0)
+	{
+		// Writers fire the channel only when the loop is idle.
+		m_write_idle = true;
+		return wait_for(m_start_write).finish_on(cl_quit);
+	}
+
+	size_t chunk = (std::min)((std::min)(m_write_size, m_transfer_size), m_write_buffer.size() - m_write_head);
+	return s.write(m_write_buffer.data() + m_write_head, chunk).then([this](size_t r) {
+		m_write_head = (m_write_head + r) % m_write_buffer.size();
+		m_write_size -= r;
+		this->accept_backlog();
 	});
 }
 
@@ -31,8 +43,9 @@ task<void> stream_device::run(stream & s)
 			return s.read(m_read_buffer, sizeof m_read_buffer).abort_on(cl_quit);
 		});
 
+		m_write_idle = false;
 		task<void> write_task = loop([this, &s](cancel_level cl) {
-			return m_write_buffer.empty() && m_write_backlog.empty() && cl >= cl_quit? nulltask: this->write_loop(s);
+			return m_write_size == 0 && cl >= cl_quit? nulltask: this->write_loop(s);
 		});
 
 		return std::move(read_task) | std::move(write_task);
@@ -43,33 +56,77 @@ task<void> stream_device::run(stream & s)
 	}
 }
 
-static void append_packet(std::vector<uint8_t> & out, packet const & p)
+bool stream_device::try_accept(packet const & p)
 {
-	assert(p.size() < 17);
+	assert(!p.empty());
+
+	uint8_t encoded[packet::max_size + 1];
+	size_t size = p.size() + 1;
+	if (size > m_write_buffer.size() - m_write_size)
+		return false;
+
+	encoded[0] = 0x80;
+	encoded[1] = (uint8_t)((p[0] << 4) | (p.size() - 1));
+	std::copy(p.begin() + 1, p.end(), encoded + 2);
+
+	size_t tail = (m_write_head + m_write_size) % m_write_buffer.size();
+	size_t first_part = (std::min)(size, m_write_buffer.size() - tail);
+	std::copy(encoded, encoded + first_part, m_write_buffer.data() + tail);
+	std::copy(encoded + first_part, encoded + size, m_write_buffer.data());
 
-	out.push_back(0x80);
-	out.push_back((uint8_t)((p[0] << 4) | (p.size() - 1)));
-	out.insert(out.end(), p.begin() + 1, p.end());
+	m_write_size += size;
+	if (m_write_idle)
+	{
+		m_write_idle = false;
+		task<void> t = m_start_write.fire();
+		assert(t.has_result());
+		(void)t;
+	}
+
+	return true;
+}
+
+void stream_device::accept_backlog()
+{
+	while (!m_write_backlog.empty() && this->try_accept(m_write_backlog.front()))
+	{
+		m_write_backlog.pop_front();
+		++m_backlog_accepted;
+	}
+
+	while (!m_backlog_waiters.empty() && m_backlog_waiters.front().first <= m_backlog_accepted)
+	{
+		promise<void> accepted = m_backlog_waiters.front().second;
+		m_backlog_waiters.pop_front();
+		accepted.set_value();
+	}
 }
 
 task<void> stream_device::write_packet(packet const & p)
+{
+	return this->write_packets(vector_ref<packet>(&p, 1));
+}
+
+task<void> stream_device::write_packets(vector_ref<packet> const & packets)
 {
 	try
 	{
-		if (m_write_buffer.empty())
-		{
-			append_packet(m_write_buffer, p);
-
-			task<void> t = m_start_write.fire();
-			assert(t.has_result());
-			(void)t;
-		}
-		else
+		// Packets that don't fit and all that follow them go to the backlog,
+		// so that the packets are written in order.
+		size_t i = 0;
+		if (m_write_backlog.empty())
 		{
-			append_packet(m_write_backlog, p);
+			while (i != packets.size() && this->try_accept(packets[i]))
+				++i;
 		}
 
-		return async::value();
+		if (i == packets.size())
+			return async::value();
+
+		promise<void> accepted;
+		m_write_backlog.insert(m_write_backlog.end(), packets.begin() + i, packets.end());
+		m_backlog_waiters.push_back(std::make_pair(m_backlog_accepted + m_write_backlog.size(), accepted));
+		return wait_for(accepted);
 	}
 	catch (...)
 	{
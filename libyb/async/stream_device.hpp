@@ -5,6 +5,7 @@
 #include "stream.hpp"
 #include "../stream_parser.hpp"
 #include "channel.hpp"
+#include "promise.hpp"
 #include <deque>
 
 namespace yb {
@@ -13,19 +14,40 @@ class stream_device
 	: public device
 {
 public:
-	stream_device();
+	// Written packets are queued in a ring buffer of `buffer_size` bytes
+	// and written to the stream in transfers of up to `transfer_size`
+	// bytes, as many packets at once as there are in the buffer.
+	explicit stream_device(size_t buffer_size = 1024, size_t transfer_size = 256);
 
 	task<void> run(stream & s);
+
+	// The returned tasks complete once the packets are accepted
+	// into the buffer; while it's full, the packets wait in line.
+	// Cancelling the task doesn't withdraw the packets.
 	task<void> write_packet(packet const & p);
+	task<void> write_packets(vector_ref<packet> const & packets);
 
 private:
 	uint8_t m_read_buffer[256];
 	stream_parser m_parser;
 
 	channel<void> m_start_write;
-	std::vector<uint8_t> m_write_buffer;
-	std::vector<uint8_t> m_write_backlog;
+	bool m_write_idle;
 
+	std::vector<uint8_t> m_write_buffer;
+	size_t m_write_head;
+	size_t m_write_size;
+	size_t m_transfer_size;
+
+	// Packets waiting for space in the buffer and the promises
+	// of their writers, fulfilled once the given number of backlog
+	// packets is accepted.
+	std::deque<packet> m_write_backlog;
+	std::deque<std::pair<uint64_t, promise<void> > > m_backlog_waiters;
+	uint64_t m_backlog_accepted;
+
+	bool try_accept(packet const & p);
+	void accept_backlog();
 	task<void> write_loop(stream & s);
 };
 
@@ -2,8 +2,12 @@
 #define LIBYB_ASYNC_SYNC_RUNNER_HPP
 
 #include "task.hpp"
+#include "runner_stats.hpp"
+#include "detail/parallel_composition_task.hpp"
+#include "detail/task_reaper.hpp"
 #include <utility> //move
 #include <list>
+#include <memory>
 
 namespace yb {
 
@@ -29,15 +33,8 @@ public:
 			delete this;
 	}
 
-	void cancel(cancel_level cl)
-	{
-		m_task.cancel(cl);
-	}
-
-	void cancel_and_wait()
-	{
-		m_task = async::result(m_task.cancel_and_wait());
-	}
+	void cancel(cancel_level cl);
+	void cancel_and_wait();
 
 	void set_task(task<T> && t)
 	{
@@ -158,9 +155,13 @@ private:
 class sync_runner
 {
 public:
-	~sync_runner()
-	{
-	}
+	sync_runner();
+	~sync_runner();
+
+	// Starts or stops collecting the statistics of the loop
+	// the runner's `run` calls drive.
+	void enable_stats(bool enable = true);
+	runner_stats stats() const;
 
 	template <typename T>
 	sync_future<T> post(task<T> && t)
@@ -178,8 +179,8 @@ public:
 
 			task<void> tt(new promise_task<T>(promise.get()));
 			sync_promise<T> * ppromise = promise.release();
-			m_parallel_tasks |= std::move(tt);
 			ppromise->set_task(std::move(t));
+			this->add_task(std::move(tt));
 			return sync_future<T>(ppromise);
 		}
 		catch (...)
@@ -193,7 +194,7 @@ public:
 	{
 		assert(!t.empty());
 		if (t.has_task())
-			m_parallel_tasks |= std::move(t);
+			this->add_task(std::move(t));
 	}
 
 	template <typename T>
@@ -256,6 +257,45 @@ public:
 private:
 	void poll_one(task_wait_preparation_context & wait_ctx);
 
+	// The posted tasks are always kept in a parallel composition,
+	// which can be finalized for several poll items after a single wait.
+	void add_task(task<void> && t)
+	{
+		if (m_parallel_tasks.has_task())
+			m_parallel_tasks |= std::move(t);
+		else
+			m_parallel_tasks = task<void>(new detail::parallel_composition_task(std::move(t)));
+	}
+
+	// Takes over the tasks that are dropped while the runner
+	// finalizes its tasks, but can't be cancelled right away.
+	class reaper
+		: public detail::task_reaper
+	{
+	public:
+		explicit reaper(sync_runner * runner)
+			: m_runner(runner)
+		{
+		}
+
+		void reap(task<void> && t) throw()
+		{
+			// A failure mustn't drop the task into this reaper again.
+			detail::scoped_task_reaper blocking(0);
+			try
+			{
+				m_runner->add_task(std::move(t));
+			}
+			catch (...)
+			{
+				t.clear();
+			}
+		}
+
+	private:
+		sync_runner * m_runner;
+	};
+
 	template <typename T>
 	class promise_task
 		: public task_base<void>
@@ -301,9 +341,38 @@ private:
 		sync_promise<T> * m_promise;
 	};
 
+	// Holds the platform's wait state, e.g. the timers; declared
+	// before the tasks, which may refer to it.
+	struct impl;
+	std::unique_ptr<impl> m_pimpl;
+
 	task<void> m_parallel_tasks;
+	reaper m_reaper;
+
+	// Set when a promise was changed from the outside of the runner.
+	bool m_invalidated;
+
+	// The thread's preparation epoch at the last preparation.
+	unsigned m_prepared_epoch;
+
+	template <typename T>
+	friend class sync_promise;
 };
 
+template <typename T>
+void sync_promise<T>::cancel(cancel_level cl)
+{
+	m_task.cancel(cl);
+	m_runner->m_invalidated = true;
+}
+
+template <typename T>
+void sync_promise<T>::cancel_and_wait()
+{
+	m_task = async::result(m_task.cancel_and_wait());
+	m_runner->m_invalidated = true;
+}
+
 template <typename T>
 task_result<T> sync_promise<T>::get()
 {
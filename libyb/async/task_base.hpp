@@ -4,6 +4,7 @@
 #include "task_result.hpp"
 #include "detail/task_fwd.hpp"
 #include <memory> // unique_ptr
+#include <cassert>
 
 namespace yb {
 
@@ -33,6 +34,13 @@ public:
 	// A task-based task indicates a continuation.
 	// A result task indicates a completion.
 	virtual task<R> finish_wait(task_wait_finalization_context & ctx) throw() = 0;
+
+private:
+	// Moves the object into the inline storage of another task.
+	// Only objects stored inline are ever relocated.
+	virtual task_base<R> * relocate(void * storage) throw();
+
+	friend class task<R>;
 };
 
 } // namespace yb
@@ -43,6 +51,13 @@ inline task_base_common::~task_base_common()
 {
 }
 
+template <typename R>
+task_base<R> * task_base<R>::relocate(void *) throw()
+{
+	assert(false);
+	return 0;
+}
+
 } // namespace yb
 
 #endif // LIBYB_ASYNC_TASK_BASE_HPP
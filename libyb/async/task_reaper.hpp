@@ -0,0 +1,28 @@
+#ifndef LIBYB_ASYNC_TASK_REAPER_HPP
+#define LIBYB_ASYNC_TASK_REAPER_HPP
+
+#include "detail/task_reaper.hpp"
+
+namespace yb {
+
+// Inside a runner, a task that can't be cancelled right away
+// (e.g. a poll whose canceller refuses to kill it) doesn't block
+// the runner's thread when it's destroyed; its runner finishes it
+// later instead. Within the scope of this object, such tasks
+// block until they complete, as they do outside of runners.
+class scoped_blocking_teardown
+	: noncopyable
+{
+public:
+	scoped_blocking_teardown() throw()
+		: m_reaper(0)
+	{
+	}
+
+private:
+	detail::scoped_task_reaper m_reaper;
+};
+
+} // namespace yb
+
+#endif // LIBYB_ASYNC_TASK_REAPER_HPP
@@ -0,0 +1,87 @@
+#ifndef LIBYB_ASYNC_TASK_TRACE_HPP
+#define LIBYB_ASYNC_TASK_TRACE_HPP
+
+#include "cancel_level.hpp"
+#include <vector>
+#include <iosfwd>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace yb {
+
+enum task_trace_kind
+{
+	ttk_created,
+	ttk_prepared,
+	ttk_finalized,
+	ttk_continued,
+	ttk_cancelled,
+	ttk_completed,
+	ttk_relocated
+};
+
+struct task_trace_event
+{
+	// The time in nanoseconds of a monotonic clock and a small
+	// number identifying the recording thread.
+	uint64_t time_ns;
+	unsigned thread;
+
+	task_trace_kind kind;
+
+	// The address of the task object. Inline tasks change their address
+	// when their owner is moved, which is recorded as `ttk_relocated`.
+	void const * task;
+
+	// The new address of a relocated task or the task a finalized one
+	// continues with. Loop iterations are recorded as `ttk_continued`
+	// with no continuation.
+	void const * other;
+
+	// The implementation type name of a created task.
+	char const * type;
+
+	// The level of a cancellation.
+	cancel_level cl;
+
+	// Set if a completed task failed with an exception.
+	bool failed;
+};
+
+// The tracer records the lifecycle of every task into a ring buffer
+// of the calling thread; each thread keeps its last `task_trace_capacity`
+// events. Recording takes no locks, and while the tracer is disabled,
+// each task operation only checks a flag.
+static size_t const task_trace_capacity = 8192;
+
+void enable_task_trace(bool enable = true);
+
+// Drops the events recorded so far.
+void clear_task_trace();
+
+// Returns the events still held by the ring buffers, ordered by time.
+std::vector<task_trace_event> collect_task_trace();
+
+// Writes the events in the Chrome trace-event format, which both
+// chrome://tracing and the Perfetto UI can open. Each task is shown
+// as an async slice from its creation until it completes or continues
+// with another task; the other events are instants on the slice.
+void write_task_trace(std::ostream & out, std::vector<task_trace_event> const & events);
+void write_task_trace(std::ostream & out);
+
+namespace detail {
+
+extern bool g_task_trace_enabled;
+
+inline bool task_trace_enabled()
+{
+	return *static_cast<bool const volatile *>(&g_task_trace_enabled);
+}
+
+void record_task_trace(task_trace_kind kind, void const * task, void const * other = 0,
+	char const * type = 0, cancel_level cl = cl_none, bool failed = false) throw();
+
+} // namespace detail
+} // namespace yb
+
+#endif // LIBYB_ASYNC_TASK_TRACE_HPP
@@ -1,8 +1,24 @@
 #include "timer.hpp"
 using namespace yb;
 
+task<void> timer::wait_ms(int milliseconds)
+{
+	assert(milliseconds > 0);
+	return this->wait_us((uint64_t)milliseconds * 1000);
+}
+
+task<void> timer::wait_us(uint64_t duration_us, uint64_t slack_us)
+{
+	return this->wait_until_us(monotonic_time_us() + duration_us, slack_us);
+}
+
 task<void> yb::wait_ms(int milliseconds)
 {
-	std::shared_ptr<timer> tmr(new timer());
-	return tmr->wait_ms(milliseconds).follow_with([tmr]{});
+	assert(milliseconds > 0);
+	return yb::wait_us((uint64_t)milliseconds * 1000);
+}
+
+task<void> yb::wait_us(uint64_t duration_us, uint64_t slack_us)
+{
+	return yb::wait_until_us(monotonic_time_us() + duration_us, slack_us);
 }
@@ -3,9 +3,13 @@
 
 #include "task.hpp"
 #include <memory>
+#include <stdint.h>
 
 namespace yb {
 
+// Returns the time of the monotonic clock the timers use, in microseconds.
+uint64_t monotonic_time_us();
+
 class timer
 {
 public:
@@ -14,6 +18,12 @@ public:
 
 	task<void> wait_ms(int milliseconds);
 
+	// Completes once the monotonic clock reaches `deadline_us`.
+	// The completion may be delayed by up to `slack_us`, which lets
+	// the runner serve timers with nearby deadlines by a single wakeup.
+	task<void> wait_until_us(uint64_t deadline_us, uint64_t slack_us = 0);
+	task<void> wait_us(uint64_t duration_us, uint64_t slack_us = 0);
+
 private:
 	struct impl;
 	std::unique_ptr<impl> m_pimpl;
@@ -23,6 +33,8 @@ private:
 };
 
 task<void> wait_ms(int milliseconds);
+task<void> wait_until_us(uint64_t deadline_us, uint64_t slack_us = 0);
+task<void> wait_us(uint64_t duration_us, uint64_t slack_us = 0);
 
 } // namespace yb
 
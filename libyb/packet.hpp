@@ -2,7 +2,9 @@
 #define LIBYB_PACKET_HPP
 
 #include <stdint.h>
+#include <stdexcept>
 #include <vector>
+#include <algorithm>
 #include "vector_ref.hpp"
 
 namespace yb {
@@ -11,7 +13,92 @@ namespace yb {
 // UART-based Shupito devices limit the length of the packet to 16-bytes
 // (including the command byte) and the value of the first byte
 // must be no greater than 15.
-typedef std::vector<uint8_t> packet;
+//
+// The bytes are stored inline, so that packets can be received,
+// passed around and built without touching the heap.
+class packet
+{
+public:
+	typedef uint8_t value_type;
+	typedef uint8_t * iterator;
+	typedef uint8_t const * const_iterator;
+
+	static size_t const max_size = 16;
+
+	packet()
+		: m_size(0)
+	{
+	}
+
+	packet(size_t size, uint8_t value)
+		: m_size(0)
+	{
+		this->resize(size, value);
+	}
+
+	packet(uint8_t const * first, uint8_t const * last)
+		: m_size(0)
+	{
+		this->append(first, last);
+	}
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	uint8_t * data() { return m_data; }
+	uint8_t const * data() const { return m_data; }
+
+	iterator begin() { return m_data; }
+	iterator end() { return m_data + m_size; }
+	const_iterator begin() const { return m_data; }
+	const_iterator end() const { return m_data + m_size; }
+
+	uint8_t & operator[](size_t i) { return m_data[i]; }
+	uint8_t const & operator[](size_t i) const { return m_data[i]; }
+
+	void clear()
+	{
+		m_size = 0;
+	}
+
+	void resize(size_t size, uint8_t value = 0)
+	{
+		if (size > max_size)
+			throw std::length_error("packet too long");
+		if (size > m_size)
+			std::fill(m_data + m_size, m_data + size, value);
+		m_size = (uint8_t)size;
+	}
+
+	void push_back(uint8_t b)
+	{
+		if (m_size == max_size)
+			throw std::length_error("packet too long");
+		m_data[m_size++] = b;
+	}
+
+	void append(uint8_t const * first, uint8_t const * last)
+	{
+		if ((size_t)(last - first) > max_size - m_size)
+			throw std::length_error("packet too long");
+		std::copy(first, last, m_data + m_size);
+		m_size += (uint8_t)(last - first);
+	}
+
+	friend bool operator==(packet const & lhs, packet const & rhs)
+	{
+		return lhs.m_size == rhs.m_size && std::equal(lhs.begin(), lhs.end(), rhs.begin());
+	}
+
+	friend bool operator!=(packet const & lhs, packet const & rhs)
+	{
+		return !(lhs == rhs);
+	}
+
+private:
+	uint8_t m_size;
+	uint8_t m_data[max_size];
+};
 
 namespace detail {
 
@@ -32,13 +119,13 @@ public:
 	packet_builder & operator%(string_ref const & s)
 	{
 		uint8_t const * p = reinterpret_cast<uint8_t const *>(s.data());
-		m_packet.insert(m_packet.end(), p, p + s.size());
+		m_packet.append(p, p + s.size());
 		return *this;
 	}
 
 	packet_builder & operator%(buffer_ref const & s)
 	{
-		m_packet.insert(m_packet.end(), s.data(), s.data() + s.size());
+		m_packet.append(s.data(), s.data() + s.size());
 		return *this;
 	}
 
@@ -17,6 +17,15 @@ public:
 	{
 		this->handle_packet(p);
 	}
+
+	// Receives the packets parsed from a single read. Handlers can
+	// override this to avoid a call per packet; by default, the packets
+	// are handled one at a time.
+	virtual void handle_packets(vector_ref<packet> const & packets)
+	{
+		for (size_t i = 0; i < packets.size(); ++i)
+			this->handle_packet(packets[i]);
+	}
 };
 
 } // namespace yb
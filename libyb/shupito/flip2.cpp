@@ -1,4 +1,5 @@
 #include "flip2.hpp"
+#include "../async/coroutine.hpp"
 #include <cassert>
 #include <stdexcept>
 using namespace yb;
@@ -105,6 +106,8 @@ static task<size_t> read_memory_range(usb_device & dev, flip2::offset_t offset,
 	});
 }
 
+#ifndef LIBYB_ASYNC_HAS_COROUTINES
+
 static task<void> write_memory_range(usb_device & dev, flip2::offset_t offset, uint8_t const * buffer, size_t size, size_t packet_size)
 {
 	assert(!dev.empty());
@@ -124,6 +127,8 @@ static task<void> write_memory_range(usb_device & dev, flip2::offset_t offset, u
 	return dev.control_write(usbcc_download, 0, 0, ctx->data(), ctx->size());
 }
 
+#endif // LIBYB_ASYNC_HAS_COROUTINES
+
 static task<flip_status_t> get_status(usb_device & dev)
 {
 	std::shared_ptr<std::vector<uint8_t>> ctx = std::make_shared<std::vector<uint8_t>>(std::vector<uint8_t>(6));
@@ -221,6 +226,8 @@ task<void> flip2::chip_erase()
 	});
 }
 
+#ifndef LIBYB_ASYNC_HAS_COROUTINES
+
 static task<void> write_memory_loop(usb_device & dev, flip2::offset_t address, uint8_t const * buffer, size_t size, size_t packet_size)
 {
 	return loop_with_state<void, size_t>(async::value(), 0, [&dev, address, buffer, size, packet_size](size_t & st, cancel_level cl) -> task<void> {
@@ -250,6 +257,62 @@ task<void> flip2::write_memory(memory_id_t mem, offset_t offset, uint8_t const *
 	});
 }
 
+#else
+
+task<void> flip2::write_memory(memory_id_t mem, offset_t offset, uint8_t const * buffer, size_t size)
+{
+	assert(!m_device.empty());
+
+	uint8_t cmd[6] = { flipcc_select_memory.group, flipcc_select_memory.command };
+	if (!m_mem_page_selected || m_current_mem_id != mem)
+	{
+		cmd[2] = 0;
+		cmd[3] = (uint8_t)mem;
+		co_await m_device.control_write(usbcc_download, 0, 0, cmd, 4);
+	}
+
+	m_current_mem_id = mem;
+
+	uint16_t page = (uint16_t)(offset >> 16);
+	if (!m_mem_page_selected || m_current_page != page)
+	{
+		cmd[2] = 1;
+		cmd[3] = (uint8_t)(page >> 8);
+		cmd[4] = (uint8_t)page;
+		cmd[5] = 0;
+		co_await m_device.control_write(usbcc_download, 0, 0, cmd, 6);
+	}
+
+	m_current_page = page;
+	m_mem_page_selected = true;
+
+	// The packet buffer lives in the frame and is reused for every chunk.
+	std::vector<uint8_t> packet(m_packet_size + (std::min)(size, (size_t)1024));
+	packet[0] = flipcc_write_memory.group;
+	packet[1] = flipcc_write_memory.command;
+
+	for (size_t done = 0; done != size;)
+	{
+		cancel_level cl = co_await current_cancel_level;
+		if (cl >= cl_abort)
+			throw task_cancelled(cl);
+
+		size_t chunk = (std::min)(size - done, (size_t)1024);
+		offset_t first = offset + done;
+		offset_t last = first + chunk - 1;
+		packet[2] = (uint8_t)(first >> 8);
+		packet[3] = (uint8_t)first;
+		packet[4] = (uint8_t)(last >> 8);
+		packet[5] = (uint8_t)last;
+		std::copy(buffer + done, buffer + done + chunk, packet.data() + m_packet_size);
+
+		co_await m_device.control_write(usbcc_download, 0, 0, packet.data(), m_packet_size + chunk);
+		done += chunk;
+	}
+}
+
+#endif // LIBYB_ASYNC_HAS_COROUTINES
+
 task<void> flip2::start_application()
 {
 	assert(!m_device.empty());
@@ -1,65 +1,82 @@
 #include "stream_parser.hpp"
 #include "utils/noncopyable.hpp"
+#include <algorithm>
 #include <utility> // move
+#include <string.h>
 using namespace yb;
 
 stream_parser::stream_parser()
-	: m_packet_pos(0)
+	: m_packet_pos(0), m_batch_size(0)
 {
 }
 
 void stream_parser::parse(packet_handler & h, buffer_ref const & buffer)
 {
-	size_t r = buffer.size();
+	uint8_t const * first = buffer.begin();
+	uint8_t const * last = buffer.end();
 
-	for (size_t i = 0; i < r; )
+	while (first != last)
 	{
-		switch (m_packet_pos)
+		if (m_packet_pos == 0)
 		{
-		case 0:
-			while (buffer[i] != 0x80 && i < r)
-				++i;
-			if (i < r)
-			{
-				m_packet_pos = 1;
-				++i;
-			}
-			break;
+			// The C library scans for the sync byte a vector at a time.
+			first = static_cast<uint8_t const *>(memchr(first, 0x80, last - first));
+			if (!first)
+				break;
 
-		case 1:
-			m_partial_packet.resize((buffer[i] & 0xf) + 1);
-			m_partial_packet[0] = buffer[i] >> 4;
-			++i;
-			++m_packet_pos;
+			++first;
+			m_packet_pos = 1;
+			continue;
+		}
 
-			if (m_partial_packet.size() == 1)
-			{
-				h.handle_packet(std::move(m_partial_packet));
-				m_partial_packet.clear();
-				m_packet_pos = 0;
-				break;
-			}
+		packet & p = m_batch[m_batch_size];
+		if (m_packet_pos == 1)
+		{
+			p.resize((*first & 0xf) + 1);
+			p[0] = *first >> 4;
+			++first;
+			++m_packet_pos;
+		}
+		else
+		{
+			size_t chunk = (std::min)((size_t)(last - first), p.size() + 1 - m_packet_pos);
+			std::copy(first, first + chunk, p.data() + m_packet_pos - 1);
+			first += chunk;
+			m_packet_pos += chunk;
+		}
 
-			// fallthrough
+		if (m_packet_pos == p.size() + 1)
+		{
+			m_packet_pos = 0;
+			if (++m_batch_size == max_batch)
+				this->flush(h);
+		}
+	}
 
-		default:
-			while (i < r)
-			{
-				m_partial_packet[m_packet_pos-1] = buffer[i];
-				++i;
+	this->flush(h);
+}
 
-				if (m_packet_pos == m_partial_packet.size())
-				{
-					h.handle_packet(std::move(m_partial_packet));
-					m_partial_packet.clear();
-					m_packet_pos = 0;
-					break;
-				}
+void stream_parser::flush(packet_handler & h)
+{
+	size_t count = m_batch_size;
+	if (count == 0)
+		return;
 
-				++m_packet_pos;
-			}
-		}
+	m_batch_size = 0;
+	try
+	{
+		h.handle_packets(vector_ref<packet>(m_batch, count));
+	}
+	catch (...)
+	{
+		// The packet being parsed must survive a throwing handler.
+		if (m_packet_pos != 0)
+			m_batch[0] = m_batch[count];
+		throw;
 	}
+
+	if (m_packet_pos != 0)
+		m_batch[0] = m_batch[count];
 }
 
 void stream_parser::parse(std::vector<packet> & out, buffer_ref const & buffer)
@@ -73,9 +90,9 @@ void stream_parser::parse(std::vector<packet> & out, buffer_ref const & buffer)
 		{
 		}
 
-		void handle_packet(packet const & p)
+		void handle_packets(vector_ref<packet> const & packets)
 		{
-			m_out.push_back(p);
+			m_out.insert(m_out.end(), packets.begin(), packets.end());
 		}
 
 	private:
@@ -12,11 +12,21 @@ public:
 	stream_parser();
 
 	void parse(std::vector<packet> & out, buffer_ref const & buffer);
+
+	// Hands the packets completed by the buffer over to `handle_packets`
+	// in batches of up to `max_batch` packets; usually a single batch.
 	void parse(packet_handler & handler, buffer_ref const & buffer);
 
+	static size_t const max_batch = 64;
+
 private:
+	void flush(packet_handler & handler);
+
 	size_t m_packet_pos;
-	packet m_partial_packet;
+
+	// The completed packets are followed by the one being parsed.
+	packet m_batch[max_batch + 1];
+	size_t m_batch_size;
 };
 
 } // namespace yb
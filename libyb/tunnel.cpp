@@ -21,7 +21,7 @@ bool tunnel_handler::attach(device & dev, device_descriptor const & desc)
 		return false;
 
 	m_dev = &dev;
-	m_reg = m_dev->register_receiver(*this);
+	m_reg = m_dev->register_receiver(*this, m_config.cmd);
 	return true;
 }
 
@@ -47,9 +47,6 @@ task<tunnel_handler::tunnel_list_t> tunnel_handler::list_tunnels()
 
 void tunnel_handler::handle_packet(packet const & p)
 {
-	if (p[0] != m_config.cmd)
-		return;
-
 	if (p.size() >= 3 && p[1] == 0 && p[2] == 0)
 	{
 		tunnel_list_t tl = tunnel_handler::parse_tunnel_list(p);
@@ -32,7 +32,7 @@ static task<void> dispatch_loop(std::shared_ptr<usb_device_core> const & core)
 {
 	// FIXME: The loop must be nothrow as it is in the cancel path
 	// for other requests. Find a way to do this somehow.
-	return make_linux_pollfd_task(core->fd.get(), POLLOUT, [](cancel_level cl) {
+	return make_linux_pollfd_task(core, core->fd.get(), POLLOUT, [](cancel_level cl) {
 		return cl < cl_quit;
 	}).then([core](short revents) -> task<void> {
 		if (revents & POLLOUT)
@@ -0,0 +1,529 @@
+#include "test.h"
+#include <libyb/async/async_runner.hpp>
+#include <libyb/async/sync_runner.hpp>
+#include <libyb/async/channel.hpp>
+#include <libyb/async/concurrent_channel.hpp>
+#include <libyb/async/task_trace.hpp>
+#include <libyb/async/serial_port.hpp>
+#include <libyb/async/task_base.hpp>
+#include <libyb/async/timer.hpp>
+#include <libyb/stream_parser.hpp>
+#include <vector>
+#include <string>
+#include <memory>
+#include <stdio.h>
+
+// Counts the iterations of the runner it's posted to; it's prepared
+// once per iteration without ever getting finalized.
+class iteration_counter_task
+	: public yb::task_base<void>
+{
+public:
+	explicit iteration_counter_task(size_t & counter)
+		: m_counter(counter), m_cancelled(false)
+	{
+	}
+
+	void cancel(yb::cancel_level) throw()
+	{
+		m_cancelled = true;
+	}
+
+	yb::task_result<void> cancel_and_wait() throw()
+	{
+		return yb::task_result<void>();
+	}
+
+	void prepare_wait(yb::task_wait_preparation_context & ctx)
+	{
+		__atomic_add_fetch(&m_counter, 1, __ATOMIC_RELAXED);
+		if (m_cancelled)
+			ctx.set_finished();
+		else
+			ctx.set_volatile();
+	}
+
+	yb::task<void> finish_wait(yb::task_wait_finalization_context &) throw()
+	{
+		return yb::async::value();
+	}
+
+private:
+	size_t & m_counter;
+	bool m_cancelled;
+};
+
+#ifdef __linux__
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+
+static yb::task<void> read_forever(yb::serial_port & port, uint8_t * buffer, size_t & completed)
+{
+	return port.read(buffer, 1).then([&port, buffer, &completed](size_t) {
+		__atomic_add_fetch(&completed, 1, __ATOMIC_RELAXED);
+		return read_forever(port, buffer, completed);
+	});
+}
+
+static void bench_wakeups_per_io(char const * name, yb::runner_backend_t backend)
+{
+	static size_t const reader_count = 16;
+	static size_t const burst_count = 2000;
+
+	yb::async_runner runner(backend);
+
+	// All readers open the same fifo, so that a single write
+	// makes all of them ready at once.
+	std::string path = "/tmp/libyb-bench-fifo-" + std::to_string((long long)getpid());
+	unlink(path.c_str());
+	int r = mkfifo(path.c_str(), 0600);
+	assert(r == 0);
+
+	std::vector<std::unique_ptr<yb::serial_port> > ports;
+	for (size_t i = 0; i < reader_count; ++i)
+	{
+		ports.push_back(std::unique_ptr<yb::serial_port>(new yb::serial_port()));
+		runner.run(ports[i]->open(path, 115200));
+	}
+
+	int writer = open(path.c_str(), O_WRONLY | O_NONBLOCK);
+	assert(writer != -1);
+	unlink(path.c_str());
+
+	size_t completed = 0;
+	uint8_t buf[reader_count];
+	std::vector<yb::async_future<void> > readers;
+	for (size_t i = 0; i < reader_count; ++i)
+		readers.push_back(runner.post(read_forever(*ports[i], buf + i, completed)));
+
+	size_t iterations = 0;
+	yb::async_future<void> counter = runner.post(yb::task<void>(new iteration_counter_task(iterations)));
+	runner.run(yb::async::value());
+
+	uint8_t burst_data[reader_count] = {};
+
+	size_t first_iteration = __atomic_load_n(&iterations, __ATOMIC_RELAXED);
+	for (size_t burst = 1; burst <= burst_count; ++burst)
+	{
+		r = write(writer, burst_data, sizeof burst_data);
+		assert(r == sizeof burst_data);
+
+		while (__atomic_load_n(&completed, __ATOMIC_RELAXED) != burst * reader_count)
+			sched_yield();
+	}
+	size_t last_iteration = __atomic_load_n(&iterations, __ATOMIC_RELAXED);
+
+	counter.wait(yb::cl_abort);
+	for (size_t i = 0; i < reader_count; ++i)
+		readers[i].wait(yb::cl_abort);
+	close(writer);
+
+	printf("%s: %.3f wakeups per completed read\n", name, double(last_iteration - first_iteration) / (reader_count * burst_count));
+}
+
+TEST_CASE(WakeupsPerIo, "+bench")
+{
+	bench_wakeups_per_io("poll", yb::rb_poll);
+	bench_wakeups_per_io("epoll", yb::rb_epoll);
+	bench_wakeups_per_io("io_uring", yb::rb_io_uring);
+}
+
+// Counts its completions; finishes as soon as it's prepared.
+class completion_counter_task
+	: public yb::task_base<void>
+{
+public:
+	explicit completion_counter_task(size_t & counter)
+		: m_counter(counter)
+	{
+	}
+
+	void cancel(yb::cancel_level) throw()
+	{
+	}
+
+	yb::task_result<void> cancel_and_wait() throw()
+	{
+		return yb::task_result<void>();
+	}
+
+	void prepare_wait(yb::task_wait_preparation_context & ctx)
+	{
+		ctx.set_finished();
+	}
+
+	yb::task<void> finish_wait(yb::task_wait_finalization_context &) throw()
+	{
+		__atomic_add_fetch(&m_counter, 1, __ATOMIC_RELAXED);
+		return yb::async::value();
+	}
+
+private:
+	size_t & m_counter;
+};
+
+static size_t const posts_per_producer = 50000;
+
+struct post_producer
+{
+	yb::async_runner * runner;
+	size_t * completed;
+	std::vector<yb::async_future<void> > futures;
+};
+
+static void * post_producer_thread(void * ctx)
+{
+	post_producer * p = (post_producer *)ctx;
+	p->futures.reserve(posts_per_producer);
+	for (size_t i = 0; i < posts_per_producer; ++i)
+		p->futures.push_back(p->runner->post(yb::task<void>(new completion_counter_task(*p->completed))));
+	return 0;
+}
+
+static double monotonic_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_post_throughput(char const * name, yb::runner_backend_t backend, size_t producer_count)
+{
+	yb::async_runner runner(backend);
+
+	size_t completed = 0;
+	std::vector<post_producer> producers(producer_count);
+	std::vector<pthread_t> threads(producer_count);
+
+	double start = monotonic_seconds();
+	for (size_t i = 0; i < producer_count; ++i)
+	{
+		producers[i].runner = &runner;
+		producers[i].completed = &completed;
+		int r = pthread_create(&threads[i], 0, &post_producer_thread, &producers[i]);
+		assert(r == 0);
+	}
+
+	for (size_t i = 0; i < producer_count; ++i)
+		pthread_join(threads[i], 0);
+	double posted = monotonic_seconds();
+
+	while (__atomic_load_n(&completed, __ATOMIC_RELAXED) != producer_count * posts_per_producer)
+		sched_yield();
+	double finished = monotonic_seconds();
+
+	size_t total = producer_count * posts_per_producer;
+	printf("%s, %d producers: %.0f posts/s, %.0f completions/s\n", name, (int)producer_count,
+		total / (posted - start), total / (finished - start));
+}
+
+TEST_CASE(PostThroughput, "+bench")
+{
+	static size_t const producer_counts[] = { 1, 2, 4, 8 };
+	for (size_t i = 0; i < sizeof producer_counts / sizeof producer_counts[0]; ++i)
+	{
+		bench_post_throughput("poll", yb::rb_poll, producer_counts[i]);
+		bench_post_throughput("epoll", yb::rb_epoll, producer_counts[i]);
+	}
+}
+
+static void bench_cancel_throughput(char const * name, yb::runner_backend_t backend)
+{
+	static size_t const promise_count = 20000;
+
+	yb::async_runner runner(backend);
+
+	std::vector<yb::async_future<void> > futures;
+	futures.reserve(promise_count);
+	for (size_t i = 0; i < promise_count; ++i)
+		futures.push_back(runner.post(yb::wait_ms(1000000)));
+	runner.run(yb::async::value());
+
+	double start = monotonic_seconds();
+	for (size_t i = 0; i < promise_count; ++i)
+		futures[i].cancel(yb::cl_abort);
+	for (size_t i = 0; i < promise_count; ++i)
+		futures[i].wait();
+	double finished = monotonic_seconds();
+
+	printf("%s: %.0f cancels/s\n", name, promise_count / (finished - start));
+}
+
+TEST_CASE(CancelThroughput, "+bench")
+{
+	bench_cancel_throughput("poll", yb::rb_poll);
+	bench_cancel_throughput("epoll", yb::rb_epoll);
+}
+
+static double bench_loop_iterations(size_t iteration_count)
+{
+	size_t completed = 0;
+
+	double start = monotonic_seconds();
+	yb::sync_runner().run(yb::loop([&completed, iteration_count](yb::cancel_level) -> yb::task<void> {
+		if (completed == iteration_count)
+			return yb::nulltask;
+		return yb::task<void>(new completion_counter_task(completed));
+	}));
+
+	return iteration_count / (monotonic_seconds() - start);
+}
+
+static yb::task<void> count_completions(size_t & completed, size_t count)
+{
+	return yb::loop([&completed, count](yb::cancel_level) mutable -> yb::task<void> {
+		if (count == 0)
+			return yb::nulltask;
+		--count;
+		return yb::task<void>(new completion_counter_task(completed));
+	});
+}
+
+TEST_CASE(ParallelFanIn, "+bench")
+{
+	static size_t const task_counts[] = { 10, 100, 1000 };
+	static size_t const iteration_count = 200000;
+
+	for (size_t i = 0; i < sizeof task_counts / sizeof task_counts[0]; ++i)
+	{
+		size_t task_count = task_counts[i];
+		size_t completed = 0;
+
+		double start = monotonic_seconds();
+		yb::task<void> t;
+		for (size_t j = 0; j < task_count; ++j)
+			t |= count_completions(completed, iteration_count / task_count);
+		yb::sync_runner().run(std::move(t));
+		double composed = monotonic_seconds() - start;
+
+		start = monotonic_seconds();
+		std::vector<yb::task<void> > tasks;
+		for (size_t j = 0; j < task_count; ++j)
+			tasks.push_back(count_completions(completed, iteration_count / task_count));
+		yb::sync_runner().run(yb::when_all(std::move(tasks)));
+		double all = monotonic_seconds() - start;
+
+		printf("%d tasks: operator|= %.0f completions/s, when_all %.0f completions/s\n", (int)task_count,
+			iteration_count / composed, iteration_count / all);
+	}
+}
+
+TEST_CASE(TaskTraceOverhead, "+bench")
+{
+	static size_t const iteration_count = 500000;
+
+	double untraced = bench_loop_iterations(iteration_count);
+
+	yb::enable_task_trace();
+	double traced = bench_loop_iterations(iteration_count);
+	yb::enable_task_trace(false);
+
+	printf("untraced: %.0f iterations/s\ntraced: %.0f iterations/s\n", untraced, traced);
+}
+
+template <typename Channel>
+static double bench_channel_transfer(Channel const & ch, size_t batch_size)
+{
+	static size_t const value_count = 1000000;
+
+	size_t sent = 0;
+	size_t received = 0;
+
+	double start = monotonic_seconds();
+	yb::task<void> producer = yb::loop([&ch, &sent, batch_size](yb::cancel_level) -> yb::task<void> {
+		if (sent == value_count)
+			return yb::nulltask;
+
+		if (batch_size == 1)
+			return ch.send(sent++);
+
+		std::vector<size_t> batch;
+		for (size_t i = 0; i < batch_size; ++i)
+			batch.push_back(sent++);
+		return ch.send_many(std::move(batch));
+	});
+
+	yb::task<void> consumer = yb::loop([&ch, &received, batch_size](yb::cancel_level) -> yb::task<void> {
+		if (received == value_count)
+			return yb::nulltask;
+
+		if (batch_size == 1)
+			return ch.receive().then([&received](size_t) { ++received; });
+		return ch.receive_many(batch_size).then([&received](std::vector<size_t> const & batch) { received += batch.size(); });
+	});
+
+	yb::sync_runner().run(std::move(producer) | std::move(consumer));
+	return value_count / (monotonic_seconds() - start);
+}
+
+TEST_CASE(ChannelBatch, "+bench")
+{
+	static size_t const batch_sizes[] = { 1, 16, 64 };
+	for (size_t i = 0; i < sizeof batch_sizes / sizeof batch_sizes[0]; ++i)
+	{
+		double fixed = bench_channel_transfer(yb::channel<size_t, 256>::create(), batch_sizes[i]);
+		double dynamic = bench_channel_transfer(yb::channel<size_t, yb::dynamic_capacity>::create(256), batch_sizes[i]);
+		printf("batch %d: fixed %.0f values/s, dynamic %.0f values/s\n", (int)batch_sizes[i], fixed, dynamic);
+	}
+}
+
+template <typename Channel>
+static void * channel_sender_thread(void * ctx)
+{
+	Channel & ch = *(Channel *)ctx;
+	size_t next = 0;
+	yb::sync_runner().run(yb::loop([&ch, &next](yb::cancel_level) -> yb::task<void> {
+		if (next == 1000000)
+			return yb::nulltask;
+		return ch.send(next++);
+	}));
+	return 0;
+}
+
+template <typename Channel>
+static void bench_channel_handoff(char const * name)
+{
+	static size_t const value_count = 1000000;
+
+	Channel ch = Channel::create(256);
+	yb::async_runner runner;
+
+	double start = monotonic_seconds();
+	pthread_t thread;
+	int r = pthread_create(&thread, 0, &channel_sender_thread<Channel>, &ch);
+	assert(r == 0);
+
+	size_t received = 0;
+	runner.run(yb::loop([&ch, &received](yb::cancel_level) -> yb::task<void> {
+		if (received == value_count)
+			return yb::nulltask;
+		return ch.receive().then([&received](size_t) { ++received; });
+	}));
+	pthread_join(thread, 0);
+
+	printf("%s: %.0f values/s\n", name, value_count / (monotonic_seconds() - start));
+}
+
+TEST_CASE(ChannelHandoff, "+bench")
+{
+	bench_channel_handoff<yb::concurrent_channel<size_t> >("mpmc");
+	bench_channel_handoff<yb::concurrent_channel<size_t, yb::cc_spsc> >("spsc");
+}
+
+// Runs a chain of `length` continuations, each of which waits
+// for a value; returns the seconds per stage.
+static double bench_chain_stage(size_t length)
+{
+	yb::channel<int> ch = yb::channel<int>::create();
+	yb::task<int> t = ch.receive();
+	for (size_t i = 0; i < length; ++i)
+		t = t.then([&ch](int) { return ch.receive(); });
+
+	yb::sync_runner runner;
+	size_t sent = 0;
+
+	double start = monotonic_seconds();
+	runner.post_detached(yb::loop([&ch, &sent, length](yb::cancel_level) -> yb::task<void> {
+		if (sent == length + 1)
+			return yb::nulltask;
+		++sent;
+		return ch.send(1);
+	}));
+	runner.run(std::move(t));
+	return (monotonic_seconds() - start) / (length + 1);
+}
+
+TEST_CASE(ChainDepth, "+bench")
+{
+	static size_t const lengths[] = { 1, 16, 256, 4096, 65536 };
+	for (size_t i = 0; i < sizeof lengths / sizeof lengths[0]; ++i)
+		printf("chain of %d: %.0f ns per stage\n", (int)lengths[i], bench_chain_stage(lengths[i]) * 1e9);
+}
+
+class packet_counter
+	: public yb::packet_handler
+{
+public:
+	packet_counter()
+		: count(0), bytes(0)
+	{
+	}
+
+	void handle_packet(yb::packet const & p)
+	{
+		++count;
+		bytes += p.size();
+	}
+
+	size_t count;
+	size_t bytes;
+};
+
+class packet_batch_counter
+	: public packet_counter
+{
+public:
+	void handle_packets(yb::vector_ref<yb::packet> const & packets)
+	{
+		count += packets.size();
+		for (size_t i = 0; i < packets.size(); ++i)
+			bytes += packets[i].size();
+	}
+};
+
+// Parses a synthetic stream of packets of random lengths, every eighth
+// one preceded by `noise` bytes of garbage; returns bytes per second.
+static double bench_stream_parser(packet_counter & counter, size_t read_size, size_t noise)
+{
+	static size_t const stream_size = 1 << 20;
+	static size_t const passes = 64;
+
+	std::vector<uint8_t> stream;
+	stream.reserve(stream_size + noise + 32);
+	size_t expected = 0;
+	for (uint32_t seed = 1; stream.size() < stream_size; ++expected)
+	{
+		seed = seed * 1103515245 + 12345;
+		if (expected % 8 == 0)
+			stream.insert(stream.end(), noise, (uint8_t)0x55);
+
+		uint8_t len = (seed >> 16) & 0xf;
+		stream.push_back(0x80);
+		stream.push_back((uint8_t)((seed >> 8) & 0xf0) | len);
+		for (uint8_t i = 0; i < len; ++i)
+			stream.push_back((uint8_t)(seed + i));
+	}
+
+	counter.count = 0;
+	double start = monotonic_seconds();
+	for (size_t pass = 0; pass < passes; ++pass)
+	{
+		yb::stream_parser parser;
+		for (size_t i = 0; i < stream.size(); i += read_size)
+			parser.parse(counter, yb::buffer_ref(stream.data() + i, (std::min)(read_size, stream.size() - i)));
+	}
+	double elapsed = monotonic_seconds() - start;
+
+	assert(counter.count == expected * passes);
+	return stream.size() * passes / elapsed;
+}
+
+TEST_CASE(StreamParser, "+bench")
+{
+	static size_t const read_sizes[] = { 64, 256, 4096 };
+	packet_counter single;
+	packet_batch_counter batched;
+	for (size_t i = 0; i < sizeof read_sizes / sizeof read_sizes[0]; ++i)
+	{
+		printf("reads of %d bytes: %.1f MB/s, with bursts of noise %.1f MB/s, in batches %.1f MB/s\n", (int)read_sizes[i],
+			bench_stream_parser(single, read_sizes[i], 3) / 1e6, bench_stream_parser(single, read_sizes[i], 512) / 1e6,
+			bench_stream_parser(batched, read_sizes[i], 3) / 1e6);
+	}
+}
+
+#endif // __linux__
@@ -1,16 +1,27 @@
 #include "memmock.h"
 #include "test.h"
 #include <vector>
+#include <string>
+#include <string.h>
 
 #include <libyb/async/task.hpp>
 #include <libyb/async/sync_runner.hpp>
 #include <libyb/async/async_runner.hpp>
+#include <libyb/async/async_runner_pool.hpp>
 #include <libyb/async/timer.hpp>
 #include <libyb/async/channel.hpp>
+#include <libyb/async/concurrent_channel.hpp>
+#include <libyb/async/promise.hpp>
 #include <libyb/async/serial_port.hpp>
 #include <libyb/async/stream_device.hpp>
 #include <libyb/async/descriptor_reader.hpp>
 #include <libyb/async/mock_stream.hpp>
+#include <libyb/async/coroutine.hpp>
+#include <libyb/async/task_trace.hpp>
+#include <libyb/async/task_reaper.hpp>
+#include <libyb/stream_parser.hpp>
+#include <sstream>
+#include <functional>
 
 TEST_CASE(ValueTaskTest, "value_task")
 {
@@ -40,6 +51,53 @@ TEST_CASE(SeqCompTask, "seqcomp_task")
 	assert(m.alloc_count() == 0);
 }
 
+TEST_CASE(ContinuationChains, "seqcomp_task")
+{
+	static int const chain_length = 100000;
+
+	yb::channel<int> ch = yb::channel<int>::create();
+	yb::sync_runner runner;
+
+	// Neither running a long chain nor tearing it down recurses
+	// through its length.
+	yb::task<int> t = ch.receive();
+	for (int i = 0; i < chain_length; ++i)
+		t = t.then([](int v) { return v + 1; });
+	runner.run(ch.send(0));
+	assert(runner.run(std::move(t)) == chain_length);
+
+	// Compositions returned by continuations are spliced in.
+	t = ch.receive();
+	for (int i = 0; i < 1000; ++i)
+	{
+		t = t.then([&ch](int v) {
+			return ch.receive().then([v](int w) { return v + w; });
+		});
+	}
+
+	yb::sync_future<int> f = runner.post(std::move(t));
+	for (int i = 0; i <= 1000; ++i)
+		runner.run(ch.send(1));
+	assert(f.get() == 1001);
+
+	// A chain that is destroyed while waiting passes
+	// the cancellation along.
+	int failures = 0;
+	{
+		t = ch.receive();
+		for (int i = 0; i < chain_length; ++i)
+		{
+			t = t.continue_with([&failures](yb::task_result<int> r) -> yb::task<int> {
+				if (r.has_exception())
+					++failures;
+				return yb::async::result(std::move(r));
+			});
+		}
+		t.clear();
+	}
+	assert(failures == chain_length);
+}
+
 TEST_CASE(TimerTask, "timer_task")
 {
 	yb::timer tmr;
@@ -77,6 +135,54 @@ TEST_CASE(ChannelTask, "channel_task")
 	assert(res == 42);
 }
 
+TEST_CASE(ChannelBatches, "channel_task")
+{
+	yb::channel<int, yb::dynamic_capacity> ch = yb::channel<int, yb::dynamic_capacity>::create(5);
+	assert(ch.capacity() == 5);
+
+	std::vector<int> values;
+	for (int i = 0; i < 12; ++i)
+		values.push_back(i);
+
+	// Only the first five values fit.
+	yb::task<void> t = ch.send_many(std::move(values));
+	assert(!t.has_result());
+
+	std::vector<int> batch = yb::sync_runner().run(ch.receive_many(3));
+	assert(batch.size() == 3 && batch[0] == 0 && batch[2] == 2);
+
+	std::vector<int> received;
+	t |= yb::loop([&ch, &received](yb::cancel_level) -> yb::task<void> {
+		if (received.size() == 9)
+			return yb::nulltask;
+		return ch.receive_many(100).then([&received](std::vector<int> const & batch) {
+			assert(!batch.empty() && batch.size() <= 5);
+			received.insert(received.end(), batch.begin(), batch.end());
+		});
+	});
+	yb::sync_runner().run(std::move(t));
+	for (int i = 0; i < 9; ++i)
+		assert(received[i] == i + 3);
+
+	// A batch ends before an exception.
+	int const more[] = { 1, 2 };
+	yb::sync_runner().run(ch.send_many(yb::vector_ref<int>(more, 2)));
+	yb::sync_runner().run(ch.send(yb::task_result<int>(std::copy_exception(std::runtime_error("failed")))));
+	yb::sync_runner().run(ch.send(3));
+	assert(yb::sync_runner().run(ch.receive_many(10)).size() == 2);
+	assert(yb::sync_runner().try_run(ch.receive_many(10)).has_exception());
+	assert(yb::sync_runner().run(ch.receive_many(10)).size() == 1);
+
+	// The storage grows up to the capacity.
+	yb::channel<int, yb::dynamic_capacity> large = yb::channel<int, yb::dynamic_capacity>::create(1000);
+	for (int i = 0; i < 1000; ++i)
+		assert(large.send(i).has_result());
+	assert(!large.send(1000).has_result());
+	batch = yb::sync_runner().run(large.receive_many(1000));
+	for (int i = 0; i < 1000; ++i)
+		assert(batch[i] == i);
+}
+
 TEST_CASE(SignalTask, "signal_task")
 {
 	yb::timer tmr;
@@ -87,55 +193,1700 @@ TEST_CASE(SignalTask, "signal_task")
 	yb::sync_runner().run(std::move(t));
 }
 
-TEST_CASE(ReadDescriptorTask, "signal_task")
+TEST_CASE(InlineTaskStorage, "channel_task")
 {
-	static uint8_t const w1[] = { 0x80, 0x01, 0x00 };
-	static uint8_t const r2[] = {
-		0x80, 0x0f, 1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0x80, 0x0f, 15, 16,
-		0x00, 0x00, 0xc4, 0x91, 0x24, 0xd9, 0x46, 0x29, 0x4a, 0xef, 0xae, 0x35, 0xdd, 0x80, 0x08, 0xc3, 0x2c, 0x21, 0xb2, 0x79, 0, 0, 0,
-	};
+	yb::channel<int> ch = yb::channel<int>::create();
+	yb::promise<int> p;
 
-	yb::mock_stream sp;
-	sp.expect_write(w1, 1);
-	sp.expect_read(r2, 1);
+	size_t base = get_total_alloc_count();
+	yb::task<int> t1 = ch.receive();
+	yb::task<int> t2 = wait_for(p);
+	assert(t1.has_task() && t2.has_task());
 
-	yb::stream_device dev;
+	// Moving relocates the inline objects.
+	yb::task<int> t3 = std::move(t1);
+	yb::task<int> t4;
+	t4 = std::move(t2);
+	assert(t1.empty() && t2.empty());
+	assert(get_total_alloc_count() == base);
+
+	ch.send(42);
+	p.set_value(43);
 
 	yb::sync_runner runner;
-	yb::sync_future<void> f = runner.post(dev.run(sp));
+	assert(runner.run(std::move(t3)) == 42);
+	assert(runner.run(std::move(t4)) == 43);
+}
 
-	yb::device_descriptor dd = runner.run(yb::read_device_descriptor(dev));
-	assert(dd.device_guid() == "01020304-0506-0708-090a-0b0c0d0e0f10");
+// Echoes the packets; the replies are kept in a fixed array.
+class packet_echo
+	: public yb::packet_handler
+{
+public:
+	packet_echo()
+		: m_count(0)
+	{
+	}
 
-	yb::device_config const * config = dd.get_config("c49124d9-4629-4aef-ae35-ddc32c21b279");
-	assert(config);
+	void handle_packet(yb::packet const & p)
+	{
+		assert(m_count < sizeof m_replies / sizeof m_replies[0]);
+		m_replies[m_count++] = yb::make_packet(p[0]) % yb::buffer_ref(p.data() + 1, p.size() - 1);
+	}
+
+	size_t m_count;
+	yb::packet m_replies[4];
+};
+
+TEST_CASE(InlinePacket, "packet")
+{
+	// Noise, a packet with no payload, and one with the maximum one
+	// split across two reads.
+	static uint8_t const stream1[] = { 0x01, 0x80, 0x30, 0x80, 0x5f, 0, 1, 2, 3, 4, 5 };
+	static uint8_t const stream2[] = { 6, 7, 8, 9, 10, 11, 12, 13, 14, 0x80, 0x12, 0xaa, 0xbb };
+
+	alloc_mocker m;
+	while (m.next())
+	{
+		yb::stream_parser parser;
+		packet_echo echo;
+		parser.parse(echo, yb::buffer_ref(stream1, sizeof stream1));
+		parser.parse(echo, yb::buffer_ref(stream2, sizeof stream2));
+
+		assert(echo.m_count == 3);
+		assert(echo.m_replies[0] == yb::packet(1, 3));
+
+		yb::packet const & full = echo.m_replies[1];
+		assert(full.size() == yb::packet::max_size && full[0] == 5 && full[1] == 0 && full[15] == 14);
+
+		assert(echo.m_replies[2] == yb::packet(yb::make_packet(1) % 0xaa % 0xbb));
+	}
+
+	assert(m.alloc_count() == 0);
+
+	bool thrown = false;
+	try
+	{
+		yb::packet p(yb::packet::max_size, 0);
+		p.push_back(0);
+	}
+	catch (std::length_error const &)
+	{
+		thrown = true;
+	}
+	assert(thrown);
 }
 
-TEST_CASE(ReadDescriptorTask_AsyncRunner, "signal_task async_runner")
+TEST_CASE(StreamParserSplits, "packet")
 {
-	static uint8_t const w1[] = { 0x80, 0x01, 0x00 };
-	static uint8_t const r2[] = {
-		0x80, 0x0f, 1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0x80, 0x0f, 15, 16,
-		0x00, 0x00, 0xc4, 0x91, 0x24, 0xd9, 0x46, 0x29, 0x4a, 0xef, 0xae, 0x35, 0xdd, 0x80, 0x08, 0xc3, 0x2c, 0x21, 0xb2, 0x79, 0, 0, 0,
+	static uint8_t const stream[] = {
+		0x55, 0x80, 0x12, 0x80, 0x80, 0x80, 0x00, 0x80, 0x23, 1, 2, 3,
+		0x80, 0x5f, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0x80 };
+
+	std::vector<yb::packet> expected;
+	expected.push_back(yb::make_packet(1) % 0x80 % 0x80);
+	expected.push_back(yb::make_packet(0));
+	expected.push_back(yb::make_packet(2) % 1 % 2 % 3);
+	expected.push_back(yb::make_packet(5) % yb::buffer_ref(stream + 14, 15));
+
+	// The packets don't depend on how the stream is split into reads.
+	for (size_t read_size = 1; read_size <= sizeof stream; ++read_size)
+	{
+		yb::stream_parser parser;
+		std::vector<yb::packet> out;
+		for (size_t i = 0; i < sizeof stream; i += read_size)
+			parser.parse(out, yb::buffer_ref(stream + i, (std::min)(read_size, sizeof stream - i)));
+		assert(out == expected);
+	}
+
+	// Scanning for the sync byte stays within the buffer.
+	std::vector<uint8_t> noise(100, 0x55);
+	yb::stream_parser parser;
+	std::vector<yb::packet> out;
+	parser.parse(out, noise);
+	assert(out.empty());
+}
+
+namespace {
+
+struct packet_batches
+	: yb::packet_handler
+{
+	void handle_packets(yb::vector_ref<yb::packet> const & packets)
+	{
+		sizes.push_back(packets.size());
+		out.insert(out.end(), packets.begin(), packets.end());
+	}
+
+	std::vector<size_t> sizes;
+	std::vector<yb::packet> out;
+};
+
+struct throwing_batches
+	: packet_batches
+{
+	throwing_batches()
+		: fail(true)
+	{
+	}
+
+	void handle_packets(yb::vector_ref<yb::packet> const & packets)
+	{
+		if (fail)
+		{
+			fail = false;
+			throw std::runtime_error("handler failed");
+		}
+		packet_batches::handle_packets(packets);
+	}
+
+	bool fail;
+};
+
+struct single_packets
+	: yb::packet_handler
+{
+	void handle_packet(yb::packet const & p)
+	{
+		out.push_back(p);
+	}
+
+	std::vector<yb::packet> out;
+};
+
+}
+
+TEST_CASE(StreamParserBatches, "packet")
+{
+	size_t const count = yb::stream_parser::max_batch + 10;
+
+	std::vector<uint8_t> stream;
+	std::vector<yb::packet> expected;
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint8_t len = i % 4;
+		stream.push_back(0x80);
+		stream.push_back(0x10 | len);
+		for (uint8_t j = 0; j < len; ++j)
+			stream.push_back((uint8_t)i);
+		expected.push_back(yb::packet(len + 1, (uint8_t)i));
+		expected.back()[0] = 1;
+	}
+
+	// A read is delivered in as few batches as possible; the packet
+	// split by the read boundary goes with the next read.
+	size_t split = stream.size() - 2;
+
+	yb::stream_parser parser;
+	packet_batches batches;
+	parser.parse(batches, yb::buffer_ref(stream.data(), split));
+	assert(batches.sizes.size() == 2);
+	assert(batches.sizes[0] == yb::stream_parser::max_batch);
+	assert(batches.sizes[1] == count - 1 - yb::stream_parser::max_batch);
+
+	parser.parse(batches, yb::buffer_ref(stream.data() + split, 2));
+	assert(batches.sizes.size() == 3 && batches.sizes[2] == 1);
+	assert(batches.out == expected);
+
+	// Handlers of single packets get them one by one.
+	yb::stream_parser parser2;
+	single_packets singles;
+	parser2.parse(singles, stream);
+	assert(singles.out == expected);
+
+	// The packet split by the read boundary survives a throwing handler.
+	yb::stream_parser parser3;
+	throwing_batches thrower;
+	bool thrown = false;
+	try
+	{
+		parser3.parse(thrower, yb::buffer_ref(stream.data() + stream.size() - 9, 8));
+	}
+	catch (std::runtime_error const &)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+
+	parser3.parse(thrower, yb::buffer_ref(stream.data() + stream.size() - 1, 1));
+	assert(thrower.out.size() == 1 && thrower.out[0] == expected.back());
+}
+
+namespace {
+
+struct loopback_device
+	: yb::device
+{
+	yb::task<void> write_packet(yb::packet const & p)
+	{
+		this->handle_packet(p);
+		return yb::async::value();
+	}
+
+	void receive(std::vector<yb::packet> const & packets)
+	{
+		this->handle_packets(yb::vector_ref<yb::packet>(packets.data(), packets.size()));
+	}
+};
+
+struct command_counter
+	: yb::packet_handler
+{
+	command_counter()
+		: count(0), dev(0), unregister(0)
+	{
+	}
+
+	void handle_packet(yb::packet const & p)
+	{
+		++count;
+		last_cmd = p[0];
+		if (unregister)
+		{
+			dev->unregister_receiver(*unregister);
+			unregister = 0;
+		}
+		if (on_packet)
+			on_packet();
+	}
+
+	size_t count;
+	uint8_t last_cmd;
+	yb::device * dev;
+	yb::device::receiver_registration * unregister;
+	std::function<void()> on_packet;
+};
+
+}
+
+TEST_CASE(DeviceBatches, "packet")
+{
+	loopback_device dev;
+
+	command_counter first, second;
+	yb::device::receiver_registration first_reg = dev.register_receiver(first);
+	yb::device::receiver_registration second_reg = dev.register_receiver(second);
+
+	// Each packet of a batch reaches all receivers before the next one,
+	// so a receiver that unregisters itself misses the rest of the batch.
+	second.dev = &dev;
+	second.unregister = &second_reg;
+
+	std::vector<yb::packet> batch;
+	for (uint8_t cmd = 0; cmd < 3; ++cmd)
+		batch.push_back(yb::make_packet(cmd));
+	dev.receive(batch);
+	assert(first.count == 3 && second.count == 1);
+
+	dev.unregister_receiver(first_reg);
+}
+
+TEST_CASE(DeviceDispatch, "packet")
+{
+	loopback_device dev;
+
+	yb::device_config config;
+	config.cmd = 3;
+	config.cmd_count = 2;
+
+	command_counter all, two, intf;
+	yb::device::receiver_registration all_reg = dev.register_receiver(all);
+	yb::device::receiver_registration two_reg = dev.register_receiver(two, 2);
+	yb::device::receiver_registration intf_reg = dev.register_receiver(intf, config);
+
+	for (uint8_t cmd = 0; cmd < 16; ++cmd)
+		dev.write_packet(yb::make_packet(cmd));
+	assert(all.count == 16);
+	assert(two.count == 1 && two.last_cmd == 2);
+	assert(intf.count == 2 && intf.last_cmd == 4);
+
+	// A receiver can unregister others while handling a packet;
+	// those that have been unregistered don't see it.
+	all.dev = &dev;
+	all.unregister = &two_reg;
+	dev.write_packet(yb::make_packet(2));
+	assert(all.count == 17 && two.count == 1);
+	dev.write_packet(yb::make_packet(2));
+	assert(all.count == 18 && two.count == 1);
+
+	// Receivers registered during the dispatch of a packet get the next one.
+	command_counter late;
+	yb::device::receiver_registration late_reg;
+	intf.on_packet = [&] {
+		late_reg = dev.register_receiver(late, 3);
+		intf.on_packet = nullptr;
 	};
+	dev.write_packet(yb::make_packet(3));
+	assert(intf.count == 3 && late.count == 0);
+	dev.write_packet(yb::make_packet(3));
+	assert(intf.count == 4 && late.count == 1);
 
-	yb::mock_stream sp;
-	sp.expect_write(w1, 1);
-	sp.expect_read(r2, 1);
+	// ...or themselves.
+	late.dev = &dev;
+	late.unregister = &late_reg;
+	dev.write_packet(yb::make_packet(3));
+	dev.write_packet(yb::make_packet(3));
+	assert(intf.count == 6 && late.count == 2);
 
-	yb::stream_device dev;
+	dev.unregister_receiver(intf_reg);
+	dev.unregister_receiver(all_reg);
+	dev.write_packet(yb::make_packet(3));
+	assert(all.count == 22 && intf.count == 6);
 
-	yb::async_runner runner;
+	// Batches are dispatched a packet at a time, so unregistering
+	// a receiver applies to the rest of the batch.
+	command_counter first, second;
+	yb::device::receiver_registration first_reg = dev.register_receiver(first, 5);
+	yb::device::receiver_registration second_reg = dev.register_receiver(second);
+	first.dev = &dev;
+	first.unregister = &second_reg;
 
-	yb::async_future<void> f = runner.post(dev.run(sp));
+	std::vector<yb::packet> batch;
+	batch.push_back(yb::make_packet(5));
+	batch.push_back(yb::make_packet(6));
+	batch.push_back(yb::make_packet(5));
+	dev.receive(batch);
+	assert(first.count == 2 && first.last_cmd == 5);
+	assert(second.count == 0);
+	dev.unregister_receiver(first_reg);
+}
 
-	yb::device_descriptor dd = runner.run(yb::read_device_descriptor(dev));
-	assert(dd.device_guid() == "01020304-0506-0708-090a-0b0c0d0e0f10");
+#ifdef LIBYB_ASYNC_HAS_COROUTINES
 
-	yb::device_config const * config = dd.get_config("c49124d9-4629-4aef-ae35-ddc32c21b279");
-	assert(config);
+static yb::task<int> coroutine_sum(yb::channel<int> ch, yb::timer & tmr)
+{
+	int a = co_await ch.receive();
+	co_await tmr.wait_ms(1);
+	int b = co_await ch.receive();
+	co_return a + b;
+}
+
+TEST_CASE(CoroutineTask, "coroutine")
+{
+	yb::timer tmr;
+	yb::channel<int> ch = yb::channel<int>::create();
+
+	yb::sync_runner runner;
+	yb::sync_future<int> f = runner.post(coroutine_sum(ch, tmr));
+	ch.send(1);
+	runner.run(tmr.wait_ms(1).then([&ch] { ch.send(2); }));
+	assert(runner.try_run(f).get() == 3);
+}
+
+static yb::task<void> coroutine_wait(yb::timer & tmr, yb::cancel_level & seen)
+{
+	bool cancelled = false;
+	try
+	{
+		co_await tmr.wait_ms(10000);
+	}
+	catch (yb::task_cancelled const &)
+	{
+		cancelled = true;
+	}
+
+	assert(cancelled);
+	seen = co_await yb::current_cancel_level;
+
+	// Awaits following a cancellation are cancelled as well.
+	co_await tmr.wait_ms(10000);
+}
+
+TEST_CASE(CoroutineCancellation, "coroutine")
+{
+	yb::timer tmr1, tmr2;
+	yb::cancel_level seen = yb::cl_none;
+
+	yb::sync_runner runner;
+	yb::sync_future<void> f = runner.post(coroutine_wait(tmr1, seen));
+	runner.run(tmr2.wait_ms(1));
+
+	f.cancel(yb::cl_abort);
+	assert(runner.try_run(f).has_exception());
+	assert(seen == yb::cl_abort);
+}
+
+static yb::task<int> coroutine_add(yb::task<int> t, int v)
+{
+	co_return co_await std::move(t) + v;
+}
+
+TEST_CASE(CoroutineFramePool, "coroutine")
+{
+	yb::sync_runner runner;
+	assert(runner.run(coroutine_add(yb::async::value(1), 1)) == 2);
+
+	// Once a frame is recycled, coroutines don't touch the heap.
+	size_t base = get_total_alloc_count();
+	yb::task<int> t = coroutine_add(yb::async::value(40), 2);
+	assert(get_total_alloc_count() == base);
+	assert(runner.run(std::move(t)) == 42);
+}
+
+static yb::task<void> coroutine_set(bool & flag)
+{
+	flag = true;
+	co_return;
+}
+
+TEST_CASE(CoroutineNotStarted, "coroutine")
+{
+	// Tasks that are never waited for don't run their bodies.
+	bool ran = false;
+	{
+		yb::task<void> t = coroutine_set(ran);
+	}
+	assert(!ran);
+
+	yb::task<void> t = coroutine_set(ran);
+	assert(t.cancel_and_wait().has_exception());
+	assert(!ran);
+
+	yb::sync_runner runner;
+	runner.run(coroutine_set(ran));
+	assert(ran);
+}
+
+#endif // LIBYB_ASYNC_HAS_COROUTINES
+
+// Counts how many times the nested task gets prepared.
+class prepare_counter_task
+	: public yb::task_base<void>
+{
+public:
+	prepare_counter_task(yb::task<void> && t, size_t & counter)
+		: m_task(std::move(t)), m_counter(counter)
+	{
+	}
+
+	void cancel(yb::cancel_level cl) throw()
+	{
+		m_task.cancel(cl);
+	}
+
+	yb::task_result<void> cancel_and_wait() throw()
+	{
+		return m_task.cancel_and_wait();
+	}
+
+	void prepare_wait(yb::task_wait_preparation_context & ctx)
+	{
+		++m_counter;
+		m_task.prepare_wait(ctx);
+	}
+
+	yb::task<void> finish_wait(yb::task_wait_finalization_context & ctx) throw()
+	{
+		m_task.finish_wait(ctx);
+		if (m_task.has_result())
+			return std::move(m_task);
+		return yb::nulltask;
+	}
+
+private:
+	yb::task<void> m_task;
+	size_t & m_counter;
+};
+
+// Counts the cancellations that reach the nested task, per level.
+struct cancel_counts
+{
+	cancel_counts()
+		: quit(0), abort(0), other(0)
+	{
+	}
+
+	size_t quit;
+	size_t abort;
+	size_t other;
+};
+
+class cancel_counter_task
+	: public yb::task_base<void>
+{
+public:
+	cancel_counter_task(yb::task<void> && t, cancel_counts & counts)
+		: m_task(std::move(t)), m_counts(counts)
+	{
+	}
+
+	void cancel(yb::cancel_level cl) throw()
+	{
+		if (cl == yb::cl_quit)
+			++m_counts.quit;
+		else if (cl == yb::cl_abort)
+			++m_counts.abort;
+		else
+			++m_counts.other;
+		m_task.cancel(cl);
+	}
+
+	yb::task_result<void> cancel_and_wait() throw()
+	{
+		return m_task.cancel_and_wait();
+	}
+
+	void prepare_wait(yb::task_wait_preparation_context & ctx)
+	{
+		m_task.prepare_wait(ctx);
+	}
+
+	yb::task<void> finish_wait(yb::task_wait_finalization_context & ctx) throw()
+	{
+		m_task.finish_wait(ctx);
+		if (m_task.has_result())
+			return std::move(m_task);
+		return yb::nulltask;
+	}
+
+private:
+	yb::task<void> m_task;
+	cancel_counts & m_counts;
+};
+
+TEST_CASE(IncrementalPreparation, "parallel_task")
+{
+	yb::timer t1, t2;
+	size_t prepare_count = 0;
+
+	yb::task<void> t = yb::task<void>(new prepare_counter_task(t2.wait_ms(10000), prepare_count));
+	t |= t1.wait_ms(1).then([&t1] { return t1.wait_ms(1); }).then([&t1] { return t1.wait_ms(1); });
+
+	yb::sync_runner runner;
+	yb::sync_future<void> f = runner.post(std::move(t));
+
+	// The idle timer is prepared once, while the other one fires three times.
+	runner.run(t1.wait_ms(5));
+	assert(prepare_count == 1);
+
+	// Cancelling through the future must be noticed nonetheless.
+	f.cancel(yb::cl_abort);
+	runner.try_run(f);
+	assert(prepare_count == 2);
 }
 
+TEST_CASE(IncrementalPreparation_CancellationToken, "parallel_task")
+{
+	yb::timer t1, t2;
+	size_t prepare_count = 0;
+
+	yb::cancellation_token ct;
+	yb::task<void> t = yb::task<void>(new prepare_counter_task(t2.wait_ms(10000).cancellable(ct), prepare_count));
+
+	yb::sync_runner runner;
+	yb::sync_future<void> f = runner.post(std::move(t));
+
+	// A task with a token is prepared again only once the token fires.
+	runner.run(t1.wait_ms(1).then([&t1] { return t1.wait_ms(1); }));
+	assert(prepare_count == 1);
+
+	runner.run(t1.wait_ms(1).then([&ct] { ct.cancel(yb::cl_abort); }));
+	assert(prepare_count == 2);
+	assert(runner.try_run(f).has_exception());
+}
+
+TEST_CASE(IncrementalPreparation_AsyncRunner, "parallel_task async_runner")
+{
+	yb::timer t1, t2;
+	size_t prepare_count = 0;
+
+	yb::async_runner runner(yb::rb_poll);
+	yb::async_future<void> f = runner.post(yb::task<void>(new prepare_counter_task(t2.wait_ms(10000), prepare_count)));
+	runner.run(t1.wait_ms(1).then([&t1] { return t1.wait_ms(1); }).then([&t1] { return t1.wait_ms(1); }));
+
+	// The counter is only accessed on the dispatch thread.
+	assert(runner.run(t1.wait_ms(1).then([&prepare_count] { return prepare_count; })) == 1);
+
+	assert(f.wait(yb::cl_abort).has_exception());
+}
+
+namespace {
+
+struct write_recorder
+	: yb::stream
+{
+	write_recorder()
+		: reads(yb::channel<size_t>::create())
+	{
+	}
+
+	yb::task<size_t> read(uint8_t * buffer, size_t size)
+	{
+		(void)buffer;
+		(void)size;
+		return reads.receive();
+	}
+
+	yb::task<size_t> write(uint8_t const * buffer, size_t size)
+	{
+		sizes.push_back(size);
+		data.insert(data.end(), buffer, buffer + size);
+		return yb::async::value(size);
+	}
+
+	yb::channel<size_t> reads;
+	std::vector<size_t> sizes;
+	std::vector<uint8_t> data;
+};
+
+}
+
+TEST_CASE(StreamDeviceWrites, "sync_runner")
+{
+	std::vector<yb::packet> small;
+	std::vector<uint8_t> small_data;
+	for (uint8_t i = 0; i < 20; ++i)
+	{
+		small.push_back(yb::make_packet(1) % i);
+		small_data.push_back(0x80);
+		small_data.push_back(0x11);
+		small_data.push_back(i);
+	}
+
+	std::vector<yb::packet> large(3, yb::packet(16, 7));
+	std::vector<uint8_t> large_data;
+	for (size_t i = 0; i < large.size(); ++i)
+	{
+		large_data.push_back(0x80);
+		large_data.push_back(0x7f);
+		large_data.insert(large_data.end(), 15, 7);
+	}
+
+	// Queued packets are coalesced into a single transfer.
+	{
+		write_recorder s;
+		yb::stream_device dev;
+
+		yb::sync_runner runner;
+		yb::sync_future<void> f = runner.post(dev.run(s));
+
+		yb::task<void> t = dev.write_packets(small);
+		assert(t.has_result());
+
+		f.cancel(yb::cl_quit);
+		runner.try_run(f).get();
+		assert(s.sizes.size() == 1 && s.sizes[0] == small_data.size());
+		assert(s.data == small_data);
+	}
+
+	// When the buffer is full, the writers wait and the data
+	// is written in transfers of limited size.
+	{
+		write_recorder s;
+		yb::stream_device dev(32, 8);
+
+		yb::sync_runner runner;
+		yb::sync_future<void> f = runner.post(dev.run(s));
+
+		yb::task<void> t = dev.write_packets(large);
+		assert(!t.has_result());
+		yb::task<void> t2 = dev.write_packet(yb::make_packet(2));
+		assert(!t2.has_result());
+
+		runner.run(std::move(t));
+		runner.run(std::move(t2));
+
+		f.cancel(yb::cl_quit);
+		runner.try_run(f).get();
+
+		large_data.push_back(0x80);
+		large_data.push_back(0x20);
+		assert(s.data == large_data);
+		for (size_t i = 0; i < s.sizes.size(); ++i)
+			assert(s.sizes[i] <= 8);
+	}
+}
+
+TEST_CASE(ReadDescriptorTask, "signal_task")
+{
+	static uint8_t const w1[] = { 0x80, 0x01, 0x00 };
+	static uint8_t const r2[] = {
+		0x80, 0x0f, 1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0x80, 0x0f, 15, 16,
+		0x00, 0x00, 0xc4, 0x91, 0x24, 0xd9, 0x46, 0x29, 0x4a, 0xef, 0xae, 0x35, 0xdd, 0x80, 0x08, 0xc3, 0x2c, 0x21, 0xb2, 0x79, 0, 0, 0,
+	};
+
+	yb::mock_stream sp;
+	sp.expect_write(w1, 1);
+	sp.expect_read(r2, 1);
+
+	yb::stream_device dev;
+
+	yb::sync_runner runner;
+	yb::sync_future<void> f = runner.post(dev.run(sp));
+
+	yb::device_descriptor dd = runner.run(yb::read_device_descriptor(dev));
+	assert(dd.device_guid() == "01020304-0506-0708-090a-0b0c0d0e0f10");
+
+	yb::device_config const * config = dd.get_config("c49124d9-4629-4aef-ae35-ddc32c21b279");
+	assert(config);
+}
+
+TEST_CASE(ReadDescriptorTask_AsyncRunner, "signal_task async_runner")
+{
+	static uint8_t const w1[] = { 0x80, 0x01, 0x00 };
+	static uint8_t const r2[] = {
+		0x80, 0x0f, 1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0x80, 0x0f, 15, 16,
+		0x00, 0x00, 0xc4, 0x91, 0x24, 0xd9, 0x46, 0x29, 0x4a, 0xef, 0xae, 0x35, 0xdd, 0x80, 0x08, 0xc3, 0x2c, 0x21, 0xb2, 0x79, 0, 0, 0,
+	};
+
+	yb::mock_stream sp;
+	sp.expect_write(w1, 1);
+	sp.expect_read(r2, 1);
+
+	yb::stream_device dev;
+
+	yb::async_runner runner;
+
+	yb::async_future<void> f = runner.post(dev.run(sp));
+
+	yb::device_descriptor dd = runner.run(yb::read_device_descriptor(dev));
+	assert(dd.device_guid() == "01020304-0506-0708-090a-0b0c0d0e0f10");
+
+	yb::device_config const * config = dd.get_config("c49124d9-4629-4aef-ae35-ddc32c21b279");
+	assert(config);
+}
+
+TEST_CASE(ReadDescriptorTask_EpollRunner, "signal_task async_runner epoll")
+{
+	static uint8_t const w1[] = { 0x80, 0x01, 0x00 };
+	static uint8_t const r2[] = {
+		0x80, 0x0f, 1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0x80, 0x0f, 15, 16,
+		0x00, 0x00, 0xc4, 0x91, 0x24, 0xd9, 0x46, 0x29, 0x4a, 0xef, 0xae, 0x35, 0xdd, 0x80, 0x08, 0xc3, 0x2c, 0x21, 0xb2, 0x79, 0, 0, 0,
+	};
+
+	yb::mock_stream sp;
+	sp.expect_write(w1, 1);
+	sp.expect_read(r2, 1);
+
+	yb::stream_device dev;
+
+	yb::async_runner runner(yb::rb_epoll);
+
+	yb::async_future<void> f = runner.post(dev.run(sp));
+
+	yb::device_descriptor dd = runner.run(yb::read_device_descriptor(dev));
+	assert(dd.device_guid() == "01020304-0506-0708-090a-0b0c0d0e0f10");
+}
+
+TEST_CASE(EpollRunnerTimers, "timer_task async_runner epoll")
+{
+	yb::async_runner runner(yb::rb_epoll);
+
+	yb::timer t1, t2, t3;
+	yb::async_future<void> f1 = runner.post(t1.wait_ms(1));
+	yb::async_future<void> f2 = runner.post(t2.wait_ms(1).then([&t2] { return t2.wait_ms(1); }));
+	yb::async_future<void> f3 = runner.post(t3.wait_ms(10000));
+
+	f1.get();
+	f2.get();
+	assert(f3.wait(yb::cl_abort).has_exception());
+}
+
+static void test_timer_deadlines(yb::async_runner & runner)
+{
+	static size_t const timer_count = 64;
+
+	uint64_t start = yb::monotonic_time_us();
+	uint64_t deadlines[timer_count];
+	uint64_t completions[timer_count];
+	std::vector<yb::async_future<void> > futures;
+	for (size_t i = 0; i < timer_count; ++i)
+	{
+		deadlines[i] = start + 1000 + (i * 37 % timer_count) * 100;
+		uint64_t * completion = &completions[i];
+		futures.push_back(runner.post(yb::wait_until_us(deadlines[i], i % 2? 500: 0).follow_with([completion] {
+			*completion = yb::monotonic_time_us();
+		})));
+	}
+
+	yb::async_future<void> far = runner.post(yb::wait_us(10000000));
+
+	for (size_t i = 0; i < timer_count; ++i)
+	{
+		futures[i].get();
+		assert(completions[i] >= deadlines[i]);
+	}
+
+	assert(far.wait(yb::cl_abort).has_exception());
+}
+
+TEST_CASE(TimerDeadlines, "timer_task async_runner")
+{
+	yb::async_runner poll_runner(yb::rb_poll);
+	test_timer_deadlines(poll_runner);
+
+	yb::async_runner epoll_runner(yb::rb_epoll);
+	test_timer_deadlines(epoll_runner);
+
+	yb::async_runner uring_runner(yb::rb_io_uring);
+	test_timer_deadlines(uring_runner);
+
+	yb::sync_runner runner;
+	uint64_t deadline = yb::monotonic_time_us() + 2000;
+	yb::sync_future<void> f1 = runner.post(yb::wait_until_us(deadline, 1000));
+	yb::sync_future<void> f2 = runner.post(yb::wait_us(10000000));
+	yb::sync_future<void> f3 = runner.post(yb::wait_us(1000));
+	runner.try_run(f1).get();
+	assert(yb::monotonic_time_us() >= deadline);
+	runner.try_run(f3).get();
+	f2.cancel(yb::cl_abort);
+	assert(f2.try_get().has_exception());
+}
+
+static bool is_timed_out(yb::task_result<int> r)
+{
+	try
+	{
+		r.rethrow();
+		return false;
+	}
+	catch (yb::task_timed_out const &)
+	{
+		return true;
+	}
+	catch (...)
+	{
+		return false;
+	}
+}
+
+TEST_CASE(TaskTimeout, "timer_task async_runner")
+{
+	yb::sync_runner runner;
+
+	assert(runner.try_run(yb::wait_us(1000).then([] { return yb::async::value(42); }).timeout_us(1000000)).get() == 42);
+	assert(is_timed_out(runner.try_run(yb::wait_us(10000000).then([] { return yb::async::value(42); }).timeout_us(2000))));
+
+	// The timer can't be stopped at `cl_quit`, so the task runs
+	// to completion, but still fails.
+	uint64_t start = yb::monotonic_time_us();
+	assert(is_timed_out(runner.try_run(yb::wait_us(5000).then([] { return yb::async::value(42); }).timeout_us(1000, yb::cl_quit))));
+	assert(yb::monotonic_time_us() - start >= 5000);
+
+	yb::async_runner async_runner(yb::rb_epoll);
+	uint64_t deadline = yb::monotonic_time_us() + 2000;
+	yb::async_future<int> f1 = async_runner.post(yb::wait_us(10000000).then([] { return yb::async::value(1); }).with_deadline_us(deadline));
+	yb::async_future<int> f2 = async_runner.post(yb::wait_us(1000).then([] { return yb::async::value(2); }).with_deadline_us(deadline + 1000000));
+	assert(is_timed_out(f1.try_get()));
+	assert(yb::monotonic_time_us() >= deadline);
+	assert(f2.get() == 2);
+}
+
+TEST_CASE(RunnerPool, "timer_task async_runner pool")
+{
+	yb::async_runner_pool pool(4);
+
+	// Runners report the backend they've settled on.
+	assert(pool[0].backend() != yb::rb_default);
+
+	std::vector<yb::timer> timers(32);
+	std::vector<yb::async_future<void> > futures;
+	for (size_t i = 0; i < timers.size(); ++i)
+		futures.push_back(pool.post(timers[i].wait_ms(1)));
+
+	// Tasks sharing a key run on the same runner.
+	yb::timer t1;
+	yb::async_future<void> f1 = pool.post(t1.wait_ms(1).then([&t1] { return t1.wait_ms(1); }), &t1);
+
+	yb::timer t2;
+	yb::async_future<void> f2 = pool.post(t2.wait_ms(10000));
+
+	for (size_t i = 0; i < futures.size(); ++i)
+		futures[i].get();
+	f1.get();
+	assert(f2.wait(yb::cl_abort).has_exception());
+}
+
+static void test_mass_cancel(yb::async_runner & runner)
+{
+	std::vector<cancel_counts> counts(200);
+	std::vector<yb::async_future<void> > futures;
+	for (size_t i = 0; i < counts.size(); ++i)
+		futures.push_back(runner.post(yb::task<void>(new cancel_counter_task(yb::wait_ms(100000), counts[i]))));
+
+	yb::async_future<void> survivor = runner.post(yb::wait_ms(1));
+
+	// Repeated and escalating requests are applied at most once per level;
+	// a request may be superseded by a higher one before it's applied.
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		futures[i].cancel(yb::cl_quit);
+		futures[i].cancel(yb::cl_quit);
+		futures[i].cancel(yb::cl_abort);
+	}
+
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		assert(futures[i].try_get().has_exception());
+		assert(counts[i].quit <= 1 && counts[i].abort <= 1 && counts[i].other == 0);
+		assert(counts[i].quit + counts[i].abort != 0);
+	}
+	survivor.get();
+}
+
+TEST_CASE(MassCancel, "timer_task async_runner")
+{
+	yb::async_runner poll_runner(yb::rb_poll);
+	test_mass_cancel(poll_runner);
+
+	yb::async_runner epoll_runner(yb::rb_epoll);
+	test_mass_cancel(epoll_runner);
+
+	yb::async_runner_pool pool(3);
+	std::vector<yb::async_future<void> > futures;
+	for (size_t i = 0; i < 300; ++i)
+		futures.push_back(pool.post(yb::wait_ms(100000)));
+	for (size_t i = 0; i < futures.size(); ++i)
+		futures[i].cancel(yb::cl_abort);
+	for (size_t i = 0; i < futures.size(); ++i)
+		assert(futures[i].try_get().has_exception());
+}
+
+TEST_CASE(FutureThenOn, "timer_task async_runner")
+{
+	yb::async_runner r1;
+	yb::async_runner r2;
+
+	yb::async_future<int> f1 = r1.post(yb::wait_ms(1).then([] { return 1; }));
+	yb::async_future<int> f2 = f1.then_on(r2, [](int v) { return v + 1; });
+	assert(f1.empty());
+
+	// Continuations can be chained and may return tasks.
+	yb::async_future<int> f3 = f2.then_on(r1, [](int v) { return yb::wait_ms(1).then([v] { return v * 10; }); });
+	assert(f3.get() == 20);
+
+	// Exceptions skip the continuation.
+	yb::async_future<int> f4 = r1.post(yb::async::raise<int>(std::runtime_error("failed")));
+	assert(f4.then_on(r2, [](int v) { return v; }).try_get().has_exception());
+
+	// Cancelling the continuation before the promise finishes.
+	yb::async_future<void> f5 = r1.post(yb::wait_ms(10));
+	yb::async_future<void> f6 = f5.then_on(r2, [] { return yb::wait_ms(100000); });
+	assert(f6.wait(yb::cl_abort).has_exception());
+}
+
+TEST_CASE(WhenAllAny, "parallel_task")
+{
+	{
+		std::vector<yb::task<int> > tasks;
+		for (int i = 0; i < 5; ++i)
+			tasks.push_back(yb::wait_ms(5 - i).then([i] { return i * 10; }));
+		tasks.push_back(yb::async::value(50));
+
+		std::vector<int> res = yb::sync_runner().run(yb::when_all(std::move(tasks)));
+		assert(res.size() == 6);
+		for (int i = 0; i < 6; ++i)
+			assert(res[i] == i * 10);
+	}
+
+	// A failure cancels the other tasks.
+	{
+		std::vector<yb::task<void> > tasks;
+		tasks.push_back(yb::wait_ms(100000));
+		tasks.push_back(yb::wait_ms(1).then([] { throw std::runtime_error("failed"); }));
+		assert(yb::sync_runner().try_run(yb::when_all(std::move(tasks))).has_exception());
+	}
+
+	{
+		std::vector<yb::task<int> > tasks;
+		tasks.push_back(yb::wait_ms(100000).then([] { return 1; }));
+		tasks.push_back(yb::wait_ms(1).then([] { return 2; }));
+
+		std::pair<size_t, int> res = yb::sync_runner().run(yb::when_any(std::move(tasks)));
+		assert(res.first == 1 && res.second == 2);
+	}
+
+	assert(yb::sync_runner().try_run(yb::when_any(std::vector<yb::task<void> >())).has_exception());
+
+	// Repeated `|=` extends a single composition.
+	{
+		int done = 0;
+		yb::task<void> t;
+		for (int i = 0; i < 100; ++i)
+			t |= yb::wait_ms(1 + i % 3).then([&done] { ++done; });
+		yb::sync_runner().run(std::move(t));
+		assert(done == 100);
+	}
+}
+
+TEST_CASE(TaskTrace, "task_trace")
+{
+	yb::timer tmr;
+
+	yb::enable_task_trace();
+	yb::clear_task_trace();
+
+	int iterations = 0;
+	yb::sync_runner().run(yb::loop([&](yb::cancel_level) -> yb::task<void> {
+		if (++iterations == 3)
+			return yb::nulltask;
+		return tmr.wait_ms(1);
+	}).then([] {}));
+
+	{
+		yb::task<void> t = tmr.wait_ms(100000);
+		t.cancel(yb::cl_abort);
+	}
+
+	// Tasks handed over in a unique_ptr are traced too.
+	size_t prepared = 0;
+	yb::task_base<void> * owned = new prepare_counter_task(tmr.wait_ms(1), prepared);
+	yb::sync_runner().run(yb::task<void>(std::unique_ptr<yb::task_base<void> >(owned)));
+	assert(prepared != 0);
+
+	yb::enable_task_trace(false);
+
+	std::vector<yb::task_trace_event> events = yb::collect_task_trace();
+	size_t counts[yb::ttk_relocated + 1] = {};
+	bool aborted = false;
+	bool owned_created = false;
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		++counts[events[i].kind];
+		if (events[i].kind == yb::ttk_cancelled && events[i].cl == yb::cl_abort)
+			aborted = true;
+		if (events[i].kind == yb::ttk_created && events[i].task == owned)
+			owned_created = true;
+		if (i != 0)
+			assert(events[i - 1].time_ns <= events[i].time_ns);
+	}
+
+	assert(counts[yb::ttk_created] != 0);
+	assert(counts[yb::ttk_prepared] != 0);
+	assert(counts[yb::ttk_finalized] != 0);
+	assert(counts[yb::ttk_continued] != 0);
+	assert(counts[yb::ttk_completed] != 0);
+	assert(aborted);
+	assert(owned_created);
+
+	std::ostringstream out;
+	yb::write_task_trace(out, events);
+	std::string json = out.str();
+	assert(json.compare(0, 16, "{\"traceEvents\":[") == 0);
+	assert(json.find("\"ph\":\"b\"") != std::string::npos);
+	assert(json.find("\"ph\":\"e\"") != std::string::npos);
+	assert(json.find("\"level\":\"abort\"") != std::string::npos);
+
+	// Nothing is recorded while the tracer is disabled.
+	yb::clear_task_trace();
+	tmr.wait_ms(1).then([] {}).cancel_and_wait();
+	assert(yb::collect_task_trace().empty());
+}
+
+#ifdef __linux__
+
+#include <libyb/async/detail/linux_timer_wheel.hpp>
+#include <libyb/async/detail/linux_fdpoll_task.hpp>
+#include <algorithm>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+static void test_serial_port_fifo(yb::runner_backend_t backend)
+{
+	std::string path = "/tmp/libyb-test-fifo-" + std::to_string((long long)getpid());
+	unlink(path.c_str());
+	int r = mkfifo(path.c_str(), 0600);
+	assert(r == 0);
+
+	{
+		yb::async_runner runner(backend);
+		assert(runner.backend() == backend);
+
+		yb::serial_port sp;
+		runner.run(sp.open(path, 115200));
+		unlink(path.c_str());
+
+		static uint8_t const data[] = { 1, 2, 3 };
+		uint8_t buf[16];
+
+		yb::async_future<size_t> f = runner.post(sp.read(buf, sizeof buf));
+		assert(runner.run(sp.write(data, sizeof data)) == sizeof data);
+		assert(f.get() == sizeof data);
+		assert(memcmp(buf, data, sizeof data) == 0);
+
+		// A read racing with a timer must not lose data.
+		yb::timer tmr;
+		yb::async_future<size_t> f2 = runner.post(sp.read(buf, sizeof buf));
+		runner.run(tmr.wait_ms(1));
+		assert(runner.run(sp.write(data, 2)) == 2);
+		assert(f2.get() == 2);
+
+		yb::async_future<size_t> f3 = runner.post(sp.read(buf, sizeof buf));
+		assert(f3.wait(yb::cl_abort).has_exception());
+	}
+}
+
+TEST_CASE(SerialPortFifo, "serial_port async_runner")
+{
+	test_serial_port_fifo(yb::rb_poll);
+	test_serial_port_fifo(yb::rb_epoll);
+}
+
+TEST_CASE(SerialPortFifo_IoUringRunner, "serial_port async_runner io_uring")
+{
+	// Runners fall back to poll on kernels without io_uring.
+	if (yb::async_runner(yb::rb_io_uring).backend() != yb::rb_io_uring)
+	{
+		std::cout << "skipped: io_uring is not available" << std::endl;
+		return;
+	}
+
+	test_serial_port_fifo(yb::rb_io_uring);
+}
+
+struct stealing_state
+{
+	stealing_state()
+		: blocked_thread(0), blocking(false), release(false), completed(0), stolen(0)
+	{
+	}
+
+	pthread_t blocked_thread;
+	bool blocking;
+	bool release;
+	size_t completed;
+	size_t stolen;
+};
+
+TEST_CASE(RunnerPoolStealing, "timer_task async_runner pool")
+{
+	yb::async_runner_pool pool(2);
+
+	static char keys[64];
+	void const * key0 = 0;
+	void const * key1 = 0;
+	for (size_t i = 0; i < sizeof keys; ++i)
+	{
+		if (&pool.runner_for(&keys[i]) == &pool[0])
+			key0 = &keys[i];
+		else
+			key1 = &keys[i];
+	}
+	assert(key0 && key1);
+
+	// Saturate the first runner with a task that keeps its dispatch thread busy.
+	stealing_state state;
+	stealing_state * st = &state;
+	yb::async_future<void> blocker = pool.post(yb::wait_ms(1).then([st] {
+		st->blocked_thread = pthread_self();
+		__atomic_store_n(&st->blocking, true, __ATOMIC_SEQ_CST);
+		while (!__atomic_load_n(&st->release, __ATOMIC_SEQ_CST))
+			sched_yield();
+	}), key0);
+	while (!__atomic_load_n(&st->blocking, __ATOMIC_SEQ_CST))
+		sched_yield();
+
+	// While the second runner is loaded as well, new tasks
+	// are queued on the busy one.
+	std::vector<yb::async_future<void> > waits;
+	for (size_t i = 0; i < 8; ++i)
+		waits.push_back(pool.post(yb::wait_ms(100000), key1));
+
+	std::vector<yb::async_future<void> > futures;
+	for (size_t i = 0; i < 8; ++i)
+	{
+		futures.push_back(pool.post(yb::wait_ms(1).then([st] {
+			if (!pthread_equal(pthread_self(), st->blocked_thread))
+				__atomic_add_fetch(&st->stolen, 1, __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&st->completed, 1, __ATOMIC_SEQ_CST);
+		})));
+	}
+
+	// Once idle, the second runner steals the queued tasks
+	// the next time it wakes up.
+	for (size_t i = 0; i < waits.size(); ++i)
+		assert(waits[i].wait(yb::cl_abort).has_exception());
+	pool.post(yb::async::value(), key1).get();
+
+	for (int i = 0; i < 5000 && __atomic_load_n(&st->stolen, __ATOMIC_SEQ_CST) == 0; ++i)
+		usleep(1000);
+	assert(__atomic_load_n(&st->stolen, __ATOMIC_SEQ_CST) != 0);
+
+	__atomic_store_n(&st->release, true, __ATOMIC_SEQ_CST);
+	blocker.get();
+	for (size_t i = 0; i < futures.size(); ++i)
+		futures[i].get();
+	assert(state.completed == futures.size());
+}
+
+static size_t const byte_stream_reads = 64;
+
+// Reads a byte at a time, recording the allocation count before each read.
+class byte_stream
+	: public yb::stream
+{
+public:
+	explicit byte_stream(yb::stream & s)
+		: m_s(s), m_reads(0)
+	{
+	}
+
+	yb::task<size_t> read(uint8_t * buffer, size_t)
+	{
+		m_alloc_counts[m_reads] = get_total_alloc_count();
+		return m_s.read(buffer, 1).then([this](size_t r) {
+			++m_reads;
+			return r;
+		});
+	}
+
+	yb::task<size_t> write(uint8_t const * buffer, size_t size)
+	{
+		return m_s.write(buffer, size);
+	}
+
+	yb::stream & m_s;
+	size_t m_reads;
+	size_t m_alloc_counts[byte_stream_reads];
+};
+
+TEST_CASE(PooledTaskNodes, "serial_port sync_runner")
+{
+	std::string path = "/tmp/libyb-test-fifo-" + std::to_string((long long)getpid());
+	unlink(path.c_str());
+	int r = mkfifo(path.c_str(), 0600);
+	assert(r == 0);
+
+	yb::serial_port sp;
+	yb::sync_runner runner;
+	runner.run(sp.open(path, 115200));
+	unlink(path.c_str());
+
+	byte_stream bs(sp);
+	uint8_t data[byte_stream_reads] = {};
+	for (size_t i = 0; i < sizeof data; ++i)
+		data[i] = (uint8_t)i;
+	runner.run(sp.write_all(data, sizeof data));
+
+	yb::task_node_pool_stats before = yb::get_task_node_pool_stats();
+
+	uint8_t buf[sizeof data];
+	runner.run(bs.read_all(buf, sizeof buf));
+	assert(bs.m_reads == sizeof buf);
+	assert(memcmp(buf, data, sizeof data) == 0);
+
+	// Once the first few reads warm up the caches, the loop
+	// runs without touching the heap.
+	assert(bs.m_alloc_counts[8] == bs.m_alloc_counts[sizeof buf - 1]);
+
+	yb::task_node_pool_stats after = yb::get_task_node_pool_stats();
+	assert(after.allocations - before.allocations >= 2 * sizeof buf);
+	assert(after.heap_allocations - before.heap_allocations <= 8);
+
+	yb::trim_task_node_pool();
+	assert(yb::get_task_node_pool_stats().cached_blocks == 0);
+}
+
+struct concurrent_poster
+{
+	yb::async_runner * runner;
+	yb::async_runner_pool * pool;
+	size_t * completed;
+	std::vector<yb::async_future<void> > futures;
+};
+
+static void * concurrent_poster_thread(void * ctx)
+{
+	concurrent_poster * p = (concurrent_poster *)ctx;
+	for (size_t i = 0; i < 500; ++i)
+	{
+		size_t * completed = p->completed;
+		yb::task<void> t = yb::wait_us(i % 8).then([completed] { __atomic_add_fetch(completed, 1, __ATOMIC_RELAXED); });
+		p->futures.push_back(p->runner? p->runner->post(std::move(t)): p->pool->post(std::move(t)));
+	}
+	return 0;
+}
+
+static void test_concurrent_posts(yb::async_runner * runner, yb::async_runner_pool * pool)
+{
+	size_t completed = 0;
+	std::vector<concurrent_poster> posters(4);
+	std::vector<pthread_t> threads(posters.size());
+	for (size_t i = 0; i < posters.size(); ++i)
+	{
+		posters[i].runner = runner;
+		posters[i].pool = pool;
+		posters[i].completed = &completed;
+		int r = pthread_create(&threads[i], 0, &concurrent_poster_thread, &posters[i]);
+		assert(r == 0);
+	}
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], 0);
+
+	for (size_t i = 0; i < posters.size(); ++i)
+	{
+		for (size_t j = 0; j < posters[i].futures.size(); ++j)
+			posters[i].futures[j].get();
+	}
+
+	assert(__atomic_load_n(&completed, __ATOMIC_RELAXED) == posters.size() * 500);
+}
+
+TEST_CASE(ConcurrentPosts, "async_runner pool")
+{
+	{
+		yb::async_runner runner(yb::rb_poll);
+		test_concurrent_posts(&runner, 0);
+	}
+
+	{
+		yb::async_runner runner(yb::rb_epoll);
+		test_concurrent_posts(&runner, 0);
+	}
+
+	yb::async_runner_pool pool(3);
+	test_concurrent_posts(0, &pool);
+}
+
+TEST_CASE(FutureOnComplete, "timer_task async_runner")
+{
+	yb::async_runner runner;
+
+	int results[3] = {};
+	for (int i = 0; i < 2; ++i)
+	{
+		int * result = &results[i];
+		yb::async_future<int> f = runner.post(yb::wait_ms(1).then([i] { return i + 1; }));
+		f.on_complete([result](yb::task_result<int> r) { __atomic_store_n(result, r.get(), __ATOMIC_RELEASE); });
+		assert(f.empty());
+	}
+
+	// Callbacks registered after the promise finished run right away.
+	yb::async_future<int> f = runner.post(yb::async::value(3));
+	int * result = &results[2];
+	f.on_complete([result](yb::task_result<int> r) { *result = r.get(); });
+	assert(results[2] == 3);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		while (__atomic_load_n(&results[i], __ATOMIC_ACQUIRE) != i + 1)
+			sched_yield();
+	}
+}
+
+static void check_runner_stats(yb::runner_stats const & st)
+{
+	assert(st.enabled);
+	assert(st.iterations != 0);
+	assert(st.prepare_ns.count == st.iterations && st.wait_ns.count == st.iterations && st.finish_ns.count == st.iterations);
+	assert(st.poll_items.count == st.iterations);
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < yb::runner_histogram::bucket_count; ++i)
+		total += st.wait_ns.buckets[i];
+	assert(total == st.iterations);
+	assert(st.wait_ns.percentile(0.5) <= st.wait_ns.percentile(1));
+	assert(st.wait_ns.max >= 1000000);
+}
+
+TEST_CASE(RunnerStats, "async_runner sync_runner")
+{
+	static yb::runner_backend_t const backends[] = { yb::rb_poll, yb::rb_epoll, yb::rb_io_uring };
+	for (size_t i = 0; i < sizeof backends / sizeof backends[0]; ++i)
+	{
+		yb::async_runner runner(backends[i]);
+		assert(!runner.stats().enabled && runner.stats().iterations == 0);
+
+		runner.enable_stats();
+		yb::async_future<void> f = runner.post(yb::wait_ms(100000));
+		runner.run(yb::wait_ms(2));
+		assert(runner.run(yb::wait_ms(1).then([&runner] { return runner.stats().live_promises; })) == 2);
+
+		// A post only wakes the dispatch thread if it's already asleep,
+		// which takes a while after it finishes the previous task.
+		for (int j = 0; j < 1000 && runner.stats().control_wakeups == 0; ++j)
+		{
+			usleep(1000);
+			runner.run(yb::wait_ms(1));
+		}
+
+		assert(runner.stats().control_wakeups != 0);
+
+		// The snapshots stay consistent while the runner is busy.
+		yb::async_future<void> busy = runner.post(yb::loop([](yb::cancel_level cl) -> yb::task<void> {
+			return cl >= yb::cl_quit? yb::nulltask: yb::wait_ms(1);
+		}));
+		for (int j = 0; j < 10000; ++j)
+			check_runner_stats(runner.stats());
+		busy.wait(yb::cl_quit);
+
+		// The iteration running when the collection is disabled may still
+		// be recorded; it is over once a task posted afterwards completes.
+		runner.enable_stats(false);
+		runner.run(yb::wait_ms(1));
+		yb::runner_stats st = runner.stats();
+		runner.run(yb::wait_ms(1));
+		assert(runner.stats().iterations == st.iterations);
+	}
+
+	yb::sync_runner runner;
+	runner.enable_stats();
+	runner.run(yb::wait_ms(2));
+	check_runner_stats(runner.stats());
+}
+
+struct channel_producer
+{
+	yb::concurrent_channel<int> const * ch;
+	int first;
+	int count;
+};
+
+static void * channel_producer_thread(void * ctx)
+{
+	channel_producer * p = (channel_producer *)ctx;
+	int next = p->first;
+	yb::sync_runner().run(yb::loop([p, &next](yb::cancel_level) -> yb::task<void> {
+		if (next == p->first + p->count)
+			return yb::nulltask;
+		return p->ch->send(next++);
+	}));
+	return 0;
+}
+
+static void * spsc_producer_thread(void * ctx)
+{
+	yb::concurrent_channel<int, yb::cc_spsc> & ch = *(yb::concurrent_channel<int, yb::cc_spsc> *)ctx;
+	for (int i = 0; i < 20000; ++i)
+	{
+		while (!ch.try_send(i))
+			sched_yield();
+	}
+	return 0;
+}
+
+template <typename Channel>
+static yb::task<void> receive_values(Channel const & ch, size_t count, long long & sum)
+{
+	return yb::loop([ch, count, &sum](yb::cancel_level) mutable -> yb::task<void> {
+		if (count == 0)
+			return yb::nulltask;
+		--count;
+		return ch.receive().then([&sum](int value) { sum += value; });
+	});
+}
+
+TEST_CASE(ConcurrentChannel, "channel_task async_runner")
+{
+	{
+		yb::concurrent_channel<int> ch = yb::concurrent_channel<int>::create(3);
+		assert(ch.capacity() == 4);
+		for (int i = 0; i < 4; ++i)
+			assert(ch.try_send(i));
+		assert(!ch.try_send(4));
+
+		// The send completes once the receiver makes room.
+		yb::task<void> t = ch.send(4);
+		assert(!t.has_result());
+		assert(yb::sync_runner().run(ch.receive()) == 0);
+		yb::sync_runner().run(std::move(t));
+		for (int i = 1; i < 5; ++i)
+			assert(yb::sync_runner().run(ch.receive()) == i);
+
+		yb::async_runner runner;
+		yb::async_future<int> f = runner.post(ch.receive());
+		runner.run(yb::wait_ms(1));
+		f.cancel(yb::cl_abort);
+		assert(f.wait().has_exception());
+	}
+
+	// Producer threads hand the values over to two runners.
+	{
+		static int const producer_count = 4;
+		static int const value_count = 5000;
+
+		yb::concurrent_channel<int> ch = yb::concurrent_channel<int>::create(8);
+		yb::async_runner r1(yb::rb_poll);
+		yb::async_runner r2(yb::rb_epoll);
+		long long sum1 = 0, sum2 = 0;
+		yb::async_future<void> f1 = r1.post(receive_values(ch, producer_count * value_count / 2, sum1));
+		yb::async_future<void> f2 = r2.post(receive_values(ch, producer_count * value_count / 2, sum2));
+
+		std::vector<channel_producer> producers(producer_count);
+		std::vector<pthread_t> threads(producer_count);
+		for (int i = 0; i < producer_count; ++i)
+		{
+			producers[i].ch = &ch;
+			producers[i].first = i * value_count;
+			producers[i].count = value_count;
+			int r = pthread_create(&threads[i], 0, &channel_producer_thread, &producers[i]);
+			assert(r == 0);
+		}
+
+		for (int i = 0; i < producer_count; ++i)
+			pthread_join(threads[i], 0);
+		f1.get();
+		f2.get();
+
+		long long n = producer_count * value_count;
+		assert(sum1 + sum2 == n * (n - 1) / 2);
+	}
+
+	{
+		yb::concurrent_channel<int, yb::cc_spsc> ch = yb::concurrent_channel<int, yb::cc_spsc>::create(16);
+		yb::async_runner runner;
+		long long sum = 0;
+		yb::async_future<void> f = runner.post(receive_values(ch, 20000, sum));
+
+		pthread_t thread;
+		int r = pthread_create(&thread, 0, &spsc_producer_thread, &ch);
+		assert(r == 0);
+		pthread_join(thread, 0);
+		f.get();
+		assert(sum == 20000LL * 19999 / 2);
+	}
+}
+
+// A poll whose canceller refuses to kill it; the token counts the owners
+// of the canceller.
+static yb::task<short> unkillable_poll(int fd, std::shared_ptr<int> const & token)
+{
+	return yb::make_linux_pollfd_task(token, fd, POLLIN, [](yb::cancel_level) { return true; });
+}
+
+TEST_CASE(DeferredTeardown, "sync_runner async_runner")
+{
+	int fds[2];
+	int r = pipe(fds);
+	assert(r == 0);
+
+	std::shared_ptr<int> token(new int(0));
+	char c = 1;
+
+	{
+		yb::sync_runner runner;
+		yb::timer tmr;
+
+		// Dropped by a continuation, the poll doesn't block the runner,
+		// the runner finishes it later instead.
+		std::unique_ptr<yb::task<short> > t(new yb::task<short>(unkillable_poll(fds[0], token)));
+		runner.run(tmr.wait_ms(1).then([&t] { t.reset(); }));
+		assert(!t && token.use_count() == 2);
+
+		r = write(fds[1], &c, 1);
+		assert(r == 1);
+		runner.run(tmr.wait_ms(1));
+		assert(token.use_count() == 1);
+
+		// Blocking teardown can still be asked for; the pipe is readable,
+		// so it returns right away.
+		t.reset(new yb::task<short>(unkillable_poll(fds[0], token)));
+		runner.run(tmr.wait_ms(1).then([&t] {
+			yb::scoped_blocking_teardown blocking;
+			t.reset();
+		}));
+		assert(token.use_count() == 1);
+
+		// A poll of a borrowed fd isn't left to the runner, it waits
+		// right away (the pipe is still readable).
+		t.reset(new yb::task<short>(yb::make_linux_pollfd_task(fds[0], POLLIN, [token](yb::cancel_level) { return true; })));
+		runner.run(tmr.wait_ms(1).then([&t] { t.reset(); }));
+		assert(token.use_count() == 1);
+
+		r = read(fds[0], &c, 1);
+		assert(r == 1);
+	}
+
+	{
+		yb::async_runner runner;
+		yb::timer tmr;
+
+		std::unique_ptr<yb::task<short> > t(new yb::task<short>(unkillable_poll(fds[0], token)));
+		runner.run(tmr.wait_ms(1).then([&t] { t.reset(); }));
+		assert(!t && token.use_count() == 2);
+
+		r = write(fds[1], &c, 1);
+		assert(r == 1);
+		while (token.use_count() != 1)
+			sched_yield();
+
+		r = read(fds[0], &c, 1);
+		assert(r == 1);
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST_CASE(TimerWheel, "timer_task")
+{
+	yb::detail::linux_timer_wheel wheel;
+	uint64_t t0 = wheel.time();
+
+	// The deadlines are spread over all levels of the wheel
+	// and the overflow list.
+	static size_t const entry_count = 200;
+	std::vector<yb::detail::linux_timer_entry> entries(entry_count);
+	std::vector<uint64_t> deadlines;
+	for (size_t i = 0; i < entry_count; ++i)
+	{
+		entries[i].deadline = t0 + ((uint64_t)1 << (i % 40)) + i * 13;
+		wheel.arm(entries[i], 0, i);
+		if (i % 5 == 0)
+			yb::detail::linux_timer_wheel::disarm(entries[i]);
+		else
+			deadlines.push_back(entries[i].deadline);
+	}
+
+	std::sort(deadlines.begin(), deadlines.end());
+	for (size_t i = 0; i < deadlines.size(); ++i)
+	{
+		wheel.advance(deadlines[i] - 1);
+		for (size_t j = 0; j < entry_count; ++j)
+			assert(entries[j].fired == (j % 5 != 0 && entries[j].deadline < deadlines[i]));
+
+		wheel.advance(deadlines[i]);
+		for (size_t j = 0; j < entry_count; ++j)
+			assert(entries[j].fired == (j % 5 != 0 && entries[j].deadline <= deadlines[i]));
+	}
+
+	assert(wheel.expire().size() == deadlines.size());
+	for (size_t i = 0; i < entry_count; ++i)
+		yb::detail::linux_timer_wheel::disarm(entries[i]);
+	assert(!wheel.has_fired());
+
+	// Overlapping slack windows collapse into a few expirations.
+	std::vector<yb::detail::linux_timer_entry> slacked(100);
+	uint64_t t1 = wheel.time() + 1000;
+	for (size_t i = 0; i < slacked.size(); ++i)
+	{
+		slacked[i].deadline = t1 + i;
+		slacked[i].slack = 1000;
+		wheel.arm(slacked[i], 0, i);
+	}
+
+	std::vector<uint64_t> expirations;
+	std::vector<bool> seen(slacked.size());
+	size_t fired = 0;
+	for (uint64_t t = t1; t <= t1 + 1100; ++t)
+	{
+		wheel.advance(t);
+		for (size_t i = 0; i < slacked.size(); ++i)
+		{
+			if (slacked[i].fired && !seen[i])
+			{
+				seen[i] = true;
+				assert(t >= slacked[i].deadline && t <= slacked[i].deadline + slacked[i].slack);
+				if (expirations.empty() || expirations.back() != t)
+					expirations.push_back(t);
+				++fired;
+			}
+		}
+	}
+
+	assert(fired == slacked.size());
+	assert(expirations.size() <= 3);
+
+	for (size_t i = 0; i < slacked.size(); ++i)
+		yb::detail::linux_timer_wheel::disarm(slacked[i]);
+}
+
+#endif // __linux__
+
 int main(int argc, char * argv[])
 {
 	run_tests(argc, argv);
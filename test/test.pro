@@ -2,6 +2,13 @@ TEMPLATE = app
 CONFIG += console
 CONFIG -= qt
 
-SOURCES += main.cpp test.cpp memmock.cpp shupito_flash.cpp
+SOURCES += main.cpp test.cpp memmock.cpp shupito_flash.cpp bench.cpp
 
 include(../libyb.pri)
+
+# The coroutine support and its tests need C++20;
+# build them with `qmake CONFIG+=coroutines`.
+coroutines {
+    CONFIG -= c++11
+    QMAKE_CXXFLAGS += -std=c++20
+}